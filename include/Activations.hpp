@@ -1,18 +1,81 @@
 #pragma once
 #include <cmath>
 
-enum ActivationFunction { RELU, SIGMOID, NONE };
+// Activations are not stored in weight files, so new kinds can be appended freely
+enum ActivationFunction { RELU, SIGMOID, NONE, TANH, LEAKY_RELU, GELU };
 
+// Slope of LEAKY_RELU for negative inputs
+constexpr float LEAKY_RELU_SLOPE = 0.01f;
+
+// Scalar reference versions. Whole buffers should go through the vectorized kernels in
+// VectorMath.hpp instead.
 inline float relu(float x) {
   return x > 0 ? x : 0;
 }
 inline float reluDerivative(float x) {
   return x > 0 ? 1.0f : 0.0f;
 }
+inline float leakyRelu(float x) {
+  return x > 0 ? x : LEAKY_RELU_SLOPE * x;
+}
+inline float leakyReluDerivative(float x) {
+  return x > 0 ? 1.0f : LEAKY_RELU_SLOPE;
+}
 inline float sigmoid(float x) {
   return 1.0f / (1.0f + expf(-x));
 }
 inline float sigmoidDerivative(float x) {
   float s = sigmoid(x);
   return s * (1.0f - s);
-}
\ No newline at end of file
+}
+inline float tanhDerivative(float x) {
+  float t = std::tanh(x);
+  return 1.0f - t * t;
+}
+// tanh approximation of GELU, x * 0.5 * (1 + tanh(sqrt(2 / pi) * (x + 0.044715 * x^3)))
+inline float gelu(float x) {
+  float u = 0.7978845608f * (x + 0.044715f * x * x * x);
+  return 0.5f * x * (1.0f + std::tanh(u));
+}
+inline float geluDerivative(float x) {
+  float u = 0.7978845608f * (x + 0.044715f * x * x * x);
+  float du = 0.7978845608f * (1.0f + 3.0f * 0.044715f * x * x);
+  float t = std::tanh(u);
+  return 0.5f * (1.0f + t) + 0.5f * x * (1.0f - t * t) * du;
+}
+// He init suits the ReLU family, the rest use Xavier init
+inline bool usesHeInit(ActivationFunction function) {
+  return function == RELU || function == LEAKY_RELU || function == GELU;
+}
+inline float activate(ActivationFunction function, float x) {
+  switch (function) {
+  case RELU:
+    return relu(x);
+  case SIGMOID:
+    return sigmoid(x);
+  case TANH:
+    return std::tanh(x);
+  case LEAKY_RELU:
+    return leakyRelu(x);
+  case GELU:
+    return gelu(x);
+  default:
+    return x;
+  }
+}
+inline float activationDerivative(ActivationFunction function, float x) {
+  switch (function) {
+  case RELU:
+    return reluDerivative(x);
+  case SIGMOID:
+    return sigmoidDerivative(x);
+  case TANH:
+    return tanhDerivative(x);
+  case LEAKY_RELU:
+    return leakyReluDerivative(x);
+  case GELU:
+    return geluDerivative(x);
+  default:
+    return 1.0f;
+  }
+}
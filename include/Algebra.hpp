@@ -1,23 +1,81 @@
 #pragma once
+#include <Activations.hpp>
 #include <Matrix.hpp>
 #include <Tensor3.hpp>
 
-// Computes the cross product of two matrices
+// Every kernel has a version that writes into a caller provided destination, which is
+// resized only when its shape doesn't match. Layers keep those destinations as members so
+// the steady state does not allocate.
+
+// Computes the cross product of two matrices, optionally reading either operand as
+// transposed without materializing the transpose
+template <typename T>
+Matrix<T> cross(const Matrix<T>& m1, const Matrix<T>& m2, bool transposeFirst = false,
+                bool transposeSecond = false);
 template <typename T>
-Matrix<T> cross(Matrix<T> m1, Matrix<T> m2);
+void crossInto(const Matrix<T>& m1, const Matrix<T>& m2, Matrix<T>& out,
+               bool transposeFirst = false, bool transposeSecond = false);
+// View version, the row strides of the views are honoured and out must already have the
+// shape of the result since a view can't be resized
+template <typename T>
+void crossInto(MatrixView<const T> m1, MatrixView<const T> m2, MatrixView<T> out,
+               bool transposeFirst = false, bool transposeSecond = false);
 
 // Computes the transpose of a matrix
 template <typename T>
-Matrix<T> transpose(Matrix<T> m);
+Matrix<T> transpose(const Matrix<T>& m);
+template <typename T>
+void transposeInto(const Matrix<T>& m, Matrix<T>& out);
 
-// Apply a function to every element of a matrix
+// Apply an activation to every element through the vectorized kernels in VectorMath.hpp.
+// Arbitrary functions can still be mapped lazily with apply() from MatrixExpr.hpp.
 template <typename T>
-Matrix<T> apply(Matrix<T> m, T (*function)(T));
+Tensor3<T> apply(const Tensor3<T>& m, ActivationFunction function);
 template <typename T>
-Tensor3<T> apply(Tensor3<T> m, T (*function)(T));
+void applyInPlace(Tensor3<T>& m, ActivationFunction function);
+template <typename T>
+void applyInPlace(Matrix<T>& m, ActivationFunction function);
+
+// Output size along one axis of a convolution whose input gets padding zeros on each side
+int convOutputSize(int inputSize, int filterSize, int stride = 1, int padding = 0);
+
+// Element-wise copy and dst -= scale * src through relaxed atomics, for parameters that
+// several threads read and step without locks in asynchronous training. Each element is
+// loaded and stored atomically but not read-modify-written, so concurrent steps to the same
+// element may overwrite each other, which Hogwild SGD tolerates.
+void relaxedCopy(const float* src, float* dst, size_t n);
+void relaxedSubtractScaled(float* dst, const float* src, float scale, size_t n);
 
+// One row per output position holding the filterSize x filterSize x filterDepth patch it
+// reads, row y * slidesW + x with the patch ordered c * k * k + ky * k + kx. Patches step by
+// stride and read zeros where they overlap the padding.
+template <typename T>
+Matrix<T> im2col(const Tensor3<T>& input, int filterSize, int filterDepth, int stride = 1,
+                 int padding = 0);
+template <typename T>
+void im2colInto(const Tensor3<T>& input, int filterSize, int filterDepth, Matrix<T>& out,
+                int stride = 1, int padding = 0);
+template <typename T>
+void im2colInto(TensorView<const T> input, int filterSize, int filterDepth, Matrix<T>& out,
+                int stride = 1, int padding = 0);
+// Writes into a view that already has the im2col shape, e.g. one sample's rows of a batch
+template <typename T>
+void im2colInto(TensorView<const T> input, int filterSize, int filterDepth, MatrixView<T> out,
+                int stride = 1, int padding = 0);
+
+// The adjoint of im2col: every patch row of cols is added back onto the inputW x inputH x
+// filterDepth pixels it was read from, taps on the padding are dropped. out is resized and
+// overwritten.
+template <typename T>
+void col2imInto(const Matrix<T>& cols, int filterSize, int filterDepth, int inputW, int inputH,
+                Tensor3<T>& out, int stride = 1, int padding = 0);
+// Writes into a contiguous view, whose shape gives the input size
 template <typename T>
-Matrix<T> im2col(Tensor3<T> input, int filterSize, int filterDepth);
+void col2imInto(MatrixView<const T> cols, int filterSize, int filterDepth, TensorView<T> out,
+                int stride = 1, int padding = 0);
 
+// Element-wise product written into out, same as out = hadamard(m1, m2)
 template <typename T>
-Matrix<T> hadamard(Matrix<T> m1, Matrix<T> m2);
\ No newline at end of file
+void hadamardInto(const Matrix<T>& m1, const Matrix<T>& m2, Matrix<T>& out) {
+  out = hadamard(m1, m2);
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+#pragma once
+#include <cstddef>
+
+// Number of heap allocations made through operator new since the program started. The
+// global allocation functions are replaced in AllocationCounter.cpp to keep this count,
+// which lets the training loop check that a warmed up step doesn't allocate.
+size_t heapAllocationCount();
\ No newline at end of file
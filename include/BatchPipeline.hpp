@@ -0,0 +1,73 @@
+#pragma once
+#include <Tensor4.hpp>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Assembles training batches on background threads while the network trains on earlier
+// ones. An epoch is a list of sample indices cut into batches. The workers claim batches in
+// order and fill them through the sample loader, which may augment as it copies. Ready
+// batches wait in a ring of capacity slots, the consumer takes them in order and a slot is
+// refilled once the consumer has moved on. Every batch draws its augmentation from a
+// generator seeded by the epoch seed and its position, so the batches don't depend on which
+// worker built them.
+class BatchPipeline {
+public:
+  // Writes sample index into image (width * height * channels floats) and label (classes
+  // floats), using rng for whatever randomness the sample needs
+  using SampleLoader = std::function<void(int index, std::mt19937& rng, float* image,
+                                          float* label)>;
+  struct Batch {
+    Tensor4<float> images;
+    Tensor4<float> labels;
+  };
+
+private:
+  SampleLoader loader;
+  int width;
+  int height;
+  int channels;
+  int classes;
+  std::vector<Batch> slots;
+  // Batch number each slot holds once it is ready, -1 while it is empty or being filled
+  std::vector<int> ready;
+  std::vector<int> order;
+  int batchSize = 1;
+  int batches = 0;
+  unsigned seed = 0;
+  int firstBatch = 0;
+  // Batches claimed by the workers, handed to the consumer, given back by it, and being
+  // filled right now
+  int claimed = 0;
+  int consumed = 0;
+  int released = 0;
+  int filling = 0;
+  bool stopping = false;
+  double stallSeconds = 0.0;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<std::thread> workers;
+
+  void work();
+
+public:
+  BatchPipeline(SampleLoader loader, int width, int height, int channels, int classes,
+                int threads, int capacity);
+  BatchPipeline(const BatchPipeline&) = delete;
+  BatchPipeline& operator=(const BatchPipeline&) = delete;
+  // Starts an epoch over order in batches of batchSize, the last one taking what is left.
+  // Batches of an unfinished epoch are dropped. An epoch resumed part way passes the number
+  // of the batch order starts at, so its batches are augmented like they would have been.
+  void startEpoch(const std::vector<int>& order, int batchSize, unsigned seed,
+                  int firstBatch = 0);
+  // The next batch of the epoch, null once it is over. The batch stays valid until the
+  // next call, which hands its slot back to the workers.
+  const Batch* next();
+  // Time next() spent waiting for a batch that wasn't ready yet
+  double getStallSeconds() const;
+  void resetStallSeconds();
+  ~BatchPipeline();
+};
\ No newline at end of file
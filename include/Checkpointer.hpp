@@ -0,0 +1,74 @@
+#pragma once
+#include <Network.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes training checkpoints without holding up the training loop. save copies the
+// parameters and optimizer moments into one buffer laid out like the file on the first save
+// and kept from one checkpoint to the next, and a background thread adds the checksums and
+// writes it out. The file is written next to path and renamed over it once it is on disk,
+// so a crash leaves the previous checkpoint whole. The weights are stored as a weight file
+// at a page aligned offset, which load maps like Network::loadWeights does.
+class Checkpointer {
+public:
+  // Where training stopped: the next sample to train is sample of round in epoch, rng is the
+  // shuffling generator as it was when the epoch started and seed the one the run started
+  // from, so a resumed run draws the same shuffles
+  struct Position {
+    int epoch = 0;
+    int round = 0;
+    int sample = 0;
+    unsigned seed = 0;
+    std::mt19937 rng;
+  };
+
+private:
+  std::string path;
+  std::string temporaryPath;
+  std::string directory;
+  // What save copies and the writer turns into a file: the weight file followed by the
+  // optimizer state at stateStart. tensors are the parameters and moments the snapshot was
+  // laid out for and offsets where in it each is copied to, current is scratch space to
+  // check that they are still the network's. The generator is written as text, which takes
+  // at most 624 numbers below 2^32 and the separators.
+  std::vector<uint8_t> snapshot;
+  size_t weightSize = 0;
+  size_t stateStart = 0;
+  size_t stateFloats = 0;
+  std::vector<MatrixView<float>> tensors;
+  std::vector<uint64_t> offsets;
+  std::vector<MatrixView<float>> current;
+  int steps = 0;
+  const char* optimizer = "";
+  Position position;
+  char rngText[624 * 11 + 16];
+  bool busy = false;
+  bool stopping = false;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread writer;
+
+  void layout(Network& net);
+  void run();
+  void write();
+
+public:
+  explicit Checkpointer(std::string path);
+  Checkpointer(const Checkpointer&) = delete;
+  Checkpointer& operator=(const Checkpointer&) = delete;
+  // Starts writing a checkpoint of net at position, unless the last one is still being
+  // written, in which case it returns false without copying anything
+  bool save(Network& net, const Position& position);
+  // Waits for the checkpoint being written, if any
+  void wait();
+  // Replaces net's layers and optimizer state with the ones in the checkpoint at path and
+  // returns where it was written. Throws std::runtime_error if the file can't be read or
+  // doesn't fit the optimizer.
+  static Position load(Network& net, const std::string& path);
+  ~Checkpointer();
+};
\ No newline at end of file
@@ -1,26 +1,106 @@
 #pragma once
 #include <Activations.hpp>
+#include <Fft.hpp>
 #include <Layer.hpp>
 #include <Matrix.hpp>
 #include <vector>
 
+// AUTO picks one of the others for every input shape, see chooseAlgorithm
+enum ConvAlgorithm { IM2COL, DIRECT, WINOGRAD, FFT, AUTO };
+
 class ConvolutionalLayer : public Layer {
 private:
   int filterCount;
   int filterSize;
   int filterDepth;
+  int stride;
+  int padding;
   Matrix<float> flatFilters;
   Matrix<float> biases;
   Matrix<float> flatLastInput;
   Matrix<float> flatActivations;
   Matrix<float> deltas;
+  Matrix<float> flatInputDeltas;
+  // Gradients summed since the last clearGradients, hasGradients is false when that was
+  // the last call and the buffers are stale. Paths that can't add onto weightDeltas in
+  // place compute the pass's gradient into passWeightDeltas first.
+  Matrix<float> weightDeltas;
+  Matrix<float> biasDeltas;
+  Matrix<float> passWeightDeltas;
+  bool hasGradients = false;
+  Tensor4<float> output;
+  Tensor4<float> inputDeltas;
+  // Algorithm used by the last forward pass, backwards and update follow it
+  ConvAlgorithm algorithm = IM2COL;
+  ConvAlgorithm preferredAlgorithm = AUTO;
+  TensorView<const float> lastInput;
+  // Batches of more than one sample go through im2col or the direct kernels. im2col stacks
+  // the samples' matrices; activations and deltas keep one row per filter holding the
+  // positions of every sample, which the GEMM writes to stackedOutput before the output is
+  // regrouped. The direct buffers simply hold one blocked tensor per sample.
+  int batchSize = 1;
+  Tensor4View<const float> lastBatch;
+  Matrix<float> stackedOutput;
+  // Only im2col handles padding itself, the other algorithms run on a padded copy of the
+  // input and have the border cropped off the input gradient
+  Tensor4<float> paddedInput;
+  Tensor4<float> croppedInputDeltas;
+  // Deltas with a filterSize - 1 border, blocked for DIRECT and CHW for WINOGRAD
+  Matrix<float> paddedDeltas;
+  // Direct convolution state, see DirectConv.hpp. Blocked buffers are kept flat.
+  Matrix<float> packedFilters;
+  Matrix<float> packedBackFilters;
+  Matrix<float> packedBiases;
+  Matrix<float> blockedActivations;
+  Matrix<float> blockedInputDeltas;
+  Matrix<float> packedWeightDeltas;
+  // Winograd state, see Winograd.hpp. The filter transforms are only redone when the
+  // filters change, winogradTile is the tile size they were made for or 0 when stale.
+  int winogradTile = 0;
+  Matrix<float> winogradFilters;
+  Matrix<float> winogradBackFilters;
+  Matrix<float> winogradWorkspace;
+  // FFT state, see FftConv.hpp. The filter spectra are cached like the Winograd transforms,
+  // the input and delta spectra are kept for the filter gradient.
+  Fft2d fft;
+  bool fftFiltersReady = false;
+  Matrix<float> fftFilters;
+  Matrix<float> fftInput;
+  Matrix<float> fftDeltas;
+
+  Tensor4View<const float> padInput(Tensor4View<const float> input);
+  Tensor4View<const float> cropPadding(Tensor4View<const float> inputDeltas);
+  void computeDeltas(Tensor4View<const float> prevLayerDeltas);
+  Tensor4View<const float> forwardIm2col(Tensor4View<const float> input);
+  Tensor4View<const float> backwardsIm2col(Tensor4View<const float> prevLayerDeltas);
+  Tensor4View<const float> forwardDirect(Tensor4View<const float> input);
+  Tensor4View<const float> backwardsDirect(Tensor4View<const float> prevLayerDeltas);
+  void computeWeightDeltasDirect(float* weightDeltas);
+  void addBiasDeltasDirect();
+  TensorView<const float> forwardWinograd(TensorView<const float> input);
+  TensorView<const float> backwardsWinograd(TensorView<const float> prevLayerDeltas);
+  TensorView<const float> forwardFft(TensorView<const float> input);
+  TensorView<const float> backwardsFft(TensorView<const float> prevLayerDeltas);
 
 public:
+  // The input gets padding zeros on every side and the filters step by stride pixels, so
+  // outputs are (inputSize + 2 * padding - filterSize) / stride + 1 wide
   ConvolutionalLayer(int filterSize, int filterDepth, int filterCount,
-                     ActivationFunction activation = RELU);
-  Tensor3<float> forward(Tensor3<float> input) override;
-  Tensor3<float> backwards(Tensor3<float> prevLayerDeltas) override;
-  void update(float learningRate) override;
+                     ActivationFunction activation = RELU, int stride = 1, int padding = 0);
+  TensorView<const float> forward(TensorView<const float> input) override;
+  TensorView<const float> backwards(TensorView<const float> prevLayerDeltas) override;
+  Tensor4View<const float> forwardBatch(Tensor4View<const float> input) override;
+  Tensor4View<const float> backwardsBatch(Tensor4View<const float> prevLayerDeltas) override;
+  void accumulateGradients() override;
+  void clearGradients() override;
+  void addGradients(const Layer& replica) override;
+  Layer* clone() const override;
+  void copyParameters(const Layer& source) override;
+  void copyParametersRelaxed(const Layer& shared) override;
+  void applyGradientsRelaxed(Layer& shared, float learningRate, int samples) override;
+  void collectParameters(std::vector<MatrixView<float>>& out) override;
+  void collectGradients(std::vector<MatrixView<float>>& out) override;
+  void invalidateCaches() override;
   void initWeights() override;
   void setFilters(Matrix<float> filters);
   void setBiases(Matrix<float> biases);
@@ -29,5 +109,14 @@ public:
   int getFilterCount();
   int getFilterSize();
   int getFilterDepth();
+  int getStride();
+  int getPadding();
   ActivationFunction getActivation();
+  // Forces an algorithm, AUTO (the default) goes back to picking one per input shape. Batches
+  // run WINOGRAD and FFT through the direct kernels, or im2col where those are unavailable
+  // or narrower than the GEMM kernel.
+  // Throws if the filter size or stride don't allow it.
+  void setAlgorithm(ConvAlgorithm algorithm);
+  // Algorithm the last forward pass ran with
+  ConvAlgorithm getAlgorithm();
 };
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Labelled images kept the way they are stored on disk: one contiguous array of 8 bit
+// pixels, sample after sample, and one class index per sample. Pixels are only turned into
+// floats in [0, 1] and labels into one-hot vectors when a batch is assembled, so the whole
+// set takes a quarter of the memory of float tensors and is shuffled through index
+// permutations instead of moving images around.
+//
+// A dataset is either filled in memory or opened from a file. Files in the native format
+// written by save(), and the pixels of MNIST IDX files, are mapped read only rather than
+// read, so opening one costs no parsing and concurrent runs share the page cache.
+class Dataset {
+private:
+  int count = 0;
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  int classes = 0;
+  std::vector<uint8_t> ownedPixels;
+  std::vector<int32_t> ownedLabels;
+  // Either the owned buffers or the mapped file
+  const uint8_t* pixels = nullptr;
+  const int32_t* labels = nullptr;
+  void* mapping = nullptr;
+  size_t mappingSize = 0;
+
+  void unmap();
+  void checkLabels() const;
+  // Takes the shape and pixels of the mapped IDX image file at path and reads its labels
+  void openIdx(const std::string& path, const std::string& labelPath);
+
+public:
+  Dataset() = default;
+  // count zeroed samples of width x height x channels pixels
+  Dataset(int count, int width, int height, int channels, int classes);
+  Dataset(const Dataset&) = delete;
+  Dataset& operator=(const Dataset&) = delete;
+  Dataset(Dataset&& other) noexcept;
+  Dataset& operator=(Dataset&& other) noexcept;
+  // Opens a file written by save(), or an IDX image file whose labels are in the IDX file
+  // labelPath. Throws std::runtime_error if the file can't be read or is malformed.
+  static Dataset open(const std::string& path, const std::string& labelPath = "");
+  // Writes the native format: a 64 byte header, then the pixels and the labels as int32,
+  // each starting at a multiple of 64 bytes
+  void save(const std::string& path) const;
+  int getSize() const;
+  int getWidth() const;
+  int getHeight() const;
+  int getChannels() const;
+  int getClasses() const;
+  int getImageSize() const;
+  // Pixels of sample index, CHW. Only datasets filled in memory can be written.
+  uint8_t* getImage(int index);
+  const uint8_t* getImage(int index) const;
+  int getLabel(int index) const;
+  void setLabel(int index, int label);
+  // Writes sample index scaled to [0, 1] to image and its one-hot label to label
+  void loadSample(int index, float* image, float* label) const;
+  ~Dataset();
+};
\ No newline at end of file
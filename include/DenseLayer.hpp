@@ -8,15 +8,35 @@ private:
   Matrix<float> weights;
   Matrix<float> biases;
   ActivationFunction activation;
-  Matrix<float> lastInput;
+  // Single samples go through the batched code as batches of one. Inputs, activations and
+  // deltas hold one row per sample.
+  int batchSize = 1;
+  MatrixView<const float> lastInput;
   Matrix<float> activations;
   Matrix<float> deltas;
+  // Gradients summed since the last clearGradients, hasGradients is false when that was
+  // the last call and the buffers are stale
+  Matrix<float> weightDeltas;
+  Matrix<float> biasDeltas;
+  bool hasGradients = false;
+  Tensor4<float> output;
+  Tensor4<float> inputDeltas;
 
 public:
   DenseLayer(int inputSize, int outputSize, ActivationFunction activation = RELU);
-  Tensor3<float> forward(Tensor3<float> input) override;
-  Tensor3<float> backwards(Tensor3<float> prevLayerDeltas) override;
-  void update(float learningRate) override;
+  TensorView<const float> forward(TensorView<const float> input) override;
+  TensorView<const float> backwards(TensorView<const float> prevLayerDeltas) override;
+  Tensor4View<const float> forwardBatch(Tensor4View<const float> input) override;
+  Tensor4View<const float> backwardsBatch(Tensor4View<const float> prevLayerDeltas) override;
+  void accumulateGradients() override;
+  void clearGradients() override;
+  void addGradients(const Layer& replica) override;
+  Layer* clone() const override;
+  void copyParameters(const Layer& source) override;
+  void copyParametersRelaxed(const Layer& shared) override;
+  void applyGradientsRelaxed(Layer& shared, float learningRate, int samples) override;
+  void collectParameters(std::vector<MatrixView<float>>& out) override;
+  void collectGradients(std::vector<MatrixView<float>>& out) override;
   void initWeights() override;
   void setWeights(Matrix<float> weights);
   void setBiases(Matrix<float> biases);
@@ -0,0 +1,48 @@
+#pragma once
+
+// Direct convolution over a channel-blocked layout, the alternative to im2col + GEMM used by
+// ConvolutionalLayer for large inputs. A blocked tensor (CHWc) stores its channels in groups
+// of B = directConvBlock(), the SIMD width, as [channel / B][y][x][channel % B], so one
+// vector load reads the same pixel of B consecutive channels. Channel counts are padded up
+// to a multiple of B with zeros. Plain CHW is the same layout with a block of 1.
+//
+// Filters are packed per output block as [outBlock][inChannel][ky][kx][B]: the kernels
+// broadcast one input value and multiply it with B output channels at once, keeping a row
+// of output pixels in registers, so nothing is ever expanded k * k times.
+
+// Largest filter size the direct kernels handle
+constexpr int MAX_DIRECT_FILTER = 7;
+
+// Channels per block, the SIMD width the library was compiled for (1 without SIMD)
+int directConvBlock();
+// Channels rounded up to a whole number of blocks
+int blockedChannels(int channels);
+
+// Valid convolution: out[outBlock][y][x][B] = bias + sum over c, ky and kx of
+// in(c, y + ky, x + kx) * filters[outBlock][c][ky][kx][B]. in has inBlock channels per
+// block, 1 for plain CHW or directConvBlock() for a blocked tensor. out holds outBlocks
+// blocks of (inW - k + 1) x (inH - k + 1) pixels. bias is blocked too and may be null.
+void directConv(const float* in, int inChannels, int inW, int inH, int inBlock,
+                const float* filters, const float* bias, int outBlocks, int k, float* out);
+
+// Filter gradient of directConv: dFilters[outBlock][c][ky][kx][B] = sum over every output
+// pixel of in(c, y + ky, x + kx) * deltas[outBlock][y + pad][x + pad][B]. deltas carries a
+// border of pad pixels, which lets the padded buffer built for the input gradient be
+// reused. With samples > 1, in and deltas hold that many samples back to back and the
+// gradient is summed over all of them.
+void directConvFilterGradient(const float* in, int inChannels, int inW, int inH, int inBlock,
+                              const float* deltas, int pad, int outBlocks, int k,
+                              float* dFilters, int samples = 1);
+
+// Packs a flat filter matrix (row c * k * k + ky * k + kx, one column per filter) into the
+// forward layout, and into the flipped and transposed layout that computes the input
+// gradient as another directConv over the deltas padded by k - 1.
+void packDirectFilters(const float* flat, int k, int depth, int count, float* forward,
+                       float* backward);
+// Inverse of the forward packing, hands filter gradients back as a flat matrix
+void unpackDirectFilters(const float* packed, int k, int depth, int count, float* flat);
+
+// CHW to blocked, with a zero border of pad pixels on every side
+void toBlocked(const float* chw, int channels, int w, int h, int pad, float* blocked);
+// Blocked to CHW, dropping the padding channels
+void fromBlocked(const float* blocked, int channels, int w, int h, float* chw);
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+
+// Self-contained FFTs for the FFT convolution path of ConvolutionalLayer. Complex data is
+// kept split, a plane of real parts and a plane of imaginary parts, so every butterfly
+// runs over contiguous floats.
+
+// Smallest size >= n whose only prime factors are 2, 3 and 5, the sizes FftPlan handles
+int fftSize(int n);
+
+// Complex DFT of one length, as a Stockham autosort FFT with radix 4, 2, 3 and 5 stages.
+// Plans are immutable once built and may be shared between threads.
+class FftPlan {
+private:
+  int n;
+  std::vector<int> radices;
+  // Twiddles of every stage back to back, real parts then imaginary parts
+  std::vector<float> twiddlesRe;
+  std::vector<float> twiddlesIm;
+
+public:
+  FftPlan();
+  FftPlan(int n);
+  int getSize() const;
+  // Forward DFT of count interleaved transforms in place: element e of transform b is at
+  // re[e * count + b]. work holds 2 * n * count floats. Passing im as re and re as im
+  // computes the unscaled inverse instead.
+  void transform(float* re, float* im, int count, float* work) const;
+};
+
+// 2D FFT of real width x height grids. Spectra keep the width / 2 + 1 non-redundant
+// columns, as a height x (width / 2 + 1) row-major plane of getBins() real parts followed
+// by a plane of imaginary parts.
+class Fft2d {
+private:
+  int w, h;
+  FftPlan rowPlan;
+  FftPlan columnPlan;
+
+public:
+  Fft2d();
+  Fft2d(int width, int height);
+  int getWidth() const;
+  int getHeight() const;
+  int getBins() const;
+  // Spectrum of a srcW x srcH image zero padded to the grid size
+  void forward(const float* src, int srcW, int srcH, float* spectrum) const;
+  // Inverse transform, scaled by 1 / (width * height), of which only the top left
+  // dstW x dstH window is written
+  void inverse(const float* spectrum, float* dst, int dstW, int dstH) const;
+};
\ No newline at end of file
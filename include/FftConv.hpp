@@ -0,0 +1,37 @@
+#pragma once
+#include <Fft.hpp>
+#include <cstddef>
+
+// FFT convolution for stride 1 valid correlations, whose cost doesn't grow with the filter
+// size. Over a grid at least as large as the input, the three passes of a layer become
+// sums of element-wise products of spectra:
+//   forward         out[f]     = IFFT(sum over c of IN[c] * conj(W[f][c]))
+//   input gradient  dIn[c]     = IFFT(sum over f of D[f] * W[f][c])
+//   filter gradient dW[f][c]   = IFFT(IN[c] * conj(D[f])), top left k x k
+// The circular wrap-around of the grid never reaches the pixels that are kept.
+//
+// Tensors are plain CHW. Flat filter matrices have row c * k * k + ky * k + kx and one
+// column per filter, as in ConvolutionalLayer. Spectra are Fft2d spectra of 2 * getBins()
+// floats each, filter spectra ordered [f][c].
+
+// Floats taken by the spectra of count planes
+size_t fftSpectraSize(const Fft2d& fft, int count);
+
+// Spectra of count planes of w x h
+void fftTransformPlanes(const Fft2d& fft, const float* planes, int count, int w, int h,
+                        float* spectra);
+// Spectra of every k x k filter of a depth x count layer
+void fftTransformFilters(const Fft2d& fft, const float* flat, int k, int depth, int count,
+                         float* spectra);
+
+// Forward pass from the input spectra: count planes of outW x outH plus bias (one per
+// filter, may be null)
+void fftCorrelate(const Fft2d& fft, const float* inSpectra, int depth,
+                  const float* filterSpectra, int count, const float* bias, int outW,
+                  int outH, float* out);
+// Input gradient from the delta spectra: depth planes of inW x inH
+void fftInputGradient(const Fft2d& fft, const float* deltaSpectra, int count,
+                      const float* filterSpectra, int depth, int inW, int inH, float* out);
+// Filter gradient from the input and delta spectra, written as a flat filter matrix
+void fftFilterGradient(const Fft2d& fft, const float* inSpectra, int depth,
+                       const float* deltaSpectra, int count, int k, float* flat);
\ No newline at end of file
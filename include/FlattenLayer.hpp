@@ -8,8 +8,11 @@ private:
 
 public:
   FlattenLayer(int inputWidth, int inputHeight, int inputDepth);
-  Tensor3<float> forward(Tensor3<float> input) override;
-  Tensor3<float> backwards(Tensor3<float> prevLayerDeltas) override;
+  TensorView<const float> forward(TensorView<const float> input) override;
+  TensorView<const float> backwards(TensorView<const float> prevLayerDeltas) override;
+  Tensor4View<const float> forwardBatch(Tensor4View<const float> input) override;
+  Tensor4View<const float> backwardsBatch(Tensor4View<const float> prevLayerDeltas) override;
+  Layer* clone() const override;
   int getInputWidth();
   int getInputHeight();
   int getInputDepth();
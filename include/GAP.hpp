@@ -5,11 +5,16 @@ class GAP : public Layer {
 private:
   int inputWidth;
   int inputHeight;
+  Tensor4<float> output;
+  Tensor4<float> inputDeltas;
 
 public:
   GAP(int inputWidth, int inputHeight, ActivationFunction activation = ActivationFunction::NONE);
-  Tensor3<float> forward(Tensor3<float> input) override;
-  Tensor3<float> backwards(Tensor3<float> prevLayerDeltas) override;
+  TensorView<const float> forward(TensorView<const float> input) override;
+  TensorView<const float> backwards(TensorView<const float> prevLayerDeltas) override;
+  Tensor4View<const float> forwardBatch(Tensor4View<const float> input) override;
+  Tensor4View<const float> backwardsBatch(Tensor4View<const float> prevLayerDeltas) override;
+  Layer* clone() const override;
   int getInputWidth() const {
     return inputWidth;
   }
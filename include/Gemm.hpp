@@ -0,0 +1,31 @@
+#pragma once
+#include <Activations.hpp>
+
+enum BiasMode { NO_BIAS, ROW_BIAS, COLUMN_BIAS };
+
+// Work finished on each output tile as soon as its last k block is computed, while the
+// tile is still hot, instead of in separate passes over C. The result is
+// activation(op(A) * op(B) + bias); bias has one entry per row of C for ROW_BIAS and one
+// per column for COLUMN_BIAS. When preActivations is set it receives op(A) * op(B) + bias
+// with row stride ldp, which is what the layers keep for the backward pass.
+struct GemmEpilogue {
+  const float* bias = nullptr;
+  BiasMode biasMode = NO_BIAS;
+  ActivationFunction activation = NONE;
+  float* preActivations = nullptr;
+  int ldp = 0;
+};
+
+// Single precision matrix multiply on row-major buffers: C[m x n] = op(A) * op(B), where
+// op(A) is m x k and op(B) is k x n. With transA set A is stored as a k x m matrix and read
+// transposed in place, likewise transB reads a stored n x k B. lda, ldb and ldc are the
+// row strides of the buffers as stored. When accumulate is set the product is added to
+// the existing contents of C instead of overwriting them. The optional epilogue is applied
+// after accumulation.
+void sgemm(bool transA, bool transB, int m, int n, int k, const float* a, int lda,
+           const float* b, int ldb, float* c, int ldc, bool accumulate = false,
+           const GemmEpilogue* epilogue = nullptr);
+
+// Name of the micro-kernel picked at runtime ("avx512", "avx2" or "scalar").
+// Setting CNN_GEMM_KERNEL in the environment forces a specific one.
+const char* sgemmKernelName();
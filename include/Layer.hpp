@@ -1,8 +1,12 @@
 #pragma once
 #include <Activations.hpp>
 #include <Tensor3.hpp>
+#include <Tensor4.hpp>
+#include <vector>
 
-enum LayerType { DENSE, CONVOLUTIONAL, MAXPOOL, FLATTEN, GAP_LAYER };
+// STRIDED_CONVOLUTIONAL is a convolutional layer saved with its stride and padding, plain
+// CONVOLUTIONAL records keep the original layout so older files still load
+enum LayerType { DENSE, CONVOLUTIONAL, MAXPOOL, FLATTEN, GAP_LAYER, STRIDED_CONVOLUTIONAL };
 
 class Layer {
 protected:
@@ -10,9 +14,35 @@ protected:
 
 public:
   Layer(ActivationFunction activation = ActivationFunction::NONE) : activation(activation) {};
-  virtual Tensor3<float> forward(Tensor3<float> input) = 0;
-  virtual Tensor3<float> backwards(Tensor3<float> prevLayerDeltas) = 0;
-  virtual void update(float learningRate) {};
+  // Layers own the tensors they return, which stay valid until the next call to the same
+  // method, and reuse them across samples. The input passed to forward must stay alive
+  // until accumulateGradients() since layers read it again instead of keeping a copy.
+  virtual TensorView<const float> forward(TensorView<const float> input) = 0;
+  virtual TensorView<const float> backwards(TensorView<const float> prevLayerDeltas) = 0;
+  // The same passes over a whole mini-batch, with the same ownership rules
+  virtual Tensor4View<const float> forwardBatch(Tensor4View<const float> input) = 0;
+  virtual Tensor4View<const float> backwardsBatch(Tensor4View<const float> prevLayerDeltas) = 0;
+  // Adds the parameter gradients of the last backwards pass, summed over its samples, to the
+  // gradient buffers collectGradients exposes. They keep adding up until clearGradients,
+  // which the optimizer step is followed by. addGradients adds the buffers of a replica.
+  virtual void accumulateGradients() {};
+  virtual void clearGradients() {};
+  virtual void addGradients(const Layer& replica) {};
+  // A copy with the same configuration and parameters but buffers of its own, and the
+  // copy of another replica's parameters into this one
+  virtual Layer* clone() const = 0;
+  virtual void copyParameters(const Layer& source) {};
+  // Asynchronous (Hogwild) counterparts: a replica reads the parameters of, and applies its
+  // step to, a layer that other threads update at the same time, see relaxedCopy
+  virtual void copyParametersRelaxed(const Layer& shared) {};
+  virtual void applyGradientsRelaxed(Layer& shared, float learningRate, int samples) {};
+  // Appends views of the parameters and of their gradient buffers, in the same order, for
+  // the optimizer and for exchanging them between processes
+  virtual void collectParameters(std::vector<MatrixView<float>>& out) {};
+  virtual void collectGradients(std::vector<MatrixView<float>>& out) {};
+  // Drops whatever the layer derived from its parameters, for when they were changed from
+  // outside the layer, by the optimizer for one
+  virtual void invalidateCaches() {};
   virtual void initWeights() {};
   virtual ~Layer() = default;
 };
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include <Dataset.hpp>
+#include <cstdint>
+#include <matio.h>
+#include <string>
+#include <vector>
+
+// Reads an MNIST style .mat file a range of samples at a time, so the file never has to fit
+// in memory. The data variable holds one image per column, as double or uint8 pixels, and
+// the label variable one class per sample. Every read is a matio hyperslab of consecutive
+// columns, converted to bytes as it arrives.
+class MatReader {
+private:
+  mat_t* file = nullptr;
+  matvar_t* data = nullptr;
+  matvar_t* labels = nullptr;
+  int count = 0;
+  int imageSize = 0;
+  // Factor taking double pixels to [0, 255], picked from the first samples of the file
+  double pixelScale = 1.0;
+  // One read in the element type of the file
+  std::vector<uint8_t> raw;
+
+  // Reads the n images, or labels, from sample first on into raw
+  void readSlab(matvar_t* variable, int first, int n, bool images);
+  void close();
+
+public:
+  // Throws std::runtime_error if the file or its variables can't be read
+  explicit MatReader(const std::string& path);
+  MatReader(const MatReader&) = delete;
+  MatReader& operator=(const MatReader&) = delete;
+  int getSize() const;
+  int getImageSize() const;
+  // Reads samples [first, first + n) of the file into out, starting at its sample at
+  void read(int first, int n, Dataset& out, int at);
+  ~MatReader();
+};
\ No newline at end of file
@@ -1,34 +1,79 @@
 #pragma once
+#include <MatrixExpr.hpp>
+#include <Storage.hpp>
+#include <TensorView.hpp>
 #include <iostream>
 #include <vector>
 
-template <typename T>
-class Matrix {
+// Storage is the policy that allocates the elements, see Storage.hpp
+template <typename T, typename Storage = DefaultStorage>
+class Matrix : public MatrixExpr<Matrix<T, Storage>> {
 private:
   T* values;
   int numRows;
   int numCols;
+  // Set for matrices over memory they don't own, see borrow
+  bool borrowed = false;
 
 public:
+  using value_type = T;
+
   Matrix();
   Matrix(int c, int r);
   Matrix(std::vector<T> vals, int cols);
-  Matrix(const Matrix<T>& other);
-  Matrix(Matrix<T>&& other) noexcept;
-  int getNumCols();
-  int getNumRows();
+  Matrix(const Matrix<T, Storage>& other);
+  Matrix(Matrix<T, Storage>&& other) noexcept;
+  template <typename E>
+  Matrix(const MatrixExpr<E>& expr);
+  // A matrix over values it doesn't own, such as a mapped file, which must outlive it. The
+  // values are never freed, resizing to another element count gives the matrix a buffer of
+  // its own and copies own theirs as usual. values must be STORAGE_ALIGNMENT aligned.
+  static Matrix<T, Storage> borrow(T* values, int cols, int rows);
+  int getNumCols() const;
+  int getNumRows() const;
   T* getValues();
-  T getValue(int x, int y);
+  const T* getValues() const;
+  MatrixView<T> view();
+  MatrixView<const T> view() const;
+  T getValue(int x, int y) const;
   void setValue(int x, int y, T value);
-  Matrix<T>& operator=(const Matrix<T>& m);
-  Matrix<T> operator+(const Matrix<T>& m);
-  Matrix<T> operator-(const Matrix<T>& m);
-  template <typename U>
-  Matrix<T> operator*(const U& num);
-  template <typename U>
-  Matrix<T> operator/(const U& num);
+  // Changes the shape, reusing the buffer when the element count doesn't change.
+  // Contents are unspecified afterwards.
+  void resize(int c, int r);
+  T operator[](int i) const {
+    return this->values[i];
+  }
+  Matrix<T, Storage>& operator=(const Matrix<T, Storage>& m);
+  Matrix<T, Storage>& operator=(Matrix<T, Storage>&& m) noexcept;
+  template <typename E>
+  Matrix<T, Storage>& operator=(const MatrixExpr<E>& expr);
   ~Matrix();
 
-  template <typename U>
-  friend std::ostream& operator<<(std::ostream& os, const Matrix<U>& m);
+  template <typename U, typename S>
+  friend std::ostream& operator<<(std::ostream& os, const Matrix<U, S>& m);
 };
+
+template <typename T, typename Storage>
+template <typename E>
+Matrix<T, Storage>::Matrix(const MatrixExpr<E>& expr)
+    : Matrix(expr.self().getNumCols(), expr.self().getNumRows()) {
+  *this = expr;
+}
+
+// Evaluates the whole expression in one pass. Every node is element-wise, so the
+// expression may safely read this matrix while it is being overwritten.
+template <typename T, typename Storage>
+template <typename E>
+Matrix<T, Storage>& Matrix<T, Storage>::operator=(const MatrixExpr<E>& expr) {
+  const E& e = expr.self();
+  int cols = e.getNumCols();
+  int rows = e.getNumRows();
+  this->resize(cols, rows);
+  int n = cols * rows;
+  T* out = this->values;
+#pragma omp simd
+  for (int i = 0; i < n; i++) {
+    out[i] = e[i];
+  }
+  return *this;
+}
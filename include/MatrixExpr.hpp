@@ -0,0 +1,140 @@
+#pragma once
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+
+// Lazily evaluated element-wise matrix expressions. Operators build a tree of lightweight
+// nodes and nothing is computed until the tree is assigned to a Matrix, which then runs a
+// single fused loop writing straight into its own buffer, e.g.
+//   weights = weights - gradients * learningRate;
+// makes one pass and allocates no temporaries. Expressions hold references to the matrices
+// they read, so they must be consumed within the statement that builds them.
+
+template <typename T, typename Storage>
+class Matrix;
+
+template <typename E>
+class MatrixExpr {
+public:
+  const E& self() const {
+    return static_cast<const E&>(*this);
+  }
+};
+
+template <typename E>
+struct IsMatrix : std::false_type {};
+template <typename T, typename Storage>
+struct IsMatrix<Matrix<T, Storage>> : std::true_type {};
+
+// Matrices are referenced, intermediate nodes are small and are kept by value
+template <typename E>
+using ExprOperand = std::conditional_t<IsMatrix<E>::value, const E&, const E>;
+
+template <typename L, typename R, typename Op>
+class MatrixBinaryExpr : public MatrixExpr<MatrixBinaryExpr<L, R, Op>> {
+private:
+  ExprOperand<L> lhs;
+  ExprOperand<R> rhs;
+
+public:
+  using value_type = typename L::value_type;
+
+  MatrixBinaryExpr(const L& lhs, const R& rhs) : lhs(lhs), rhs(rhs) {
+    if (lhs.getNumCols() != rhs.getNumCols() || lhs.getNumRows() != rhs.getNumRows()) {
+      throw std::invalid_argument("Matrices dimensions don't match");
+    }
+  }
+  int getNumCols() const {
+    return this->lhs.getNumCols();
+  }
+  int getNumRows() const {
+    return this->lhs.getNumRows();
+  }
+  value_type operator[](int i) const {
+    return Op()(this->lhs[i], this->rhs[i]);
+  }
+};
+
+template <typename E, typename Op>
+class MatrixScalarExpr : public MatrixExpr<MatrixScalarExpr<E, Op>> {
+public:
+  using value_type = typename E::value_type;
+
+private:
+  ExprOperand<E> expr;
+  value_type scalar;
+
+public:
+  MatrixScalarExpr(const E& expr, value_type scalar) : expr(expr), scalar(scalar) {}
+  int getNumCols() const {
+    return this->expr.getNumCols();
+  }
+  int getNumRows() const {
+    return this->expr.getNumRows();
+  }
+  value_type operator[](int i) const {
+    return Op()(this->expr[i], this->scalar);
+  }
+};
+
+template <typename E, typename F>
+class MatrixMapExpr : public MatrixExpr<MatrixMapExpr<E, F>> {
+private:
+  ExprOperand<E> expr;
+  F function;
+
+public:
+  using value_type = typename E::value_type;
+
+  MatrixMapExpr(const E& expr, F function) : expr(expr), function(function) {}
+  int getNumCols() const {
+    return this->expr.getNumCols();
+  }
+  int getNumRows() const {
+    return this->expr.getNumRows();
+  }
+  value_type operator[](int i) const {
+    return this->function(this->expr[i]);
+  }
+};
+
+template <typename L, typename R>
+MatrixBinaryExpr<L, R, std::plus<>> operator+(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs) {
+  return MatrixBinaryExpr<L, R, std::plus<>>(lhs.self(), rhs.self());
+}
+
+template <typename L, typename R>
+MatrixBinaryExpr<L, R, std::minus<>> operator-(const MatrixExpr<L>& lhs,
+                                               const MatrixExpr<R>& rhs) {
+  return MatrixBinaryExpr<L, R, std::minus<>>(lhs.self(), rhs.self());
+}
+
+template <typename E, typename U>
+  requires std::is_arithmetic_v<U>
+MatrixScalarExpr<E, std::multiplies<>> operator*(const MatrixExpr<E>& expr, const U& num) {
+  return MatrixScalarExpr<E, std::multiplies<>>(expr.self(),
+                                                static_cast<typename E::value_type>(num));
+}
+
+template <typename E, typename U>
+  requires std::is_arithmetic_v<U>
+MatrixScalarExpr<E, std::divides<>> operator/(const MatrixExpr<E>& expr, const U& num) {
+  auto factor = static_cast<typename E::value_type>(num);
+  if (factor == static_cast<typename E::value_type>(0)) {
+    throw std::invalid_argument("Potential division by 0");
+  }
+  return MatrixScalarExpr<E, std::divides<>>(expr.self(), factor);
+}
+
+// Element-wise product of two matrices
+template <typename L, typename R>
+MatrixBinaryExpr<L, R, std::multiplies<>> hadamard(const MatrixExpr<L>& m1,
+                                                   const MatrixExpr<R>& m2) {
+  return MatrixBinaryExpr<L, R, std::multiplies<>>(m1.self(), m2.self());
+}
+
+// Apply a function to every element of a matrix
+template <typename E, typename F>
+MatrixMapExpr<E, F> apply(const MatrixExpr<E>& m, F function) {
+  return MatrixMapExpr<E, F>(m.self(), function);
+}
\ No newline at end of file
@@ -8,12 +8,17 @@ private:
   int poolDepth;
   int inputWidth;
   int inputHeight;
-  std::vector<std::vector<int>> maxIndexes;
+  std::vector<int> maxIndexes;
+  Tensor4<float> output;
+  Tensor4<float> inputDeltas;
 
 public:
   MaxPoolLayer(int size, int depth);
-  Tensor3<float> forward(Tensor3<float> input) override;
-  Tensor3<float> backwards(Tensor3<float> prevLayerDeltas) override;
+  TensorView<const float> forward(TensorView<const float> input) override;
+  TensorView<const float> backwards(TensorView<const float> prevLayerDeltas) override;
+  Tensor4View<const float> forwardBatch(Tensor4View<const float> input) override;
+  Tensor4View<const float> backwardsBatch(Tensor4View<const float> prevLayerDeltas) override;
+  Layer* clone() const override;
   int getPoolSize();
   int getPoolDepth();
 };
\ No newline at end of file
@@ -1,19 +1,117 @@
 #pragma once
 #include <Layer.hpp>
+#include <Optimizer.hpp>
+#include <RingAllreduce.hpp>
 #include <Tensor3.hpp>
+#include <Tensor4.hpp>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 class Network {
 private:
   std::vector<Layer*> layers;
+  Tensor3<float> output;
+  Tensor3<float> outputDeltas;
+  Tensor4<float> batchOutput;
+  Tensor4<float> batchOutputDeltas;
+  // Owned, see setOptimizer. accumulatedSamples counts the samples the layers' gradient
+  // buffers were summed over since the last step, lastBatchSize those of the last backwards.
+  Optimizer* optimizer;
+  int accumulatedSamples = 0;
+  int lastBatchSize = 0;
+  std::vector<MatrixView<float>> parameterViews;
+  std::vector<MatrixView<float>> gradientViews;
+  // Data-parallel training state. Worker t > 0 of trainBatch runs on replicas[t - 1], clones
+  // of layers refreshed from them every batch; trainAsync only trains replicas, worker t
+  // uses replicas[t]. Every worker has its own output buffers.
+  int threads = 1;
+  std::vector<std::vector<Layer*>> replicas;
+  std::vector<Tensor4<float>> workerOutputs;
+  std::vector<Tensor4<float>> workerDeltas;
+  // Processes training together, see RingAllreduce. Not owned, null for a single process.
+  RingAllreduce* communicator = nullptr;
+  std::vector<MatrixView<float>> exchanged;
+  // Weight file the layers' parameters point into, mapped copy on write so processes that
+  // load the same file share its pages until they change them. Null when every layer owns
+  // its parameters.
+  void* weightMapping = nullptr;
+  size_t weightMappingSize = 0;
+
+  void prepareWorkers(int workers);
+  void clearReplicas();
+  // Deletes the layers and their replicas and unmaps the weight file
+  void clearLayers();
+  // Reads the unversioned format written before the current one
+  bool loadLegacyWeights(std::string path);
 
 public:
-  Network() = default;
+  Network();
+  Network(const Network&) = delete;
+  Network& operator=(const Network&) = delete;
   void addLayer(Layer* layer);
-  Tensor3<float> forward(Tensor3<float> input);
-  void backwards(Tensor3<float> result, Tensor3<float> expected);
-  void update(float learningRate);
+  // The returned tensor is owned by the network and is overwritten by the next call.
+  // input must stay alive until accumulateGradients() is called.
+  const Tensor3<float>& forward(const Tensor3<float>& input);
+  void backwards(const Tensor3<float>& result, const Tensor3<float>& expected);
+  // The same over a mini-batch, one softmax output per sample
+  const Tensor4<float>& forwardBatch(const Tensor4<float>& input);
+  void backwardsBatch(const Tensor4<float>& result, const Tensor4<float>& expected);
+  // accumulateGradients adds the gradients of the last backwards pass to the ones summed
+  // since the last step, and step has the optimizer apply their average over all those
+  // samples, so several passes can make up one step. update() does both for a single pass.
+  void accumulateGradients();
+  void step();
+  void update();
+  // Takes ownership of optimizer and drops the previous one with its moments. Networks
+  // start out with plain SGD at a learning rate of 0.01.
+  void setOptimizer(Optimizer* optimizer);
+  Optimizer& getOptimizer();
+  // Appends every layer's parameters, in the order the optimizer steps them
+  void collectParameters(std::vector<MatrixView<float>>& out);
+  // One training step over a mini-batch split across threads: every thread runs forward and
+  // backwards on its own slice, the gradients are summed by a pairwise tree reduction and a
+  // single optimizer step applies their average. Returns the outputs like forwardBatch.
+  const Tensor4<float>& trainBatch(const Tensor4<float>& input, const Tensor4<float>& expected);
+  // Asynchronous (Hogwild) training over input: threads take mini-batches of batchSize as
+  // they become free and each steps the shared parameters as soon as its gradients are
+  // ready, without barriers or a reduction. Steps may start from parameters that are a few
+  // updates old and concurrent steps may overwrite part of each other, which SGD tolerates
+  // on models this size. The steps are plain SGD at the optimizer's learning rate since
+  // moments can't be shared without locks. Returns the outputs like forwardBatch.
+  const Tensor4<float>& trainAsync(const Tensor4<float>& input, const Tensor4<float>& expected,
+                                   int batchSize);
+  // Multi-process training: every rank runs its own network on its share of each batch.
+  // broadcastParameters copies rank 0's parameters to the others once, trainDistributed
+  // then keeps them bit-identical.
+  void setCommunicator(RingAllreduce* communicator);
+  void broadcastParameters();
+  // One step over a batch of totalSamples spread over the ranks, input holding this rank's
+  // share. Each layer's gradients are sent off as soon as its backwards pass is done, so the
+  // transfers overlap with the layers below, and every rank steps with the summed gradients.
+  const Tensor4<float>& trainDistributed(const Tensor4<float>& input,
+                                         const Tensor4<float>& expected, int totalSamples);
+  // Threads trainBatch and trainAsync use, 1 by default
+  void setThreads(int threads);
+  // Writes the layers, their activations and parameters, see the format in Network.cpp
   void saveWeights(std::string path);
-  void loadWeights(std::string path);
+  // The file saveWeights writes, built in two steps so the parameters can be copied out
+  // between training steps and the rest done elsewhere: writeWeightImage copies the layers
+  // into image, getWeightImageSize() bytes that start out zeroed since the padding between
+  // sections is left alone, and sealWeightImage adds the checksum. writeWeightLayout writes
+  // all but the parameters and sets tensors to them and offsets to where each goes, for an
+  // image that is kept and only has its parameters copied in again for every save.
+  size_t getWeightImageSize();
+  void writeWeightImage(uint8_t* image);
+  void writeWeightLayout(uint8_t* image, std::vector<MatrixView<float>>& tensors,
+                         std::vector<uint64_t>& offsets);
+  static void sealWeightImage(uint8_t* image);
+  // Replaces the layers with the ones saved in path, offset bytes into the file, a multiple
+  // of the page size. The file is mapped and the layers' parameters used in place, files
+  // of the older unversioned format are read into memory. Returns false if the file can't
+  // be loaded, leaving the network without layers once it was found valid.
+  bool loadWeights(std::string path, size_t offset = 0);
+  // Puts back optimizer state saved for these parameters, see Optimizer::restoreState
+  void restoreOptimizerState(int steps, const float* state, size_t size);
   ~Network();
 };
\ No newline at end of file
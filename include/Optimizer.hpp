@@ -0,0 +1,111 @@
+#pragma once
+#include <Matrix.hpp>
+#include <TensorView.hpp>
+#include <cstddef>
+#include <vector>
+
+// Turns the gradients the layers accumulated into a parameter update. Network hands over
+// every parameter tensor of the model with its gradient in one call, the gradients being
+// sums over samples. Each optimizer updates a parameter, its gradient and its moment
+// buffers in a single fused pass. The parameters are split into equal chunks spread over
+// the threads, so small bias vectors don't each pay for a parallel region.
+class Optimizer {
+private:
+  struct Chunk {
+    int tensor;
+    size_t begin;
+    size_t count;
+  };
+  std::vector<Chunk> chunks;
+  // momentBuffers() buffers per parameter tensor, shaped like it, in the order step sees them
+  std::vector<Matrix<float>> moments;
+
+  void createMoments(const std::vector<MatrixView<float>>& parameters);
+
+protected:
+  float learningRate;
+  // Steps taken so far, counting the one in progress
+  int steps = 0;
+
+  virtual int momentBuffers() const = 0;
+  // Called once per step before any stepRange, with the samples the gradients are summed
+  // over, to work out the constants the kernels share
+  virtual void beginStep(int samples) = 0;
+  // Updates n consecutive parameters. moments holds momentBuffers() pointers at the same
+  // offset. Called concurrently on disjoint ranges.
+  virtual void stepRange(float* parameters, const float* gradients, float* const* moments,
+                         size_t n) const = 0;
+
+public:
+  explicit Optimizer(float learningRate);
+  Optimizer(const Optimizer&) = delete;
+  Optimizer& operator=(const Optimizer&) = delete;
+  // parameters[i] -= update(gradients[i] / samples). Moment buffers are created on the
+  // first step and the tensors must keep their shapes afterwards.
+  void step(const std::vector<MatrixView<float>>& parameters,
+            const std::vector<MatrixView<float>>& gradients, int samples);
+  // Forgets the moments and the step count, for a model whose parameters were replaced
+  void reset();
+  // Step count and moment buffers, for checkpoints. The state is every buffer collectState
+  // appends in turn, none before the first step. restoreState puts it back, creating the
+  // buffers for parameters like the first step would, and throws std::invalid_argument if
+  // the state doesn't fit them.
+  int getSteps() const;
+  size_t getStateSize() const;
+  void collectState(std::vector<MatrixView<float>>& out);
+  void restoreState(const std::vector<MatrixView<float>>& parameters, int steps,
+                    const float* state, size_t size);
+  // The kind of optimizer as --optimizer names it, which checkpoints record since the state
+  // of one kind can't be resumed by another
+  virtual const char* getName() const = 0;
+  float getLearningRate() const;
+  void setLearningRate(float learningRate);
+  virtual ~Optimizer() = default;
+};
+
+// Plain SGD, or with momentum > 0 heavy ball momentum: v = momentum * v + g and the
+// parameters step by learningRate * v, or by learningRate * (g + momentum * v) with nesterov
+class SgdOptimizer : public Optimizer {
+private:
+  float momentum;
+  bool nesterov;
+  float gradientScale = 1.0f;
+  float stepSize = 0.0f;
+
+protected:
+  int momentBuffers() const override;
+  void beginStep(int samples) override;
+  void stepRange(float* parameters, const float* gradients, float* const* moments,
+                 size_t n) const override;
+
+public:
+  SgdOptimizer(float learningRate, float momentum = 0.0f, bool nesterov = false);
+  const char* getName() const override;
+};
+
+// Adam with bias corrected moments. weightDecay is an L2 penalty added to the gradient,
+// or with decoupledWeightDecay (AdamW) a shrinking of the parameters by
+// learningRate * weightDecay outside the adaptive step.
+class AdamOptimizer : public Optimizer {
+private:
+  float beta1;
+  float beta2;
+  float epsilon;
+  float weightDecay;
+  bool decoupledWeightDecay;
+  float gradientScale = 1.0f;
+  float firstCorrection = 1.0f;
+  float secondCorrection = 1.0f;
+
+protected:
+  int momentBuffers() const override;
+  void beginStep(int samples) override;
+  void stepRange(float* parameters, const float* gradients, float* const* moments,
+                 size_t n) const override;
+
+public:
+  AdamOptimizer(float learningRate, float beta1 = 0.9f, float beta2 = 0.999f,
+                float epsilon = 1e-8f, float weightDecay = 0.0f,
+                bool decoupledWeightDecay = false);
+  const char* getName() const override;
+};
\ No newline at end of file
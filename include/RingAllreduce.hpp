@@ -0,0 +1,67 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sums float buffers across the processes of a data-parallel run. The ranks form a ring,
+// each connected to the next one and accepting from the previous one, over Unix domain
+// sockets on one machine or TCP across machines. Neighbours exchange their ranks when they
+// connect and anything else connecting to a rank is dropped. A buffer is split into one
+// chunk per rank: in workers - 1 reduce-scatter steps every rank adds the chunk it receives
+// to its own and passes it on, after which each chunk is complete on one rank, and
+// workers - 1 allgather steps hand the complete chunks around. Every rank ends up with the
+// bytes the owner of a chunk computed, so the results are bit-identical across ranks.
+// Transfers are split into segments that are added up as they arrive, overlapping the
+// additions with the network.
+class RingAllreduce {
+private:
+  int rank;
+  int workers;
+  int nextSocket = -1;
+  int prevSocket = -1;
+  std::vector<float> scratch;
+  // Background reductions queued by allreduceAsync, run in order by the worker thread
+  struct Job {
+    float* values;
+    size_t count;
+  };
+  std::vector<Job> jobs;
+  size_t nextJob = 0;
+  bool stopping = false;
+  std::exception_ptr failure;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread worker;
+
+  void connectRing(const std::string& listenAddress, const std::string& nextAddress,
+                   bool tcp);
+  // Sends sendBytes to the next rank while receiving recvBytes from the previous one. With
+  // accumulate the received floats are added onto recv, otherwise they overwrite it.
+  void exchange(const void* send, size_t sendBytes, void* recv, size_t recvBytes,
+                bool accumulate);
+  void reduce(float* values, size_t count);
+  void runJobs();
+
+public:
+  // Unix domain sockets at socketPrefix-<rank>, for several processes on one machine
+  RingAllreduce(int rank, int workers, const std::string& socketPrefix);
+  // TCP, hosts holds one host:port per rank and this rank listens on its own address
+  RingAllreduce(int rank, int workers, const std::vector<std::string>& hosts);
+  RingAllreduce(const RingAllreduce&) = delete;
+  RingAllreduce& operator=(const RingAllreduce&) = delete;
+  int getRank() const;
+  int getWorkers() const;
+  // values = sum of values over every rank
+  void allreduce(float* values, size_t count);
+  // The same in the background, in the order the calls were made. The buffer must not be
+  // touched until wait() returns, which rethrows any error of the transfers.
+  void allreduceAsync(float* values, size_t count);
+  void wait();
+  // Copies rank 0's bytes to every rank
+  void broadcast(void* data, size_t bytes);
+  ~RingAllreduce();
+};
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+#include <Dataset.hpp>
+#include <MatReader.hpp>
+#include <random>
+#include <vector>
+
+// Shuffles a file too big for memory through a window of fixed size. The file is read in
+// chunks of consecutive samples, the chunks in a random order, and the window starts out
+// with the first samples streamed. Every sample handed out is drawn at random from the
+// window and its place taken by the next sample streamed, so memory stays at the window and
+// one chunk however big the file is, and samples travel at most a window away from where
+// the chunk order put them. Every holdoutEvery-th sample of the file is held out for
+// testing, the rest are for training.
+class ShuffleBuffer {
+private:
+  MatReader& reader;
+  int holdoutEvery;
+  bool heldOut = false;
+  Dataset window;
+  int filled = 0;
+  Dataset chunk;
+  int chunkFirst = 0;
+  int chunkPosition = 0;
+  int chunkCount = 0;
+  // Samples each chunk starts at, in the order they are streamed this epoch
+  std::vector<int> chunks;
+  size_t nextChunk = 0;
+  std::mt19937 rng;
+
+  bool belongs(int sample) const;
+  // Streams the next sample of the part into slot of the window, false once there is none
+  bool pull(int slot);
+
+public:
+  ShuffleBuffer(MatReader& reader, int classes, int windowSize, int chunkSize,
+                int holdoutEvery);
+  ShuffleBuffer(const ShuffleBuffer&) = delete;
+  ShuffleBuffer& operator=(const ShuffleBuffer&) = delete;
+  // Samples in the training part, or the held out one
+  int getSize(bool heldOut) const;
+  // Rewinds to stream the training or held out part, in an order drawn from seed
+  void start(bool heldOut, unsigned seed);
+  // Moves the next samples, as many as out holds, into out and returns how many it got,
+  // fewer only at the end of the part
+  int read(Dataset& out);
+};
\ No newline at end of file
@@ -0,0 +1,238 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Thin wrappers over one SIMD register type each, picked at compile time from the flags the
+// project is built with. Kernels are written once against the operations below and
+// instantiated for NativeOps, with ScalarOps handling the tails left over by the wider ones.
+// SSE2 is part of x86-64 itself, so it's what a build without CNN_NATIVE_ARCH gets.
+struct ScalarOps {
+  using Vec = float;
+  using Mask = bool;
+  static constexpr int width = 1;
+  static Vec load(const float* p) {
+    return *p;
+  }
+  static void store(float* p, Vec v) {
+    *p = v;
+  }
+  static Vec set(float x) {
+    return x;
+  }
+  static Vec add(Vec a, Vec b) {
+    return a + b;
+  }
+  static Vec sub(Vec a, Vec b) {
+    return a - b;
+  }
+  static Vec mul(Vec a, Vec b) {
+    return a * b;
+  }
+  static Vec div(Vec a, Vec b) {
+    return a / b;
+  }
+  static Vec fmadd(Vec a, Vec b, Vec c) {
+    return a * b + c;
+  }
+  static Vec sqrt(Vec x) {
+    return std::sqrt(x);
+  }
+  static Vec max(Vec a, Vec b) {
+    return a > b ? a : b;
+  }
+  static Vec min(Vec a, Vec b) {
+    return a < b ? a : b;
+  }
+  static Mask greater(Vec a, Vec b) {
+    return a > b;
+  }
+  static Vec select(Mask m, Vec a, Vec b) {
+    return m ? a : b;
+  }
+  static Vec round(Vec x) {
+    return std::nearbyint(x);
+  }
+  // 2^n for an integral n in [-126, 127]
+  static Vec pow2(Vec n) {
+    int32_t bits = ((int32_t)n + 127) << 23;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+  }
+};
+
+#if defined(__AVX512F__)
+struct Avx512Ops {
+  using Vec = __m512;
+  using Mask = __mmask16;
+  static constexpr int width = 16;
+  static Vec load(const float* p) {
+    return _mm512_loadu_ps(p);
+  }
+  static void store(float* p, Vec v) {
+    _mm512_storeu_ps(p, v);
+  }
+  static Vec set(float x) {
+    return _mm512_set1_ps(x);
+  }
+  static Vec add(Vec a, Vec b) {
+    return _mm512_add_ps(a, b);
+  }
+  static Vec sub(Vec a, Vec b) {
+    return _mm512_sub_ps(a, b);
+  }
+  static Vec mul(Vec a, Vec b) {
+    return _mm512_mul_ps(a, b);
+  }
+  static Vec div(Vec a, Vec b) {
+    return _mm512_div_ps(a, b);
+  }
+  static Vec fmadd(Vec a, Vec b, Vec c) {
+    return _mm512_fmadd_ps(a, b, c);
+  }
+  static Vec sqrt(Vec x) {
+    return _mm512_sqrt_ps(x);
+  }
+  static Vec max(Vec a, Vec b) {
+    return _mm512_max_ps(a, b);
+  }
+  static Vec min(Vec a, Vec b) {
+    return _mm512_min_ps(a, b);
+  }
+  static Mask greater(Vec a, Vec b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+  }
+  static Vec select(Mask m, Vec a, Vec b) {
+    return _mm512_mask_blend_ps(m, b, a);
+  }
+  static Vec round(Vec x) {
+    return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static Vec pow2(Vec n) {
+    __m512i bits = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(bits, 23));
+  }
+};
+using NativeOps = Avx512Ops;
+inline constexpr const char* NATIVE_ISA = "avx512";
+#elif defined(__AVX2__) && defined(__FMA__)
+struct Avx2Ops {
+  using Vec = __m256;
+  using Mask = __m256;
+  static constexpr int width = 8;
+  static Vec load(const float* p) {
+    return _mm256_loadu_ps(p);
+  }
+  static void store(float* p, Vec v) {
+    _mm256_storeu_ps(p, v);
+  }
+  static Vec set(float x) {
+    return _mm256_set1_ps(x);
+  }
+  static Vec add(Vec a, Vec b) {
+    return _mm256_add_ps(a, b);
+  }
+  static Vec sub(Vec a, Vec b) {
+    return _mm256_sub_ps(a, b);
+  }
+  static Vec mul(Vec a, Vec b) {
+    return _mm256_mul_ps(a, b);
+  }
+  static Vec div(Vec a, Vec b) {
+    return _mm256_div_ps(a, b);
+  }
+  static Vec fmadd(Vec a, Vec b, Vec c) {
+    return _mm256_fmadd_ps(a, b, c);
+  }
+  static Vec sqrt(Vec x) {
+    return _mm256_sqrt_ps(x);
+  }
+  static Vec max(Vec a, Vec b) {
+    return _mm256_max_ps(a, b);
+  }
+  static Vec min(Vec a, Vec b) {
+    return _mm256_min_ps(a, b);
+  }
+  static Mask greater(Vec a, Vec b) {
+    return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+  }
+  static Vec select(Mask m, Vec a, Vec b) {
+    return _mm256_blendv_ps(b, a, m);
+  }
+  static Vec round(Vec x) {
+    return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static Vec pow2(Vec n) {
+    __m256i bits = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+  }
+};
+using NativeOps = Avx2Ops;
+inline constexpr const char* NATIVE_ISA = "avx2";
+#elif defined(__SSE2__)
+struct Sse2Ops {
+  using Vec = __m128;
+  using Mask = __m128;
+  static constexpr int width = 4;
+  static Vec load(const float* p) {
+    return _mm_loadu_ps(p);
+  }
+  static void store(float* p, Vec v) {
+    _mm_storeu_ps(p, v);
+  }
+  static Vec set(float x) {
+    return _mm_set1_ps(x);
+  }
+  static Vec add(Vec a, Vec b) {
+    return _mm_add_ps(a, b);
+  }
+  static Vec sub(Vec a, Vec b) {
+    return _mm_sub_ps(a, b);
+  }
+  static Vec mul(Vec a, Vec b) {
+    return _mm_mul_ps(a, b);
+  }
+  static Vec div(Vec a, Vec b) {
+    return _mm_div_ps(a, b);
+  }
+  // No FMA before AVX2, rounded twice like ScalarOps
+  static Vec fmadd(Vec a, Vec b, Vec c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+  }
+  static Vec sqrt(Vec x) {
+    return _mm_sqrt_ps(x);
+  }
+  static Vec max(Vec a, Vec b) {
+    return _mm_max_ps(a, b);
+  }
+  static Vec min(Vec a, Vec b) {
+    return _mm_min_ps(a, b);
+  }
+  static Mask greater(Vec a, Vec b) {
+    return _mm_cmpgt_ps(a, b);
+  }
+  static Vec select(Mask m, Vec a, Vec b) {
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+  }
+  // SSE4.1 has the rounding instruction, this converts in the default round to nearest mode
+  // instead, exact for the |x| < 2^31 the kernels round
+  static Vec round(Vec x) {
+    return _mm_cvtepi32_ps(_mm_cvtps_epi32(x));
+  }
+  static Vec pow2(Vec n) {
+    __m128i bits = _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127));
+    return _mm_castsi128_ps(_mm_slli_epi32(bits, 23));
+  }
+};
+using NativeOps = Sse2Ops;
+inline constexpr const char* NATIVE_ISA = "sse2";
+#else
+using NativeOps = ScalarOps;
+inline constexpr const char* NATIVE_ISA = "scalar";
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+
+// Storage policies decide where Matrix and Tensor3 keep their elements. A policy provides
+//   template <typename T> static T* allocate(size_t count);
+//   template <typename T> static void deallocate(T* values, size_t count);
+// and is passed as the second template argument of the container. Every policy returns
+// blocks aligned to STORAGE_ALIGNMENT bytes so rows can be read with aligned SIMD loads.
+
+constexpr size_t STORAGE_ALIGNMENT = 64;
+
+void* alignedAllocate(size_t bytes);
+void alignedDeallocate(void* block);
+// Per-thread pool of aligned blocks grouped in power of two size classes. Freed blocks are
+// kept for the next allocation of the same class instead of going back to the heap, so
+// buffers that are dropped and recreated with the same shapes every sample stop hitting
+// malloc. Blocks may be released on a different thread than the one that allocated them.
+void* pooledAllocate(size_t bytes);
+void pooledDeallocate(void* block, size_t bytes);
+
+// Plain 64 byte aligned heap allocations
+struct AlignedStorage {
+  template <typename T>
+  static T* allocate(size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>, "Storage only holds trivial element types");
+    return static_cast<T*>(alignedAllocate(count * sizeof(T)));
+  }
+  template <typename T>
+  static void deallocate(T* values, size_t) {
+    alignedDeallocate(values);
+  }
+};
+
+// 64 byte aligned blocks recycled through the calling thread's pool
+struct PooledStorage {
+  template <typename T>
+  static T* allocate(size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>, "Storage only holds trivial element types");
+    return static_cast<T*>(pooledAllocate(count * sizeof(T)));
+  }
+  template <typename T>
+  static void deallocate(T* values, size_t count) {
+    pooledDeallocate(values, count * sizeof(T));
+  }
+};
+
+using DefaultStorage = PooledStorage;
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
+#include <Storage.hpp>
+#include <TensorView.hpp>
 
-template <typename T>
+// Storage is the policy that allocates the elements, see Storage.hpp
+template <typename T, typename Storage = DefaultStorage>
 class Tensor3 {
 private:
   int w, h, c;
@@ -9,14 +12,28 @@ private:
 public:
   Tensor3();
   Tensor3(int width, int height, int channels);
-  Tensor3(const Tensor3<T>& other);
-  Tensor3<T>& operator=(const Tensor3<T>& other);
-  int getWidth();
-  int getHeight();
-  int getChannels();
-  T getValue(int x, int y, int z);
+  Tensor3(const Tensor3<T, Storage>& other);
+  Tensor3(Tensor3<T, Storage>&& other) noexcept;
+  Tensor3<T, Storage>& operator=(const Tensor3<T, Storage>& other);
+  Tensor3<T, Storage>& operator=(Tensor3<T, Storage>&& other) noexcept;
+  int getWidth() const;
+  int getHeight() const;
+  int getChannels() const;
+  T* getValues();
+  const T* getValues() const;
+  TensorView<T> view();
+  TensorView<const T> view() const;
+  // The same buffer seen as a row-major cols x rows matrix, without copying
+  MatrixView<T> asMatrix(int cols, int rows);
+  MatrixView<const T> asMatrix(int cols, int rows) const;
+  T getValue(int x, int y, int z) const;
   void setValue(int x, int y, int z, T value);
-  Tensor3<T> operator+(const Tensor3<T>& t);
-  Tensor3<T> operator-(const Tensor3<T>& t);
+  // Changes the shape, reusing the buffer when the element count doesn't change.
+  // Contents are unspecified afterwards.
+  void resize(int width, int height, int channels);
+  // Changes the shape keeping the contents, the element count must stay the same
+  void reshape(int width, int height, int channels);
+  Tensor3<T, Storage> operator+(const Tensor3<T, Storage>& t);
+  Tensor3<T, Storage> operator-(const Tensor3<T, Storage>& t);
   ~Tensor3();
 };
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+#include <Storage.hpp>
+#include <TensorView.hpp>
+
+// A batch of batchSize CHW samples stored back to back, the unit of mini-batch training.
+// Storage is the policy that allocates the elements, see Storage.hpp
+template <typename T, typename Storage = DefaultStorage>
+class Tensor4 {
+private:
+  int n, w, h, c;
+  T* values;
+
+public:
+  Tensor4();
+  Tensor4(int batchSize, int width, int height, int channels);
+  Tensor4(const Tensor4<T, Storage>& other);
+  Tensor4(Tensor4<T, Storage>&& other) noexcept;
+  Tensor4<T, Storage>& operator=(const Tensor4<T, Storage>& other);
+  Tensor4<T, Storage>& operator=(Tensor4<T, Storage>&& other) noexcept;
+  int getBatchSize() const;
+  int getWidth() const;
+  int getHeight() const;
+  int getChannels() const;
+  int getSampleSize() const;
+  T* getValues();
+  const T* getValues() const;
+  Tensor4View<T> view();
+  Tensor4View<const T> view() const;
+  TensorView<T> sample(int i);
+  TensorView<const T> sample(int i) const;
+  // Changes the shape, reusing the buffer when the element count doesn't change.
+  // Contents are unspecified afterwards.
+  void resize(int batchSize, int width, int height, int channels);
+  ~Tensor4();
+};
\ No newline at end of file
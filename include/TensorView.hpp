@@ -0,0 +1,213 @@
+#pragma once
+#include <MatrixExpr.hpp>
+#include <stdexcept>
+#include <type_traits>
+
+// Non-owning views over a Matrix or Tensor3 buffer. A view never allocates or copies, it
+// only reinterprets the memory it points to, so it must not outlive the owner of that
+// memory. T is const qualified for read-only views.
+
+template <typename T>
+class MatrixView : public MatrixExpr<MatrixView<T>> {
+private:
+  T* values;
+  int numCols;
+  int numRows;
+  int rowStride;
+
+public:
+  using value_type = std::remove_const_t<T>;
+
+  MatrixView() : values(nullptr), numCols(0), numRows(0), rowStride(0) {}
+  MatrixView(T* values, int cols, int rows)
+      : values(values), numCols(cols), numRows(rows), rowStride(cols) {}
+  MatrixView(T* values, int cols, int rows, int rowStride)
+      : values(values), numCols(cols), numRows(rows), rowStride(rowStride) {}
+  // Mutable views convert to read-only ones
+  template <typename U>
+    requires std::is_same_v<const U, T>
+  MatrixView(const MatrixView<U>& other)
+      : values(other.getValues()), numCols(other.getNumCols()), numRows(other.getNumRows()),
+        rowStride(other.getRowStride()) {}
+
+  int getNumCols() const {
+    return this->numCols;
+  }
+  int getNumRows() const {
+    return this->numRows;
+  }
+  int getRowStride() const {
+    return this->rowStride;
+  }
+  T* getValues() const {
+    return this->values;
+  }
+  bool isContiguous() const {
+    return this->rowStride == this->numCols;
+  }
+  T& operator()(int x, int y) const {
+    return this->values[y * this->rowStride + x];
+  }
+  // Linear access for expressions, only meaningful on contiguous views
+  value_type operator[](int i) const {
+    return this->values[i];
+  }
+  // Rows [first, first + count) of this view, sharing its stride
+  MatrixView<T> rows(int first, int count) const {
+    return MatrixView<T>(this->values + first * this->rowStride, this->numCols, count,
+                         this->rowStride);
+  }
+  // Columns [first, first + count) of this view, sharing its stride
+  MatrixView<T> cols(int first, int count) const {
+    return MatrixView<T>(this->values + first, count, this->numRows, this->rowStride);
+  }
+  // Evaluates an element-wise expression straight into the viewed memory
+  template <typename E>
+  void assign(const MatrixExpr<E>& expr) const {
+    const E& e = expr.self();
+    if (e.getNumCols() != this->numCols || e.getNumRows() != this->numRows) {
+      throw std::invalid_argument("Matrices dimensions don't match");
+    }
+    if (!this->isContiguous()) {
+      throw std::invalid_argument("Expressions can only be assigned to contiguous views");
+    }
+    int n = this->numCols * this->numRows;
+    T* out = this->values;
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+      out[i] = e[i];
+    }
+  }
+};
+
+template <typename T>
+class TensorView {
+private:
+  T* values;
+  int w, h, c;
+  int rowStride;
+  int channelStride;
+
+public:
+  TensorView() : values(nullptr), w(0), h(0), c(0), rowStride(0), channelStride(0) {}
+  TensorView(T* values, int width, int height, int channels)
+      : values(values), w(width), h(height), c(channels), rowStride(width),
+        channelStride(width * height) {}
+  TensorView(T* values, int width, int height, int channels, int rowStride, int channelStride)
+      : values(values), w(width), h(height), c(channels), rowStride(rowStride),
+        channelStride(channelStride) {}
+  template <typename U>
+    requires std::is_same_v<const U, T>
+  TensorView(const TensorView<U>& other)
+      : values(other.getValues()), w(other.getWidth()), h(other.getHeight()),
+        c(other.getChannels()), rowStride(other.getRowStride()),
+        channelStride(other.getChannelStride()) {}
+
+  int getWidth() const {
+    return this->w;
+  }
+  int getHeight() const {
+    return this->h;
+  }
+  int getChannels() const {
+    return this->c;
+  }
+  int getRowStride() const {
+    return this->rowStride;
+  }
+  int getChannelStride() const {
+    return this->channelStride;
+  }
+  T* getValues() const {
+    return this->values;
+  }
+  bool isContiguous() const {
+    return this->rowStride == this->w && this->channelStride == this->w * this->h;
+  }
+  T& operator()(int x, int y, int z) const {
+    return this->values[z * this->channelStride + y * this->rowStride + x];
+  }
+  // Channels [first, first + count) of this view
+  TensorView<T> channels(int first, int count) const {
+    return TensorView<T>(this->values + first * this->channelStride, this->w, this->h, count,
+                         this->rowStride, this->channelStride);
+  }
+  // Same memory seen with another shape holding the same number of elements
+  TensorView<T> reshape(int width, int height, int channels) const {
+    if (!this->isContiguous() || width * height * channels != this->w * this->h * this->c) {
+      throw std::invalid_argument("Tensor can't be reshaped to the requested dimensions");
+    }
+    return TensorView<T>(this->values, width, height, channels);
+  }
+  // Same memory seen as a row-major cols x rows matrix
+  MatrixView<T> asMatrix(int cols, int rows) const {
+    if (!this->isContiguous() || cols * rows != this->w * this->h * this->c) {
+      throw std::invalid_argument("Tensor can't be viewed with the requested dimensions");
+    }
+    return MatrixView<T>(this->values, cols, rows);
+  }
+};
+
+// A batch of n contiguous CHW samples, sample i starting at i * width * height * channels
+template <typename T>
+class Tensor4View {
+private:
+  T* values;
+  int n, w, h, c;
+
+public:
+  Tensor4View() : values(nullptr), n(0), w(0), h(0), c(0) {}
+  Tensor4View(T* values, int batchSize, int width, int height, int channels)
+      : values(values), n(batchSize), w(width), h(height), c(channels) {}
+  // A single contiguous sample seen as a batch of one
+  explicit Tensor4View(const TensorView<T>& sample)
+      : values(sample.getValues()), n(1), w(sample.getWidth()), h(sample.getHeight()),
+        c(sample.getChannels()) {
+    if (!sample.isContiguous()) {
+      throw std::invalid_argument("Only contiguous tensors can be seen as a batch");
+    }
+  }
+  template <typename U>
+    requires std::is_same_v<const U, T>
+  Tensor4View(const Tensor4View<U>& other)
+      : values(other.getValues()), n(other.getBatchSize()), w(other.getWidth()),
+        h(other.getHeight()), c(other.getChannels()) {}
+
+  int getBatchSize() const {
+    return this->n;
+  }
+  int getWidth() const {
+    return this->w;
+  }
+  int getHeight() const {
+    return this->h;
+  }
+  int getChannels() const {
+    return this->c;
+  }
+  // Elements of one sample
+  int getSampleSize() const {
+    return this->w * this->h * this->c;
+  }
+  T* getValues() const {
+    return this->values;
+  }
+  TensorView<T> sample(int i) const {
+    return TensorView<T>(this->values + (size_t)i * this->getSampleSize(), this->w, this->h,
+                         this->c);
+  }
+  // Every sample seen with another shape holding the same number of elements
+  Tensor4View<T> reshape(int width, int height, int channels) const {
+    if (width * height * channels != this->getSampleSize()) {
+      throw std::invalid_argument("Tensor can't be reshaped to the requested dimensions");
+    }
+    return Tensor4View<T>(this->values, this->n, width, height, channels);
+  }
+  // The whole batch seen as a row-major cols x rows matrix
+  MatrixView<T> asMatrix(int cols, int rows) const {
+    if (cols * rows != this->n * this->getSampleSize()) {
+      throw std::invalid_argument("Tensor can't be viewed with the requested dimensions");
+    }
+    return MatrixView<T>(this->values, cols, rows);
+  }
+};
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+#include <Activations.hpp>
+
+// Vectorized activation and softmax kernels over contiguous float buffers. The instruction
+// set is chosen at compile time from the flags the project is built with (AVX-512, AVX2 with
+// FMA, or the SSE2 every x86-64 build has), see the CNN_NATIVE_ARCH option.
+//
+// exp is computed as 2^n * p(r) with n = round(x / ln 2), r = x - n * ln 2 and p a degree 7
+// polynomial, which keeps the relative error under 1.5 ulp (1.8e-7) for x in [-87, 88].
+// Inputs outside that range are clamped, so exp never returns 0 or inf. sigmoid, tanh and
+// GELU are built on it. sigmoid and tanh stay within 2e-7 of the libm based versions in
+// Activations.hpp, GELU within 6e-7 (5.5e-7 measured over every float in [-8, 8], beyond
+// which it rounds to x or 0), and their derivatives within 3e-6.
+
+// out[i] = f(in[i]), in and out may be the same buffer
+void applyActivation(ActivationFunction function, const float* in, float* out, int n);
+// out[i] = upstream[i] * f'(preActivations[i]), which turns the deltas coming from the next
+// layer into this layer's deltas. out may be the same buffer as upstream.
+void applyActivationDerivative(ActivationFunction function, const float* preActivations,
+                               const float* upstream, float* out, int n);
+// Numerically stable softmax of in written to out. The max and the normalizer are found in
+// one online pass, rescaling the running sum whenever the max grows, and a second pass
+// writes the probabilities.
+void softmax(const float* in, float* out, int n);
+
+// Instruction set the kernels were compiled for ("avx512", "avx2", "sse2" or "scalar")
+const char* vectorMathIsa();
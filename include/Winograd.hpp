@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+
+// Winograd minimal filtering F(m x m, 3 x 3) for stride 1 valid convolutions with 3x3
+// filters. Each m x m block of output is computed from an (m + 2) x (m + 2) input tile as
+// A^T [(G g G^T) . (B^T d B)] A, so the per-channel work becomes (m + 2)^2 independent
+// GEMMs over all tiles, using 2.25x (m = 2) or 4x (m = 4) fewer multiplications than direct
+// convolution. m = 4 saves more but loses about an order of magnitude of accuracy, see
+// ConvolutionalLayer for which one is used.
+//
+// Tensors are plain CHW. Flat filter matrices have row c * 9 + ky * 3 + kx and one column
+// per filter, as in ConvolutionalLayer.
+
+// Floats taken by the filters of a depth x count layer once transformed for tile size m
+size_t winogradFilterSize(int depth, int count, int m);
+// Transforms the filters for the forward pass. With flip set, transforms them rotated by
+// 180 degrees with filters and channels swapped instead, which computes the input gradient
+// as another forward pass over the deltas padded by 2.
+void winogradTransformFilters(const float* flat, int depth, int count, int m, bool flip,
+                              float* transformed);
+
+// Floats of scratch space winogradConv needs
+size_t winogradWorkspaceSize(int inChannels, int outChannels, int inW, int inH, int m);
+// out = valid correlation of in with the transformed filters, plus bias (one per output
+// channel, may be null). out has outChannels planes of (inW - 2) x (inH - 2).
+void winogradConv(const float* in, int inChannels, int inW, int inH, const float* transformed,
+                  int outChannels, const float* bias, int m, float* out, float* workspace);
\ No newline at end of file
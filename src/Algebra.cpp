@@ -1,109 +1,301 @@
 #include <Algebra.hpp>
+#include <algorithm>
+#include <atomic>
+#include <Gemm.hpp>
+#include <VectorMath.hpp>
 #include <Matrix.hpp>
 #include <Tensor3.hpp>
+#include <omp.h>
 #include <stdexcept>
+#include <type_traits>
 
 template <typename T>
-Matrix<T> cross(Matrix<T> m1, Matrix<T> m2) {
-  if (m1.getNumCols() != m2.getNumRows()) {
+Matrix<T> cross(const Matrix<T>& m1, const Matrix<T>& m2, bool transposeFirst,
+                bool transposeSecond) {
+  Matrix<T> result;
+  crossInto(m1, m2, result, transposeFirst, transposeSecond);
+  return result;
+}
+
+template <typename T>
+void crossInto(const Matrix<T>& m1, const Matrix<T>& m2, Matrix<T>& out, bool transposeFirst,
+               bool transposeSecond) {
+  if (&out == &m1 || &out == &m2) {
+    throw std::invalid_argument("Output matrix can't be one of the operands");
+  }
+  int rows = transposeFirst ? m1.getNumCols() : m1.getNumRows();
+  int cols = transposeSecond ? m2.getNumRows() : m2.getNumCols();
+  out.resize(cols, rows);
+  crossInto<T>(m1.view(), m2.view(), out.view(), transposeFirst, transposeSecond);
+}
+
+template <typename T>
+void crossInto(MatrixView<const T> m1, MatrixView<const T> m2, MatrixView<T> out,
+               bool transposeFirst, bool transposeSecond) {
+  int rows1 = transposeFirst ? m1.getNumCols() : m1.getNumRows();
+  int cols1 = transposeFirst ? m1.getNumRows() : m1.getNumCols();
+  int rows2 = transposeSecond ? m2.getNumCols() : m2.getNumRows();
+  int cols2 = transposeSecond ? m2.getNumRows() : m2.getNumCols();
+  if (cols1 != rows2) {
     throw std::invalid_argument(
         "Number of colums of the first matrix doesn't match the number of rows of the second");
   }
-  int rows1 = m1.getNumRows();
-  int cols1 = m1.getNumCols();
-  int cols2 = m2.getNumCols();
-  T* a = m1.getValues();
-  T* b = m2.getValues();
-  Matrix<T> result = Matrix<T>(cols2, rows1);
-  T* c = result.getValues();
+  if (out.getNumRows() != rows1 || out.getNumCols() != cols2) {
+    throw std::invalid_argument("Output matrix dimensions don't match the product");
+  }
+  int lda = m1.getRowStride();
+  int ldb = m2.getRowStride();
+  int ldc = out.getRowStride();
+  const T* a = m1.getValues();
+  const T* b = m2.getValues();
+  T* c = out.getValues();
+  if constexpr (std::is_same_v<T, float>) {
+    sgemm(transposeFirst, transposeSecond, rows1, cols2, cols1, a, lda, b, ldb, c, ldc);
+  } else {
 #pragma omp parallel for schedule(static)
-  for (int y = 0; y < rows1; y++) {
-    for (int x = 0; x < cols1; x++) {
-      T aVal = a[y * cols1 + x];
+    for (int y = 0; y < rows1; y++) {
       for (int x2 = 0; x2 < cols2; x2++) {
-        c[y * cols2 + x2] += aVal * b[x * cols2 + x2];
+        c[y * ldc + x2] = 0;
+      }
+      for (int x = 0; x < cols1; x++) {
+        T aVal = transposeFirst ? a[x * lda + y] : a[y * lda + x];
+        for (int x2 = 0; x2 < cols2; x2++) {
+          c[y * ldc + x2] += aVal * (transposeSecond ? b[x2 * ldb + x] : b[x * ldb + x2]);
+        }
       }
     }
   }
-  return result;
 }
 
 template <typename T>
-Matrix<T> transpose(Matrix<T> m) {
-  Matrix<T> result = Matrix<T>(m.getNumRows(), m.getNumCols());
-  for (size_t y = 0; y < m.getNumRows(); y++) {
-    for (size_t x = 0; x < m.getNumCols(); x++) {
-      result.setValue(y, x, m.getValue(x, y));
-    }
-  }
+Matrix<T> transpose(const Matrix<T>& m) {
+  Matrix<T> result;
+  transposeInto(m, result);
   return result;
 }
 
 template <typename T>
-Matrix<T> apply(Matrix<T> m, T (*function)(T)) {
-  Matrix<T> result = Matrix<T>(m.getNumCols(), m.getNumRows());
-  for (size_t y = 0; y < m.getNumRows(); y++) {
-    for (size_t x = 0; x < m.getNumCols(); x++) {
-      result.setValue(x, y, function(m.getValue(x, y)));
+void transposeInto(const Matrix<T>& m, Matrix<T>& out) {
+  if (&out == &m) {
+    throw std::invalid_argument("Output matrix can't be the input");
+  }
+  int rows = m.getNumRows();
+  int cols = m.getNumCols();
+  out.resize(rows, cols);
+  const T* src = m.getValues();
+  T* dst = out.getValues();
+  for (int y = 0; y < rows; y++) {
+    for (int x = 0; x < cols; x++) {
+      dst[x * rows + y] = src[y * cols + x];
     }
   }
+}
+
+template <typename T>
+Tensor3<T> apply(const Tensor3<T>& m, ActivationFunction function) {
+  Tensor3<T> result(m.getWidth(), m.getHeight(), m.getChannels());
+  applyActivation(function, m.getValues(), result.getValues(),
+                  m.getWidth() * m.getHeight() * m.getChannels());
   return result;
 }
 
 template <typename T>
-Tensor3<T> apply(Tensor3<T> m, T (*function)(T)) {
-  Tensor3<T> result = Tensor3<T>(m.getWidth(), m.getHeight(), m.getChannels());
-  for (size_t z = 0; z < m.getChannels(); z++) {
-    for (size_t y = 0; y < m.getHeight(); y++) {
-      for (size_t x = 0; x < m.getWidth(); x++) {
-        result.setValue(x, y, z, function(m.getValue(x, y, z)));
-      }
-    }
+void applyInPlace(Tensor3<T>& m, ActivationFunction function) {
+  int n = m.getWidth() * m.getHeight() * m.getChannels();
+  applyActivation(function, m.getValues(), m.getValues(), n);
+}
+
+template <typename T>
+void applyInPlace(Matrix<T>& m, ActivationFunction function) {
+  int n = m.getNumCols() * m.getNumRows();
+  applyActivation(function, m.getValues(), m.getValues(), n);
+}
+
+int convOutputSize(int inputSize, int filterSize, int stride, int padding) {
+  if (stride < 1 || padding < 0) {
+    throw std::invalid_argument("Stride must be positive and padding non negative");
   }
-  return result;
+  int span = inputSize + 2 * padding - filterSize;
+  if (span < 0) {
+    throw std::invalid_argument("Filter doesn't fit in the padded input");
+  }
+  return span / stride + 1;
+}
+
+void relaxedCopy(const float* src, float* dst, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    // atomic_ref can't wrap a const object before C++26, the source is only loaded from
+    std::atomic_ref<float> source(const_cast<float&>(src[i]));
+    std::atomic_ref<float>(dst[i]).store(source.load(std::memory_order_relaxed),
+                                         std::memory_order_relaxed);
+  }
+}
+
+void relaxedSubtractScaled(float* dst, const float* src, float scale, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    std::atomic_ref<float> element(dst[i]);
+    element.store(element.load(std::memory_order_relaxed) - scale * src[i],
+                  std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+Matrix<T> im2col(const Tensor3<T>& input, int filterSize, int filterDepth, int stride,
+                 int padding) {
+  Matrix<T> flatInput;
+  im2colInto(input, filterSize, filterDepth, flatInput, stride, padding);
+  return flatInput;
 }
 
 template <typename T>
-Matrix<T> im2col(Tensor3<T> input, int filterSize, int filterDepth) {
-  int slidesW = input.getWidth() - filterSize + 1;
-  int slidesH = input.getHeight() - filterSize + 1;
-  Matrix<T> flatInput(filterSize * filterSize * filterDepth, slidesH * slidesW);
-  for (size_t c = 0; c < filterDepth; c++) {
+void im2colInto(const Tensor3<T>& input, int filterSize, int filterDepth, Matrix<T>& out,
+                int stride, int padding) {
+  im2colInto<T>(input.view(), filterSize, filterDepth, out, stride, padding);
+}
+
+template <typename T>
+void im2colInto(TensorView<const T> input, int filterSize, int filterDepth, Matrix<T>& out,
+                int stride, int padding) {
+  int slidesW = convOutputSize(input.getWidth(), filterSize, stride, padding);
+  int slidesH = convOutputSize(input.getHeight(), filterSize, stride, padding);
+  out.resize(filterSize * filterSize * filterDepth, slidesH * slidesW);
+  im2colInto<T>(input, filterSize, filterDepth, out.view(), stride, padding);
+}
+
+template <typename T>
+void im2colInto(TensorView<const T> input, int filterSize, int filterDepth, MatrixView<T> out,
+                int stride, int padding) {
+  int inputW = input.getWidth();
+  int inputH = input.getHeight();
+  int slidesW = convOutputSize(inputW, filterSize, stride, padding);
+  int slidesH = convOutputSize(inputH, filterSize, stride, padding);
+  int patchSize = filterSize * filterSize * filterDepth;
+  if (out.getNumRows() != slidesW * slidesH || out.getNumCols() != patchSize ||
+      !out.isContiguous()) {
+    throw std::invalid_argument("Output matrix dimensions don't match the convolution");
+  }
+  int rowStride = input.getRowStride();
+  T* dst = out.getValues();
+  for (int c = 0; c < filterDepth; c++) {
     int rowBase = c * filterSize * filterSize;
-    for (size_t y = 0; y < slidesH; y++) {
-      for (size_t x = 0; x < slidesW; x++) {
-        int col = y * slidesW + x;
-        for (size_t filY = 0; filY < filterSize; filY++) {
-          int rowBaseY = rowBase + filY * filterSize;
-          for (size_t filX = 0; filX < filterSize; filX++) {
-            T val = input.getValue(x + filX, y + filY, c);
-            flatInput.setValue(rowBaseY + filX, col, val);
+    const T* channel = &input(0, 0, c);
+    for (int y = 0; y < slidesH; y++) {
+      for (int x = 0; x < slidesW; x++) {
+        T* patch = dst + (y * slidesW + x) * patchSize + rowBase;
+        int inX = x * stride - padding;
+        bool inside = inX >= 0 && inX + filterSize <= inputW;
+        for (int filY = 0; filY < filterSize; filY++) {
+          T* patchRow = patch + filY * filterSize;
+          int inY = y * stride - padding + filY;
+          if (inY < 0 || inY >= inputH) {
+            std::fill(patchRow, patchRow + filterSize, T(0));
+            continue;
+          }
+          const T* inRow = channel + inY * rowStride + inX;
+          if (inside) {
+            for (int filX = 0; filX < filterSize; filX++) {
+              patchRow[filX] = inRow[filX];
+            }
+            continue;
+          }
+          for (int filX = 0; filX < filterSize; filX++) {
+            bool column = inX + filX >= 0 && inX + filX < inputW;
+            patchRow[filX] = column ? inRow[filX] : T(0);
           }
         }
       }
     }
   }
+}
 
-  return flatInput;
+// Each (channel, input row) is owned by one iteration, which adds in the patch rows of every
+// output position that read it, so rows can be split between threads without write races.
+// Reads are k contiguous floats of a patch per output position.
+template <typename T>
+void col2imInto(const Matrix<T>& cols, int filterSize, int filterDepth, int inputW, int inputH,
+                Tensor3<T>& out, int stride, int padding) {
+  out.resize(inputW, inputH, filterDepth);
+  col2imInto<T>(cols.view(), filterSize, filterDepth, out.view(), stride, padding);
 }
 
 template <typename T>
-Matrix<T> hadamard(Matrix<T> m1, Matrix<T> m2) {
-  if (m1.getNumRows() != m2.getNumRows() || m1.getNumCols() != m2.getNumCols()) {
-    throw std::invalid_argument("Incompatible matrix dimensions");
-  }
-  Matrix<T> result = Matrix<T>(m1.getNumCols(), m1.getNumRows());
-  for (size_t y = 0; y < m1.getNumRows(); y++) {
-    for (size_t x = 0; x < m1.getNumCols(); x++) {
-      result.setValue(x, y, m1.getValue(x, y) * m2.getValue(x, y));
+void col2imInto(MatrixView<const T> cols, int filterSize, int filterDepth, TensorView<T> out,
+                int stride, int padding) {
+  int inputW = out.getWidth();
+  int inputH = out.getHeight();
+  if (out.getChannels() != filterDepth || !out.isContiguous() || !cols.isContiguous()) {
+    throw std::invalid_argument("Input gradient must be a contiguous filterDepth tensor");
+  }
+  int k = filterSize;
+  int slidesW = convOutputSize(inputW, k, stride, padding);
+  int slidesH = convOutputSize(inputH, k, stride, padding);
+  int patchSize = k * k * filterDepth;
+  if (cols.getNumRows() != slidesW * slidesH || cols.getNumCols() != patchSize) {
+    throw std::invalid_argument("Column matrix dimensions don't match the convolution");
+  }
+  const T* src = cols.getValues();
+  T* dst = out.getValues();
+  // First and last output columns whose patch lies fully inside a row
+  int firstInside = (padding + stride - 1) / stride;
+  int lastInside = -1;
+  if (inputW + padding >= k) {
+    lastInside = std::min(slidesW - 1, (inputW + padding - k) / stride);
+  }
+  bool parallel = (size_t)patchSize * slidesW * slidesH >= 64 * 64 * 64 &&
+                  omp_get_max_threads() > 1;
+#pragma omp parallel for collapse(2) schedule(static) if (parallel)
+  for (int c = 0; c < filterDepth; c++) {
+    for (int inY = 0; inY < inputH; inY++) {
+      T* row = dst + ((size_t)c * inputH + inY) * inputW;
+      std::fill(row, row + inputW, T(0));
+      for (int fy = 0; fy < k; fy++) {
+        int offset = inY + padding - fy;
+        if (offset < 0 || offset % stride != 0 || offset / stride >= slidesH) {
+          continue;
+        }
+        int outY = offset / stride;
+        const T* taps = src + (size_t)outY * slidesW * patchSize + (c * k + fy) * k;
+        for (int outX = 0; outX < slidesW; outX++) {
+          const T* patchRow = taps + (size_t)outX * patchSize;
+          int inX = outX * stride - padding;
+          if (outX >= firstInside && outX <= lastInside) {
+            T* target = row + inX;
+            for (int fx = 0; fx < k; fx++) {
+              target[fx] += patchRow[fx];
+            }
+            continue;
+          }
+          for (int fx = 0; fx < k; fx++) {
+            if (inX + fx >= 0 && inX + fx < inputW) {
+              row[inX + fx] += patchRow[fx];
+            }
+          }
+        }
+      }
     }
   }
-  return result;
 }
 
-template Matrix<float> cross(Matrix<float> m1, Matrix<float> m2);
-template Matrix<float> transpose(Matrix<float> m);
-template Matrix<float> apply(Matrix<float> m, float (*function)(float));
-template Tensor3<float> apply(Tensor3<float> m, float (*function)(float));
-template Matrix<float> im2col(Tensor3<float> input, int filterSize, int filterDepth);
-template Matrix<float> hadamard(Matrix<float> m1, Matrix<float> m2);
\ No newline at end of file
+template Matrix<float> cross(const Matrix<float>& m1, const Matrix<float>& m2,
+                             bool transposeFirst, bool transposeSecond);
+template void crossInto(const Matrix<float>& m1, const Matrix<float>& m2, Matrix<float>& out,
+                        bool transposeFirst, bool transposeSecond);
+template void crossInto(MatrixView<const float> m1, MatrixView<const float> m2,
+                        MatrixView<float> out, bool transposeFirst, bool transposeSecond);
+template Matrix<float> transpose(const Matrix<float>& m);
+template void transposeInto(const Matrix<float>& m, Matrix<float>& out);
+template Tensor3<float> apply(const Tensor3<float>& m, ActivationFunction function);
+template void applyInPlace(Tensor3<float>& m, ActivationFunction function);
+template void applyInPlace(Matrix<float>& m, ActivationFunction function);
+template Matrix<float> im2col(const Tensor3<float>& input, int filterSize, int filterDepth,
+                              int stride, int padding);
+template void im2colInto(const Tensor3<float>& input, int filterSize, int filterDepth,
+                         Matrix<float>& out, int stride, int padding);
+template void im2colInto(TensorView<const float> input, int filterSize, int filterDepth,
+                         Matrix<float>& out, int stride, int padding);
+template void im2colInto(TensorView<const float> input, int filterSize, int filterDepth,
+                         MatrixView<float> out, int stride, int padding);
+template void col2imInto(const Matrix<float>& cols, int filterSize, int filterDepth,
+                         int inputW, int inputH, Tensor3<float>& out, int stride, int padding);
+template void col2imInto(MatrixView<const float> cols, int filterSize, int filterDepth,
+                         TensorView<float> out, int stride, int padding);
\ No newline at end of file
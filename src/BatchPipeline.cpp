@@ -0,0 +1,113 @@
+#include <BatchPipeline.hpp>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+BatchPipeline::BatchPipeline(SampleLoader loader, int width, int height, int channels,
+                             int classes, int threads, int capacity) {
+  if (threads < 1 || capacity < 1) {
+    throw std::invalid_argument("A pipeline needs at least one thread and one slot");
+  }
+  this->loader = loader;
+  this->width = width;
+  this->height = height;
+  this->channels = channels;
+  this->classes = classes;
+  this->slots.resize(capacity);
+  this->ready.assign(capacity, -1);
+  for (int t = 0; t < threads; t++) {
+    this->workers.emplace_back(&BatchPipeline::work, this);
+  }
+}
+
+void BatchPipeline::work() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  int capacity = (int)this->slots.size();
+  while (true) {
+    this->changed.wait(lock, [this, capacity] {
+      return this->stopping ||
+             (this->claimed < this->batches && this->claimed < this->released + capacity);
+    });
+    if (this->stopping) {
+      return;
+    }
+    int number = this->claimed++;
+    int first = number * this->batchSize;
+    int count = std::min(this->batchSize, (int)this->order.size() - first);
+    Batch& batch = this->slots[number % capacity];
+    this->filling++;
+    lock.unlock();
+    batch.images.resize(count, this->width, this->height, this->channels);
+    batch.labels.resize(count, this->classes, 1, 1);
+    int imageSize = batch.images.getSampleSize();
+    std::mt19937 rng(this->seed ^ (0x9e3779b9u * (unsigned)(this->firstBatch + number + 1)));
+    for (int b = 0; b < count; b++) {
+      this->loader(this->order[first + b], rng, batch.images.getValues() + b * imageSize,
+                   batch.labels.getValues() + b * this->classes);
+    }
+    lock.lock();
+    this->ready[number % capacity] = number;
+    this->filling--;
+    this->changed.notify_all();
+  }
+}
+
+void BatchPipeline::startEpoch(const std::vector<int>& order, int batchSize, unsigned seed,
+                               int firstBatch) {
+  if (batchSize < 1) {
+    throw std::invalid_argument("Batch size must be positive");
+  }
+  std::unique_lock<std::mutex> lock(this->mutex);
+  // No new claims, and whatever is being filled for the previous epoch is finished first
+  this->batches = 0;
+  this->changed.wait(lock, [this] { return this->filling == 0; });
+  this->order = order;
+  this->batchSize = batchSize;
+  this->seed = seed;
+  this->firstBatch = firstBatch;
+  this->claimed = 0;
+  this->consumed = 0;
+  this->released = 0;
+  std::fill(this->ready.begin(), this->ready.end(), -1);
+  this->batches = ((int)order.size() + batchSize - 1) / batchSize;
+  this->changed.notify_all();
+}
+
+const BatchPipeline::Batch* BatchPipeline::next() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->released = this->consumed;
+  this->changed.notify_all();
+  if (this->consumed >= this->batches) {
+    return nullptr;
+  }
+  int number = this->consumed;
+  int slot = number % (int)this->slots.size();
+  if (this->ready[slot] != number) {
+    auto start = std::chrono::steady_clock::now();
+    this->changed.wait(lock, [this, slot, number] { return this->ready[slot] == number; });
+    std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+    this->stallSeconds += waited.count();
+  }
+  this->ready[slot] = -1;
+  this->consumed++;
+  return &this->slots[slot];
+}
+
+double BatchPipeline::getStallSeconds() const {
+  return this->stallSeconds;
+}
+
+void BatchPipeline::resetStallSeconds() {
+  this->stallSeconds = 0.0;
+}
+
+BatchPipeline::~BatchPipeline() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->changed.notify_all();
+  for (std::thread& worker : this->workers) {
+    worker.join();
+  }
+}
\ No newline at end of file
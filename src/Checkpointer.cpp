@@ -0,0 +1,339 @@
+#include <Checkpointer.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <spanstream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char MAGIC[8] = {'C', 'N', 'N', 'C', 'K', 'P', 'T', '\0'};
+constexpr uint32_t VERSION = 1;
+// The weights start at a multiple of this so they can be mapped on any common page size,
+// the other sections at multiples of a cache line
+constexpr uint64_t WEIGHT_ALIGNMENT = 65536;
+constexpr uint64_t ALIGNMENT = 64;
+
+// The generator state is stored as the text std::mt19937 writes, the rest in the byte order
+// of the machine that wrote it. checksum covers the generator state and the optimizer
+// state, the weights have a checksum of their own. optimizer is the kind the state belongs
+// to, see Optimizer::getName.
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t epoch;
+  int32_t round;
+  int32_t sample;
+  uint32_t seed;
+  int32_t steps;
+  uint64_t rngOffset;
+  uint64_t rngSize;
+  uint64_t weightOffset;
+  uint64_t weightSize;
+  uint64_t stateOffset;
+  uint64_t stateFloats;
+  uint64_t checksum;
+  char optimizer[16];
+  uint8_t reserved[24];
+};
+static_assert(sizeof(CheckpointHeader) == 2 * ALIGNMENT);
+
+[[noreturn]] void fail(const std::string& what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+[[noreturn]] void malformed(const std::string& path, const std::string& what) {
+  throw std::runtime_error(path + ": " + what);
+}
+
+uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// FNV-1a, continued from hash
+uint64_t checksum(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+void writeAll(int file, const void* data, size_t size, uint64_t offset,
+              const std::string& path) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t written = pwrite(file, bytes, size, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("Can't write " + path);
+    }
+    bytes += written;
+    size -= written;
+    offset += written;
+  }
+}
+
+void readAll(int file, void* data, size_t size, uint64_t offset, const std::string& path) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t got = pread(file, bytes, size, offset);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      close(file);
+      if (got == 0) {
+        malformed(path, "truncated checkpoint");
+      }
+      fail("Can't read " + path);
+    }
+    bytes += got;
+    size -= got;
+    offset += got;
+  }
+}
+
+// Whether a and b are the same tensors, at the same addresses and with the same shapes
+bool sameTensors(const std::vector<MatrixView<float>>& a,
+                 const std::vector<MatrixView<float>>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].getValues() != b[i].getValues() || a[i].getNumCols() != b[i].getNumCols() ||
+        a[i].getNumRows() != b[i].getNumRows()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+Checkpointer::Checkpointer(std::string path) : path(std::move(path)) {
+  // Written in full and synced under another name first, so path always holds a complete
+  // checkpoint
+  this->temporaryPath = this->path + ".tmp";
+  size_t slash = this->path.find_last_of('/');
+  this->directory = slash == std::string::npos ? "." : this->path.substr(0, slash + 1);
+  this->writer = std::thread(&Checkpointer::run, this);
+}
+
+bool Checkpointer::save(Network& net, const Position& position) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->busy) {
+      return false;
+    }
+  }
+  // The writer is idle, so the snapshot is ours until busy is set again. It is only laid
+  // out again when the tensors changed, like the moments the optimizer's first step creates.
+  Optimizer& optimizer = net.getOptimizer();
+  this->current.clear();
+  net.collectParameters(this->current);
+  optimizer.collectState(this->current);
+  if (!sameTensors(this->current, this->tensors)) {
+    this->layout(net);
+  }
+  for (size_t i = 0; i < this->tensors.size(); i++) {
+    const MatrixView<float>& tensor = this->tensors[i];
+    std::memcpy(this->snapshot.data() + this->offsets[i], tensor.getValues(),
+                (size_t)tensor.getNumCols() * tensor.getNumRows() * sizeof(float));
+  }
+  this->steps = optimizer.getSteps();
+  this->optimizer = optimizer.getName();
+  this->position = position;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->busy = true;
+  }
+  this->changed.notify_all();
+  return true;
+}
+
+// The weight file's header and layer table are written here once, the optimizer state
+// follows the weights a cache line further on
+void Checkpointer::layout(Network& net) {
+  Optimizer& optimizer = net.getOptimizer();
+  this->weightSize = net.getWeightImageSize();
+  this->stateStart = alignUp(this->weightSize, ALIGNMENT);
+  this->stateFloats = optimizer.getStateSize();
+  this->snapshot.assign(this->stateStart + this->stateFloats * sizeof(float), 0);
+  net.writeWeightLayout(this->snapshot.data(), this->tensors, this->offsets);
+  size_t weightTensors = this->tensors.size();
+  optimizer.collectState(this->tensors);
+  uint64_t offset = this->stateStart;
+  for (size_t i = weightTensors; i < this->tensors.size(); i++) {
+    this->offsets.push_back(offset);
+    offset += (uint64_t)this->tensors[i].getNumCols() * this->tensors[i].getNumRows() *
+              sizeof(float);
+  }
+}
+
+void Checkpointer::wait() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->changed.wait(lock, [this] { return !this->busy; });
+}
+
+void Checkpointer::run() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    this->changed.wait(lock, [this] { return this->stopping || this->busy; });
+    if (!this->busy) {
+      return;
+    }
+    lock.unlock();
+    try {
+      this->write();
+    } catch (const std::exception& e) {
+      // Training goes on, the previous checkpoint is still there
+      std::cerr << "Checkpoint not written: " << e.what() << std::endl;
+    }
+    lock.lock();
+    this->busy = false;
+    this->changed.notify_all();
+  }
+}
+
+void Checkpointer::write() {
+  std::ospanstream rngText(this->rngText);
+  rngText << this->position.rng;
+  if (rngText.fail()) {
+    throw std::runtime_error("Generator state doesn't fit its buffer");
+  }
+  std::span<const char> rng = rngText.span();
+  uint8_t* weights = this->snapshot.data();
+  const uint8_t* state = weights + this->stateStart;
+  Network::sealWeightImage(weights);
+
+  CheckpointHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.epoch = this->position.epoch;
+  header.round = this->position.round;
+  header.sample = this->position.sample;
+  header.seed = this->position.seed;
+  header.steps = this->steps;
+  std::strncpy(header.optimizer, this->optimizer, sizeof(header.optimizer) - 1);
+  header.rngOffset = sizeof(CheckpointHeader);
+  header.rngSize = rng.size();
+  header.weightOffset = alignUp(header.rngOffset + header.rngSize, WEIGHT_ALIGNMENT);
+  header.weightSize = this->weightSize;
+  header.stateOffset = alignUp(header.weightOffset + header.weightSize, ALIGNMENT);
+  header.stateFloats = this->stateFloats;
+  size_t stateBytes = this->stateFloats * sizeof(float);
+  header.checksum = checksum(state, stateBytes, checksum(rng.data(), rng.size()));
+
+  const std::string& temporary = this->temporaryPath;
+  int file = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file < 0) {
+    fail("Can't create " + temporary);
+  }
+  try {
+    writeAll(file, &header, sizeof(header), 0, temporary);
+    writeAll(file, rng.data(), rng.size(), header.rngOffset, temporary);
+    writeAll(file, weights, header.weightSize, header.weightOffset, temporary);
+    writeAll(file, state, stateBytes, header.stateOffset, temporary);
+    // The gaps between sections read as zeros
+    if (ftruncate(file, header.stateOffset + stateBytes) != 0 || fsync(file) != 0) {
+      fail("Can't write " + temporary);
+    }
+  } catch (...) {
+    close(file);
+    throw;
+  }
+  if (close(file) != 0) {
+    fail("Can't write " + temporary);
+  }
+  if (std::rename(temporary.c_str(), this->path.c_str()) != 0) {
+    fail("Can't replace " + this->path);
+  }
+  // The rename itself is only durable once the directory is synced
+  int dir = open(this->directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir >= 0) {
+    fsync(dir);
+    close(dir);
+  }
+}
+
+Checkpointer::Position Checkpointer::load(Network& net, const std::string& path) {
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    fail("Can't open " + path);
+  }
+  struct stat info;
+  if (fstat(file, &info) != 0) {
+    close(file);
+    fail("Can't read " + path);
+  }
+  uint64_t size = info.st_size;
+  CheckpointHeader header;
+  readAll(file, &header, sizeof(header), 0, path);
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+    close(file);
+    malformed(path, "not a checkpoint of this version");
+  }
+  if (header.rngOffset > size || header.rngSize > size - header.rngOffset ||
+      header.weightOffset % WEIGHT_ALIGNMENT != 0 || header.weightOffset > size ||
+      header.weightSize > size - header.weightOffset || header.stateOffset > size ||
+      header.stateFloats > (size - header.stateOffset) / sizeof(float) || header.epoch < 0 ||
+      header.round < 0 || header.sample < 0) {
+    close(file);
+    malformed(path, "corrupt checkpoint header");
+  }
+  std::string rng(header.rngSize, '\0');
+  std::vector<float> state(header.stateFloats);
+  readAll(file, rng.data(), rng.size(), header.rngOffset, path);
+  readAll(file, state.data(), state.size() * sizeof(float), header.stateOffset, path);
+  close(file);
+  if (checksum(state.data(), state.size() * sizeof(float), checksum(rng.data(), rng.size())) !=
+      header.checksum) {
+    malformed(path, "checkpoint checksum mismatch");
+  }
+
+  // Moments of one kind of optimizer mean something else to another, or don't fit at all
+  std::string_view saved(header.optimizer, strnlen(header.optimizer, sizeof(header.optimizer)));
+  std::string_view running = net.getOptimizer().getName();
+  if (saved != running) {
+    malformed(path, "checkpoint of the " + std::string(saved) +
+                        " optimizer can't be resumed with " + std::string(running));
+  }
+
+  Position position;
+  position.epoch = header.epoch;
+  position.round = header.round;
+  position.sample = header.sample;
+  position.seed = header.seed;
+  std::istringstream rngText(rng);
+  rngText >> position.rng;
+  if (rngText.fail()) {
+    malformed(path, "corrupt generator state");
+  }
+  if (!net.loadWeights(path, header.weightOffset)) {
+    malformed(path, "can't load the checkpoint's weights");
+  }
+  try {
+    net.restoreOptimizerState(header.steps, state.data(), state.size());
+  } catch (const std::invalid_argument& e) {
+    malformed(path, e.what());
+  }
+  return position;
+}
+
+Checkpointer::~Checkpointer() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->changed.notify_all();
+  this->writer.join();
+}
\ No newline at end of file
@@ -1,103 +1,655 @@
 #include <Activations.hpp>
 #include <Algebra.hpp>
 #include <ConvolutionalLayer.hpp>
+#include <DirectConv.hpp>
+#include <FftConv.hpp>
+#include <Gemm.hpp>
 #include <Matrix.hpp>
+#include <VectorMath.hpp>
+#include <Winograd.hpp>
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <omp.h>
 #include <random>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+// Everything but im2col assumes stride 1
+bool algorithmAvailable(ConvAlgorithm algorithm, int filterSize, int stride) {
+  if (algorithm != IM2COL && algorithm != AUTO && stride != 1) {
+    return false;
+  }
+  if (algorithm == DIRECT) {
+    return filterSize <= MAX_DIRECT_FILTER && directConvBlock() > 1;
+  }
+  if (algorithm == WINOGRAD) {
+    return filterSize == 3;
+  }
+  return true;
+}
+
+// The direct kernels are compiled for one instruction set while sgemm picks the widest the
+// machine has at run time. Built narrower, like the SSE2 of a default build on an AVX2
+// machine, they measured 1.2x to 4x slower than im2col, so AUTO only picks them when they
+// are at least as wide.
+bool directPreferred(int filterSize, int stride) {
+  static const bool asWide = [] {
+    std::string_view gemm = sgemmKernelName();
+    int gemmWidth = gemm == "avx512" ? 16 : gemm == "avx2" ? 8 : 1;
+    return directConvBlock() >= gemmWidth;
+  }();
+  return asWide && algorithmAvailable(DIRECT, filterSize, stride);
+}
+
+// Rough cost of a training step (forward, input gradient and filter gradient) through FFT
+// against the spatial algorithms, in flops. A real 2D transform of N points is taken as
+// 2.5 N log2 N and each pass multiplies depth * count spectra; the filter gradient also
+// needs one inverse transform per filter and channel. Per flop the FFT code measured about
+// 5x slower than the direct kernels, FFT_PENALTY accounts for it. With it FFT takes over
+// from about 9x9 filters.
+constexpr double FFT_PENALTY = 5.0;
+
+bool fftIsCheaper(int filterSize, int depth, int count, int inW, int inH) {
+  double points = (double)fftSize(inW) * fftSize(inH);
+  double transform = 2.5 * points * std::log2(points);
+  double pairs = (double)depth * count;
+  double fft = transform * (2.0 * (depth + count) + pairs) + 3.0 * pairs * 4.0 * points;
+  double slides = (double)(inW - filterSize + 1) * (inH - filterSize + 1);
+  double spatial = 3.0 * 2.0 * slides * filterSize * filterSize * pairs;
+  return fft * FFT_PENALTY < spatial;
+}
+
+// A layer's own setAlgorithm wins, then CNN_CONV_ALGO ("im2col", "direct", "winograd" or
+// "fft") where the filter size allows it. Otherwise FFT is used once the cost model says
+// large filters make it worth it, and deep 3x3 layers go through Winograd, which needs the
+// fewest multiplications. The rest uses the direct kernels, which skip the k * k times
+// larger im2col matrix and its memory traffic and win on most shapes. The exception is a
+// shallow input feeding many filters: the input gradient is then computed mostly on the
+// zero channels padding the input to a full block, while im2col's GEMM stays small.
+ConvAlgorithm chooseAlgorithm(ConvAlgorithm preferred, int filterSize, int stride,
+                              int filterDepth, int filterCount, int inW, int inH) {
+  if (preferred != AUTO) {
+    return preferred;
+  }
+  if (stride != 1) {
+    return IM2COL;
+  }
+  static const char* forced = std::getenv("CNN_CONV_ALGO");
+  if (forced != nullptr) {
+    std::string_view name(forced);
+    ConvAlgorithm named = name == "im2col"     ? IM2COL
+                          : name == "direct"   ? DIRECT
+                          : name == "winograd" ? WINOGRAD
+                          : name == "fft"      ? FFT
+                                               : AUTO;
+    if (named != AUTO && algorithmAvailable(named, filterSize, stride)) {
+      return named;
+    }
+  }
+  if (fftIsCheaper(filterSize, filterDepth, filterCount, inW, inH)) {
+    return FFT;
+  }
+  bool directPossible = directPreferred(filterSize, stride);
+  // Winograd's transforms only pay off once enough channel pairs share them. Against the
+  // direct kernels that takes about 64 x 64 channels, against im2col about 16 x 16.
+  int winogradChannels = directPossible ? 64 : 16;
+  if (filterSize == 3 && filterDepth * filterCount >= winogradChannels * winogradChannels) {
+    return WINOGRAD;
+  }
+  if (!directPossible) {
+    return IM2COL;
+  }
+  bool shallow = blockedChannels(filterDepth) >= 4 * filterDepth;
+  return !shallow || filterCount < 2 * directConvBlock() ? DIRECT : IM2COL;
+}
+
+// F(4x4, 3x3) is about 10x less accurate than F(2x2, 3x3), so it is kept for outputs large
+// enough for its savings to matter
+int winogradTileFor(int outW, int outH) {
+  return std::min(outW, outH) >= 16 ? 4 : 2;
+}
+
+} // namespace
 
 ConvolutionalLayer::ConvolutionalLayer(int filterSize, int filterDepth, int filterCount,
-                                       ActivationFunction activation)
+                                       ActivationFunction activation, int stride, int padding)
     : Layer(activation) {
+  if (stride < 1 || padding < 0) {
+    throw std::invalid_argument("Stride must be positive and padding non negative");
+  }
   this->activation = activation;
   this->filterSize = filterSize;
   this->filterDepth = filterDepth;
   this->filterCount = filterCount;
+  this->stride = stride;
+  this->padding = padding;
   this->flatFilters = Matrix<float>(filterCount, filterSize * filterSize * filterDepth);
   this->biases = Matrix<float>(1, filterCount);
+  this->weightDeltas = Matrix<float>(filterCount, filterSize * filterSize * filterDepth);
+  this->biasDeltas = Matrix<float>(1, filterCount);
+}
+
+TensorView<const float> ConvolutionalLayer::forward(TensorView<const float> input) {
+  return this->forwardBatch(Tensor4View<const float>(input)).sample(0);
 }
 
-Tensor3<float> ConvolutionalLayer::forward(Tensor3<float> input) {
-  Matrix<float> flatInput = im2col<float>(input, this->filterSize, this->filterDepth);
-  this->flatLastInput = flatInput;
-  Matrix<float> featureMat = cross(flatInput, this->flatFilters);
-  this->flatActivations = Matrix<float>(featureMat.getNumCols(), featureMat.getNumRows());
-  int slidesW = input.getWidth() - this->filterSize + 1;
-  int slidesH = input.getHeight() - this->filterSize + 1;
-  Tensor3<float> featureTens = Tensor3<float>(slidesW, slidesH, this->filterCount);
-  for (size_t y = 0; y < featureMat.getNumRows(); y++) {
-    int row = std::floor(y / slidesW);
-    int col = y % slidesW;
-    for (size_t x = 0; x < featureMat.getNumCols(); x++) {
-      float value = featureMat.getValue(x, y) + this->biases.getValue(0, x);
-      this->flatActivations.setValue(x, y, value);
-      if (this->activation == RELU) {
-        value = relu(value);
-      } else if (this->activation == SIGMOID) {
-        value = sigmoid(value);
+TensorView<const float> ConvolutionalLayer::backwards(TensorView<const float> prevLayerDeltas) {
+  return this->backwardsBatch(Tensor4View<const float>(prevLayerDeltas)).sample(0);
+}
+
+Tensor4View<const float> ConvolutionalLayer::forwardBatch(Tensor4View<const float> input) {
+  this->algorithm = chooseAlgorithm(this->preferredAlgorithm, this->filterSize, this->stride,
+                                    this->filterDepth, this->filterCount,
+                                    input.getWidth() + 2 * this->padding,
+                                    input.getHeight() + 2 * this->padding);
+  this->batchSize = input.getBatchSize();
+  if (this->batchSize > 1 && (this->algorithm == WINOGRAD || this->algorithm == FFT)) {
+    // Winograd and FFT keep per-sample transforms, batches take the direct kernels instead
+    bool direct = directPreferred(this->filterSize, this->stride);
+    this->algorithm = direct ? DIRECT : IM2COL;
+  }
+  if (this->algorithm == DIRECT) {
+    return this->forwardDirect(this->padInput(input));
+  }
+  if (this->algorithm == WINOGRAD) {
+    return Tensor4View<const float>(this->forwardWinograd(this->padInput(input).sample(0)));
+  }
+  if (this->algorithm == FFT) {
+    return Tensor4View<const float>(this->forwardFft(this->padInput(input).sample(0)));
+  }
+  return this->forwardIm2col(input);
+}
+
+Tensor4View<const float> ConvolutionalLayer::backwardsBatch(
+    Tensor4View<const float> prevLayerDeltas) {
+  if (this->algorithm == DIRECT) {
+    return this->cropPadding(this->backwardsDirect(prevLayerDeltas));
+  }
+  if (this->algorithm == WINOGRAD) {
+    TensorView<const float> sample = this->backwardsWinograd(prevLayerDeltas.sample(0));
+    return this->cropPadding(Tensor4View<const float>(sample));
+  }
+  if (this->algorithm == FFT) {
+    TensorView<const float> sample = this->backwardsFft(prevLayerDeltas.sample(0));
+    return this->cropPadding(Tensor4View<const float>(sample));
+  }
+  return this->backwardsIm2col(prevLayerDeltas);
+}
+
+Tensor4View<const float> ConvolutionalLayer::forwardIm2col(Tensor4View<const float> input) {
+  int n = input.getBatchSize();
+  int k = this->filterSize;
+  int slidesW = convOutputSize(input.getWidth(), k, this->stride, this->padding);
+  int slidesH = convOutputSize(input.getHeight(), k, this->stride, this->padding);
+  int positions = slidesW * slidesH;
+  int patchSize = k * k * this->filterDepth;
+  this->batchSize = n;
+  this->lastBatch = input;
+  this->flatLastInput.resize(patchSize, n * positions);
+  MatrixView<float> flatInput = this->flatLastInput.view();
+#pragma omp parallel for schedule(static) if (n > 1 && omp_get_max_threads() > 1)
+  for (int b = 0; b < n; b++) {
+    im2colInto<float>(input.sample(b), k, this->filterDepth,
+                      flatInput.rows(b * positions, positions), this->stride, this->padding);
+  }
+  this->flatActivations.resize(n * positions, this->filterCount);
+  this->output.resize(n, slidesW, slidesH, this->filterCount);
+  // Computed as filters^T * input^T for the whole batch at once, so each row holds one
+  // filter's feature maps of every sample. A single sample is already the channel-major
+  // layout of the output tensor, batches are regrouped by sample afterwards.
+  float* activated = this->output.getValues();
+  if (n > 1) {
+    this->stackedOutput.resize(n * positions, this->filterCount);
+    activated = this->stackedOutput.getValues();
+  }
+  GemmEpilogue epilogue;
+  epilogue.bias = this->biases.getValues();
+  epilogue.biasMode = ROW_BIAS;
+  epilogue.activation = this->activation;
+  epilogue.preActivations = this->flatActivations.getValues();
+  epilogue.ldp = n * positions;
+  sgemm(true, true, this->filterCount, n * positions, patchSize, this->flatFilters.getValues(),
+        this->filterCount, this->flatLastInput.getValues(), patchSize, activated,
+        n * positions, false, &epilogue);
+  if (n > 1) {
+    for (int f = 0; f < this->filterCount; f++) {
+      for (int b = 0; b < n; b++) {
+        const float* src = activated + ((size_t)f * n + b) * positions;
+        std::copy(src, src + positions, this->output.sample(b).channels(f, 1).getValues());
       }
-      featureTens.setValue(col, row, x, value);
     }
   }
-  return featureTens;
-}
-
-Tensor3<float> ConvolutionalLayer::backwards(Tensor3<float> prevLayerDeltas) {
-  Matrix<float> flatDeltas = im2col<float>(prevLayerDeltas, 1, this->filterCount);
-  this->deltas =
-      hadamard(flatDeltas, apply(this->flatActivations,
-                                 this->activation == RELU ? reluDerivative : sigmoidDerivative));
-  Matrix<float> prevDeltas = cross(this->deltas, transpose(this->flatFilters));
-  int inputW = prevLayerDeltas.getWidth() + this->filterSize - 1;
-  int inputH = prevLayerDeltas.getHeight() + this->filterSize - 1;
-  Tensor3<float> result = Tensor3<float>(inputW, inputH, this->filterDepth);
-  for (size_t col = 0; col < prevDeltas.getNumRows(); col++) {
-    int outY = col / inputW;
-    int outX = col % inputW;
-    for (size_t c = 0; c < (size_t)this->filterDepth; c++) {
-      int channelBase = c * this->filterSize * this->filterSize;
-      for (size_t fy = 0; fy < (size_t)this->filterSize; fy++) {
-        for (size_t fx = 0; fx < (size_t)this->filterSize; fx++) {
-          int inY = outY - (int)fy;
-          int inX = outX - (int)fx;
-          if (inY >= 0 && inX >= 0 && inY < inputH && inX < inputW) {
-            float v = result.getValue(inX, inY, c);
-            v += prevDeltas.getValue(channelBase + fy * this->filterSize + fx, col);
-            result.setValue(inX, inY, c, v);
-          }
-        }
-      }
+  return this->output.view();
+}
+
+Tensor4View<const float> ConvolutionalLayer::backwardsIm2col(
+    Tensor4View<const float> prevLayerDeltas) {
+  int n = prevLayerDeltas.getBatchSize();
+  int positions = prevLayerDeltas.getWidth() * prevLayerDeltas.getHeight();
+  int patchSize = this->filterSize * this->filterSize * this->filterDepth;
+  this->computeDeltas(prevLayerDeltas);
+  // Patch gradients deltas^T * filters^T, one row per output position of every sample,
+  // added back onto the pixels they were read from
+  this->flatInputDeltas.resize(patchSize, n * positions);
+  sgemm(true, true, n * positions, patchSize, this->filterCount, this->deltas.getValues(),
+        n * positions, this->flatFilters.getValues(), this->filterCount,
+        this->flatInputDeltas.getValues(), patchSize);
+  this->inputDeltas.resize(n, this->lastBatch.getWidth(), this->lastBatch.getHeight(),
+                           this->filterDepth);
+  for (int b = 0; b < n; b++) {
+    col2imInto<float>(this->flatInputDeltas.view().rows(b * positions, positions),
+                      this->filterSize, this->filterDepth, this->inputDeltas.sample(b),
+                      this->stride, this->padding);
+  }
+  return this->inputDeltas.view();
+}
+
+Tensor4View<const float> ConvolutionalLayer::padInput(Tensor4View<const float> input) {
+  if (this->padding == 0) {
+    return input;
+  }
+  int p = this->padding;
+  int width = input.getWidth();
+  int height = input.getHeight();
+  int planes = input.getBatchSize() * input.getChannels();
+  int paddedW = width + 2 * p;
+  int paddedH = height + 2 * p;
+  this->paddedInput.resize(input.getBatchSize(), paddedW, paddedH, input.getChannels());
+  float* padded = this->paddedInput.getValues();
+  std::fill(padded, padded + (size_t)planes * paddedW * paddedH, 0.0f);
+  for (int plane = 0; plane < planes; plane++) {
+    for (int y = 0; y < height; y++) {
+      const float* src = input.getValues() + ((size_t)plane * height + y) * width;
+      std::copy(src, src + width, padded + ((size_t)plane * paddedH + y + p) * paddedW + p);
+    }
+  }
+  return this->paddedInput.view();
+}
+
+Tensor4View<const float> ConvolutionalLayer::cropPadding(Tensor4View<const float> inputDeltas) {
+  if (this->padding == 0) {
+    return inputDeltas;
+  }
+  int p = this->padding;
+  int paddedW = inputDeltas.getWidth();
+  int paddedH = inputDeltas.getHeight();
+  int width = paddedW - 2 * p;
+  int height = paddedH - 2 * p;
+  int planes = inputDeltas.getBatchSize() * inputDeltas.getChannels();
+  this->croppedInputDeltas.resize(inputDeltas.getBatchSize(), width, height,
+                                  inputDeltas.getChannels());
+  float* cropped = this->croppedInputDeltas.getValues();
+  for (int plane = 0; plane < planes; plane++) {
+    for (int y = 0; y < height; y++) {
+      const float* src = inputDeltas.getValues() + ((size_t)plane * paddedH + y + p) * paddedW + p;
+      std::copy(src, src + width, cropped + ((size_t)plane * height + y) * width);
+    }
+  }
+  return this->croppedInputDeltas.view();
+}
+
+// deltas = prevLayerDeltas * activation'(flatActivations), with one row per filter holding
+// the positions of every sample like flatActivations
+void ConvolutionalLayer::computeDeltas(Tensor4View<const float> prevLayerDeltas) {
+  int n = prevLayerDeltas.getBatchSize();
+  int positions = prevLayerDeltas.getWidth() * prevLayerDeltas.getHeight();
+  this->deltas.resize(n * positions, this->filterCount);
+  for (int f = 0; f < this->filterCount; f++) {
+    for (int b = 0; b < n; b++) {
+      size_t row = ((size_t)f * n + b) * positions;
+      applyActivationDerivative(this->activation, this->flatActivations.getValues() + row,
+                                prevLayerDeltas.sample(b).channels(f, 1).getValues(),
+                                this->deltas.getValues() + row, positions);
     }
   }
-  return result;
 }
 
-void ConvolutionalLayer::update(float learningRate) {
-  Matrix<float> weightDeltas = cross(transpose(this->flatLastInput), this->deltas);
-  for (size_t f = 0; f < filterCount; f++) {
-    for (size_t c = 0; c < filterDepth; c++) {
-      int channel = c * this->filterSize * this->filterSize;
-      for (size_t y = 0; y < filterSize; y++) {
-        int row = y * this->filterSize;
-        for (size_t x = 0; x < filterSize; x++) {
-          float val = this->flatFilters.getValue(f, channel + row + x) -
-                      learningRate * weightDeltas.getValue(f, channel + row + x);
-          this->flatFilters.setValue(f, channel + row + x, val);
+// Samples are convolved one after the other, each call already spreads over the threads
+Tensor4View<const float> ConvolutionalLayer::forwardDirect(Tensor4View<const float> input) {
+  this->lastBatch = input;
+  int n = input.getBatchSize();
+  int k = this->filterSize;
+  int block = directConvBlock();
+  int filterBlocks = blockedChannels(this->filterCount) / block;
+  int depthBlocks = blockedChannels(this->filterDepth) / block;
+  int slidesW = input.getWidth() - k + 1;
+  int slidesH = input.getHeight() - k + 1;
+  // Filters are repacked every pass, which is cheap next to the convolution itself
+  this->packedFilters.resize(filterBlocks * this->filterDepth * k * k * block, 1);
+  this->packedBackFilters.resize(depthBlocks * this->filterCount * k * k * block, 1);
+  packDirectFilters(this->flatFilters.getValues(), k, this->filterDepth, this->filterCount,
+                    this->packedFilters.getValues(), this->packedBackFilters.getValues());
+  this->packedBiases.resize(filterBlocks * block, 1);
+  float* paddedBiases = this->packedBiases.getValues();
+  std::fill(paddedBiases, paddedBiases + filterBlocks * block, 0.0f);
+  std::copy(this->biases.getValues(), this->biases.getValues() + this->filterCount,
+            paddedBiases);
+  size_t blockedSize = (size_t)filterBlocks * block * slidesW * slidesH;
+  this->blockedActivations.resize(n * blockedSize, 1);
+  this->output.resize(n, slidesW, slidesH, this->filterCount);
+  for (int b = 0; b < n; b++) {
+    float* blocked = this->blockedActivations.getValues() + b * blockedSize;
+    directConv(input.sample(b).getValues(), this->filterDepth, input.getWidth(),
+               input.getHeight(), 1, this->packedFilters.getValues(), paddedBiases,
+               filterBlocks, k, blocked);
+    fromBlocked(blocked, this->filterCount, slidesW, slidesH,
+                this->output.sample(b).getValues());
+  }
+  size_t size = (size_t)n * slidesW * slidesH * this->filterCount;
+  applyActivation(this->activation, this->output.getValues(), this->output.getValues(), size);
+  return this->output.view();
+}
+
+Tensor4View<const float> ConvolutionalLayer::backwardsDirect(
+    Tensor4View<const float> prevLayerDeltas) {
+  int n = prevLayerDeltas.getBatchSize();
+  int k = this->filterSize;
+  int block = directConvBlock();
+  int filterBlocks = blockedChannels(this->filterCount) / block;
+  int depthBlocks = blockedChannels(this->filterDepth) / block;
+  int slidesW = prevLayerDeltas.getWidth();
+  int slidesH = prevLayerDeltas.getHeight();
+  // The deltas get a k - 1 border so the input gradient is a valid convolution of them
+  int pad = k - 1;
+  int paddedW = slidesW + 2 * pad;
+  int paddedH = slidesH + 2 * pad;
+  size_t paddedSize = (size_t)filterBlocks * block * paddedW * paddedH;
+  this->paddedDeltas.resize(n * paddedSize, 1);
+  float* deltas = this->paddedDeltas.getValues();
+  for (int b = 0; b < n; b++) {
+    toBlocked(prevLayerDeltas.sample(b).getValues(), this->filterCount, slidesW, slidesH, pad,
+              deltas + b * paddedSize);
+  }
+  // Blocks of every sample follow each other in both buffers
+  for (int fb = 0; fb < n * filterBlocks; fb++) {
+    for (int y = 0; y < slidesH; y++) {
+      const float* pre =
+          this->blockedActivations.getValues() + ((size_t)fb * slidesH + y) * slidesW * block;
+      float* row = deltas + (((size_t)fb * paddedH + y + pad) * paddedW + pad) * block;
+      applyActivationDerivative(this->activation, pre, row, row, slidesW * block);
+    }
+  }
+  int inputW = slidesW + k - 1;
+  int inputH = slidesH + k - 1;
+  size_t blockedSize = (size_t)depthBlocks * block * inputW * inputH;
+  this->blockedInputDeltas.resize(n * blockedSize, 1);
+  this->inputDeltas.resize(n, inputW, inputH, this->filterDepth);
+  for (int b = 0; b < n; b++) {
+    float* blocked = this->blockedInputDeltas.getValues() + b * blockedSize;
+    directConv(deltas + b * paddedSize, this->filterCount, paddedW, paddedH, block,
+               this->packedBackFilters.getValues(), nullptr, depthBlocks, k, blocked);
+    fromBlocked(blocked, this->filterDepth, inputW, inputH,
+                this->inputDeltas.sample(b).getValues());
+  }
+  return this->inputDeltas.view();
+}
+
+void ConvolutionalLayer::computeWeightDeltasDirect(float* weightDeltas) {
+  int k = this->filterSize;
+  int block = directConvBlock();
+  int filterBlocks = blockedChannels(this->filterCount) / block;
+  this->packedWeightDeltas.resize(filterBlocks * this->filterDepth * k * k * block, 1);
+  directConvFilterGradient(this->lastBatch.getValues(), this->filterDepth,
+                           this->lastBatch.getWidth(), this->lastBatch.getHeight(), 1,
+                           this->paddedDeltas.getValues(), k - 1, filterBlocks, k,
+                           this->packedWeightDeltas.getValues(), this->lastBatch.getBatchSize());
+  unpackDirectFilters(this->packedWeightDeltas.getValues(), k, this->filterDepth,
+                      this->filterCount, weightDeltas);
+}
+
+// Adds every filter's deltas over all output positions of the batch to its bias gradient,
+// read from the interior of the padded blocked deltas
+void ConvolutionalLayer::addBiasDeltasDirect() {
+  int block = directConvBlock();
+  int pad = this->filterSize - 1;
+  int slidesW = this->lastBatch.getWidth() - pad;
+  int slidesH = this->lastBatch.getHeight() - pad;
+  int paddedW = slidesW + 2 * pad;
+  int paddedH = slidesH + 2 * pad;
+  size_t paddedSize = (size_t)blockedChannels(this->filterCount) * paddedW * paddedH;
+  const float* deltas = this->paddedDeltas.getValues();
+  for (int f = 0; f < this->filterCount; f++) {
+    float delta = 0.0f;
+    for (int b = 0; b < this->lastBatch.getBatchSize(); b++) {
+      for (int y = 0; y < slidesH; y++) {
+        const float* row = deltas + b * paddedSize +
+                           (((size_t)(f / block) * paddedH + y + pad) * paddedW + pad) * block +
+                           f % block;
+        for (int x = 0; x < slidesW; x++) {
+          delta += row[(size_t)x * block];
         }
       }
     }
+    this->biasDeltas.setValue(0, f, this->biasDeltas.getValue(0, f) + delta);
+  }
+}
+
+TensorView<const float> ConvolutionalLayer::forwardWinograd(TensorView<const float> input) {
+  if (!input.isContiguous()) {
+    throw std::invalid_argument("Winograd convolution needs a contiguous input");
+  }
+  this->lastInput = input;
+  int slidesW = input.getWidth() - 2;
+  int slidesH = input.getHeight() - 2;
+  int m = winogradTileFor(slidesW, slidesH);
+  if (this->winogradTile != m) {
+    size_t size = winogradFilterSize(this->filterDepth, this->filterCount, m);
+    this->winogradFilters.resize(size, 1);
+    this->winogradBackFilters.resize(size, 1);
+    winogradTransformFilters(this->flatFilters.getValues(), this->filterDepth,
+                             this->filterCount, m, false, this->winogradFilters.getValues());
+    winogradTransformFilters(this->flatFilters.getValues(), this->filterDepth,
+                             this->filterCount, m, true, this->winogradBackFilters.getValues());
+    this->winogradTile = m;
+  }
+  // Sized for the backward pass as well so the buffer is allocated once
+  size_t workspace = std::max(
+      winogradWorkspaceSize(this->filterDepth, this->filterCount, input.getWidth(),
+                            input.getHeight(), m),
+      winogradWorkspaceSize(this->filterCount, this->filterDepth, slidesW + 4, slidesH + 4, m));
+  this->winogradWorkspace.resize(workspace, 1);
+  this->flatActivations.resize(slidesW * slidesH, this->filterCount);
+  winogradConv(input.getValues(), this->filterDepth, input.getWidth(), input.getHeight(),
+               this->winogradFilters.getValues(), this->filterCount, this->biases.getValues(),
+               m, this->flatActivations.getValues(), this->winogradWorkspace.getValues());
+  this->output.resize(1, slidesW, slidesH, this->filterCount);
+  applyActivation(this->activation, this->flatActivations.getValues(),
+                  this->output.getValues(), slidesW * slidesH * this->filterCount);
+  return this->output.sample(0);
+}
+
+TensorView<const float> ConvolutionalLayer::backwardsWinograd(
+    TensorView<const float> prevLayerDeltas) {
+  this->computeDeltas(Tensor4View<const float>(prevLayerDeltas));
+  int slidesW = prevLayerDeltas.getWidth();
+  int slidesH = prevLayerDeltas.getHeight();
+  // The input gradient is the forward convolution of the deltas padded by 2 with the
+  // flipped filters
+  int paddedW = slidesW + 4;
+  int paddedH = slidesH + 4;
+  this->paddedDeltas.resize(this->filterCount * paddedW * paddedH, 1);
+  float* padded = this->paddedDeltas.getValues();
+  std::fill(padded, padded + this->filterCount * paddedW * paddedH, 0.0f);
+  for (int f = 0; f < this->filterCount; f++) {
+    for (int y = 0; y < slidesH; y++) {
+      const float* src = this->deltas.getValues() + ((size_t)f * slidesH + y) * slidesW;
+      std::copy(src, src + slidesW, padded + ((size_t)f * paddedH + y + 2) * paddedW + 2);
+    }
+  }
+  this->inputDeltas.resize(1, slidesW + 2, slidesH + 2, this->filterDepth);
+  winogradConv(padded, this->filterCount, paddedW, paddedH,
+               this->winogradBackFilters.getValues(), this->filterDepth, nullptr,
+               this->winogradTile, this->inputDeltas.getValues(),
+               this->winogradWorkspace.getValues());
+  return this->inputDeltas.sample(0);
+}
+
+TensorView<const float> ConvolutionalLayer::forwardFft(TensorView<const float> input) {
+  if (!input.isContiguous()) {
+    throw std::invalid_argument("FFT convolution needs a contiguous input");
+  }
+  this->lastInput = input;
+  int inW = input.getWidth();
+  int inH = input.getHeight();
+  int slidesW = inW - this->filterSize + 1;
+  int slidesH = inH - this->filterSize + 1;
+  // The grid only has to hold the input: the input gradient is inW x inH as well, and the
+  // wrap-around of the correlations lands past the pixels that are kept
+  int gridW = fftSize(inW);
+  int gridH = fftSize(inH);
+  if (this->fft.getWidth() != gridW || this->fft.getHeight() != gridH) {
+    this->fft = Fft2d(gridW, gridH);
+    this->fftFiltersReady = false;
   }
-  for (size_t f = 0; f < filterCount; f++) {
-    float biasVal = this->biases.getValue(0, f) - learningRate * this->deltas.getValue(f, 0);
-    this->biases.setValue(0, f, biasVal);
+  if (!this->fftFiltersReady) {
+    this->fftFilters.resize(fftSpectraSize(this->fft, this->filterDepth * this->filterCount),
+                            1);
+    fftTransformFilters(this->fft, this->flatFilters.getValues(), this->filterSize,
+                        this->filterDepth, this->filterCount, this->fftFilters.getValues());
+    this->fftFiltersReady = true;
   }
+  this->fftInput.resize(fftSpectraSize(this->fft, this->filterDepth), 1);
+  fftTransformPlanes(this->fft, input.getValues(), this->filterDepth, inW, inH,
+                     this->fftInput.getValues());
+  this->flatActivations.resize(slidesW * slidesH, this->filterCount);
+  fftCorrelate(this->fft, this->fftInput.getValues(), this->filterDepth,
+               this->fftFilters.getValues(), this->filterCount, this->biases.getValues(),
+               slidesW, slidesH, this->flatActivations.getValues());
+  this->output.resize(1, slidesW, slidesH, this->filterCount);
+  applyActivation(this->activation, this->flatActivations.getValues(),
+                  this->output.getValues(), slidesW * slidesH * this->filterCount);
+  return this->output.sample(0);
+}
+
+TensorView<const float> ConvolutionalLayer::backwardsFft(TensorView<const float> prevLayerDeltas) {
+  this->computeDeltas(Tensor4View<const float>(prevLayerDeltas));
+  int slidesW = prevLayerDeltas.getWidth();
+  int slidesH = prevLayerDeltas.getHeight();
+  this->fftDeltas.resize(fftSpectraSize(this->fft, this->filterCount), 1);
+  fftTransformPlanes(this->fft, this->deltas.getValues(), this->filterCount, slidesW, slidesH,
+                     this->fftDeltas.getValues());
+  int inputW = slidesW + this->filterSize - 1;
+  int inputH = slidesH + this->filterSize - 1;
+  this->inputDeltas.resize(1, inputW, inputH, this->filterDepth);
+  fftInputGradient(this->fft, this->fftDeltas.getValues(), this->filterCount,
+                   this->fftFilters.getValues(), this->filterDepth, inputW, inputH,
+                   this->inputDeltas.getValues());
+  return this->inputDeltas.sample(0);
+}
+
+void ConvolutionalLayer::accumulateGradients() {
+  int patchSize = this->filterSize * this->filterSize * this->filterDepth;
+  float* weightDeltas = this->weightDeltas.getValues();
+  bool separate = this->hasGradients && (this->algorithm == DIRECT || this->algorithm == FFT);
+  if (separate) {
+    this->passWeightDeltas.resize(this->filterCount, patchSize);
+    weightDeltas = this->passWeightDeltas.getValues();
+  }
+  if (this->algorithm == DIRECT) {
+    this->computeWeightDeltasDirect(weightDeltas);
+  } else if (this->algorithm == FFT) {
+    fftFilterGradient(this->fft, this->fftInput.getValues(), this->filterDepth,
+                      this->fftDeltas.getValues(), this->filterCount, this->filterSize,
+                      weightDeltas);
+  } else {
+    if (this->algorithm == WINOGRAD) {
+      // The forward pass didn't need the im2col matrix, the filter gradient still does
+      im2colInto<float>(this->lastInput, this->filterSize, this->filterDepth,
+                        this->flatLastInput);
+    }
+    // input^T * deltas^T over the positions of every sample sums the batch's gradients
+    sgemm(true, true, patchSize, this->filterCount, this->deltas.getNumCols(),
+          this->flatLastInput.getValues(), patchSize, this->deltas.getValues(),
+          this->deltas.getNumCols(), weightDeltas, this->filterCount, this->hasGradients);
+  }
+  if (separate) {
+    this->weightDeltas = this->weightDeltas + this->passWeightDeltas;
+  }
+  if (!this->hasGradients) {
+    std::fill(this->biasDeltas.getValues(), this->biasDeltas.getValues() + this->filterCount,
+              0.0f);
+  }
+  if (this->algorithm == DIRECT) {
+    this->addBiasDeltasDirect();
+  } else {
+    // A bias feeds every output position of its filter, all of them in one row of deltas
+    int columns = this->deltas.getNumCols();
+    for (int f = 0; f < this->filterCount; f++) {
+      const float* row = this->deltas.getValues() + (size_t)f * columns;
+      float delta = 0.0f;
+#pragma omp simd reduction(+ : delta)
+      for (int i = 0; i < columns; i++) {
+        delta += row[i];
+      }
+      this->biasDeltas.setValue(0, f, this->biasDeltas.getValue(0, f) + delta);
+    }
+  }
+  this->hasGradients = true;
+}
+
+void ConvolutionalLayer::clearGradients() {
+  this->hasGradients = false;
+}
+
+void ConvolutionalLayer::addGradients(const Layer& replica) {
+  const ConvolutionalLayer& other = static_cast<const ConvolutionalLayer&>(replica);
+  this->weightDeltas = this->weightDeltas + other.weightDeltas;
+  this->biasDeltas = this->biasDeltas + other.biasDeltas;
+}
+
+Layer* ConvolutionalLayer::clone() const {
+  return new ConvolutionalLayer(*this);
+}
+
+void ConvolutionalLayer::copyParameters(const Layer& source) {
+  const ConvolutionalLayer& other = static_cast<const ConvolutionalLayer&>(source);
+  this->flatFilters = other.flatFilters;
+  this->biases = other.biases;
+  this->invalidateCaches();
+}
+
+void ConvolutionalLayer::copyParametersRelaxed(const Layer& shared) {
+  const ConvolutionalLayer& other = static_cast<const ConvolutionalLayer&>(shared);
+  relaxedCopy(other.flatFilters.getValues(), this->flatFilters.getValues(),
+              (size_t)this->flatFilters.getNumCols() * this->flatFilters.getNumRows());
+  relaxedCopy(other.biases.getValues(), this->biases.getValues(), this->biases.getNumRows());
+  this->invalidateCaches();
+}
+
+void ConvolutionalLayer::applyGradientsRelaxed(Layer& shared, float learningRate, int samples) {
+  ConvolutionalLayer& other = static_cast<ConvolutionalLayer&>(shared);
+  float step = learningRate / samples;
+  relaxedSubtractScaled(other.flatFilters.getValues(), this->weightDeltas.getValues(), step,
+                        (size_t)this->flatFilters.getNumCols() * this->flatFilters.getNumRows());
+  relaxedSubtractScaled(other.biases.getValues(), this->biasDeltas.getValues(), step,
+                        this->biases.getNumRows());
+}
+
+void ConvolutionalLayer::collectParameters(std::vector<MatrixView<float>>& out) {
+  out.push_back(this->flatFilters.view());
+  out.push_back(this->biases.view());
+}
+
+void ConvolutionalLayer::collectGradients(std::vector<MatrixView<float>>& out) {
+  out.push_back(this->weightDeltas.view());
+  out.push_back(this->biasDeltas.view());
+}
+
+void ConvolutionalLayer::invalidateCaches() {
+  this->winogradTile = 0;
+  this->fftFiltersReady = false;
 }
 
 void ConvolutionalLayer::initWeights() {
   std::mt19937 rng(std::random_device{}());
   int fan_in = this->filterSize * this->filterSize * this->filterDepth;
-  // He init for ReLU: stddev = sqrt(2 / fan_in)
-  // Xavier init for Sigmoid/None: stddev = sqrt(1 / fan_in)
-  float stddev = (this->activation == RELU) ? std::sqrt(2.0f / fan_in) : std::sqrt(1.0f / fan_in);
+  // He init for the ReLU family: stddev = sqrt(2 / fan_in)
+  // Xavier init for Sigmoid/Tanh/None: stddev = sqrt(1 / fan_in)
+  float stddev =
+      usesHeInit(this->activation) ? std::sqrt(2.0f / fan_in) : std::sqrt(1.0f / fan_in);
   std::normal_distribution<float> dist(0.0f, stddev);
   for (size_t f = 0; f < (size_t)this->filterCount; f++) {
     for (size_t c = 0; c < (size_t)this->filterDepth; c++) {
@@ -113,14 +665,16 @@ void ConvolutionalLayer::initWeights() {
   for (size_t f = 0; f < (size_t)this->filterCount; f++) {
     this->biases.setValue(0, f, 0.0f);
   }
+  this->invalidateCaches();
 }
 
 void ConvolutionalLayer::setFilters(Matrix<float> filters) {
-  this->flatFilters = filters;
+  this->flatFilters = std::move(filters);
+  this->invalidateCaches();
 }
 
 void ConvolutionalLayer::setBiases(Matrix<float> biases) {
-  this->biases = biases;
+  this->biases = std::move(biases);
 }
 
 Matrix<float> ConvolutionalLayer::getFilters() {
@@ -139,6 +693,23 @@ int ConvolutionalLayer::getFilterSize() {
 int ConvolutionalLayer::getFilterDepth() {
   return this->filterDepth;
 }
+int ConvolutionalLayer::getStride() {
+  return this->stride;
+}
+int ConvolutionalLayer::getPadding() {
+  return this->padding;
+}
 ActivationFunction ConvolutionalLayer::getActivation() {
   return this->activation;
+}
+void ConvolutionalLayer::setAlgorithm(ConvAlgorithm algorithm) {
+  if (!algorithmAvailable(algorithm, this->filterSize, this->stride)) {
+    throw std::invalid_argument(
+        "Convolution algorithm not available for this filter size and stride");
+  }
+  this->preferredAlgorithm = algorithm;
+}
+
+ConvAlgorithm ConvolutionalLayer::getAlgorithm() {
+  return this->algorithm;
 }
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include <Dataset.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char MAGIC[8] = {'C', 'N', 'N', 'D', 'A', 'T', 'A', '\0'};
+constexpr uint32_t VERSION = 1;
+// Sections start at multiples of this, a cache line
+constexpr uint64_t ALIGNMENT = 64;
+// IDX magic numbers of unsigned byte data with 3 (images) and 1 (labels) dimensions
+constexpr uint32_t IDX_IMAGES = 0x00000803;
+constexpr uint32_t IDX_LABELS = 0x00000801;
+
+// Native header, in the byte order of the machine that wrote it
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  uint32_t classes;
+  uint64_t pixelOffset;
+  uint64_t labelOffset;
+  uint8_t reserved[16];
+};
+static_assert(sizeof(FileHeader) == ALIGNMENT);
+
+[[noreturn]] void fail(const std::string& what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+[[noreturn]] void malformed(const std::string& path, const std::string& what) {
+  throw std::runtime_error(path + ": " + what);
+}
+
+uint64_t alignUp(uint64_t offset) {
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+uint32_t readBigEndian(const uint8_t* bytes) {
+  return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 |
+         bytes[3];
+}
+
+} // namespace
+
+Dataset::Dataset(int count, int width, int height, int channels, int classes) {
+  if (count < 0 || width < 1 || height < 1 || channels < 1 || classes < 1) {
+    throw std::invalid_argument("Dataset dimensions must be positive");
+  }
+  this->count = count;
+  this->width = width;
+  this->height = height;
+  this->channels = channels;
+  this->classes = classes;
+  this->ownedPixels.assign((size_t)count * width * height * channels, 0);
+  this->ownedLabels.assign(count, 0);
+  this->pixels = this->ownedPixels.data();
+  this->labels = this->ownedLabels.data();
+}
+
+Dataset::Dataset(Dataset&& other) noexcept {
+  *this = std::move(other);
+}
+
+Dataset& Dataset::operator=(Dataset&& other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
+  this->unmap();
+  this->count = other.count;
+  this->width = other.width;
+  this->height = other.height;
+  this->channels = other.channels;
+  this->classes = other.classes;
+  // Moving a vector keeps its buffer, so the pointers into it stay valid
+  this->ownedPixels = std::move(other.ownedPixels);
+  this->ownedLabels = std::move(other.ownedLabels);
+  this->pixels = other.pixels;
+  this->labels = other.labels;
+  this->mapping = other.mapping;
+  this->mappingSize = other.mappingSize;
+  other.count = 0;
+  other.pixels = nullptr;
+  other.labels = nullptr;
+  other.mapping = nullptr;
+  other.mappingSize = 0;
+  return *this;
+}
+
+void Dataset::unmap() {
+  if (this->mapping != nullptr) {
+    munmap(this->mapping, this->mappingSize);
+    this->mapping = nullptr;
+    this->mappingSize = 0;
+  }
+}
+
+void Dataset::checkLabels() const {
+  for (int i = 0; i < this->count; i++) {
+    if (this->labels[i] < 0 || this->labels[i] >= this->classes) {
+      throw std::runtime_error("Label out of range in sample " + std::to_string(i));
+    }
+  }
+}
+
+void Dataset::openIdx(const std::string& path, const std::string& labelPath) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(this->mapping);
+  if (labelPath.empty()) {
+    malformed(path, "IDX images need a label file");
+  }
+  if (this->mappingSize < 16) {
+    malformed(path, "truncated IDX header");
+  }
+  // Big endian count, rows and columns, then the pixels row major
+  uint64_t count = readBigEndian(bytes + 4);
+  uint64_t rows = readBigEndian(bytes + 8);
+  uint64_t cols = readBigEndian(bytes + 12);
+  if (count > INT_MAX || rows < 1 || cols < 1 || rows * cols > INT_MAX ||
+      16 + count * rows * cols > this->mappingSize) {
+    malformed(path, "IDX dimensions don't match the file");
+  }
+  std::ifstream labelFile(labelPath, std::ios::binary);
+  std::vector<uint8_t> raw((std::istreambuf_iterator<char>(labelFile)),
+                           std::istreambuf_iterator<char>());
+  if (!labelFile.is_open() || raw.size() < 8 || readBigEndian(raw.data()) != IDX_LABELS ||
+      readBigEndian(raw.data() + 4) != count || raw.size() < 8 + count) {
+    malformed(labelPath, "not IDX labels for " + path);
+  }
+  this->count = (int)count;
+  this->width = (int)cols;
+  this->height = (int)rows;
+  this->channels = 1;
+  this->ownedLabels.assign(raw.begin() + 8, raw.begin() + 8 + count);
+  this->classes =
+      count > 0 ? 1 + *std::max_element(raw.begin() + 8, raw.begin() + 8 + count) : 1;
+  this->pixels = bytes + 16;
+  this->labels = this->ownedLabels.data();
+}
+
+Dataset Dataset::open(const std::string& path, const std::string& labelPath) {
+  int file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    fail("Can't open " + path);
+  }
+  struct stat info;
+  if (fstat(file, &info) != 0) {
+    int error = errno;
+    close(file);
+    errno = error;
+    fail("Can't read " + path);
+  }
+  size_t size = info.st_size;
+  if (size < sizeof(uint32_t)) {
+    close(file);
+    malformed(path, "too short for a dataset");
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+  int error = errno;
+  close(file);
+  if (mapping == MAP_FAILED) {
+    errno = error;
+    fail("Can't map " + path);
+  }
+  // Every sample is visited each epoch, so the whole file is worth reading ahead
+  madvise(mapping, size, MADV_WILLNEED);
+  Dataset dataset;
+  dataset.mapping = mapping;
+  dataset.mappingSize = size;
+  const uint8_t* bytes = static_cast<const uint8_t*>(mapping);
+
+  if (readBigEndian(bytes) == IDX_IMAGES) {
+    dataset.openIdx(path, labelPath);
+    return dataset;
+  }
+
+  if (size < sizeof(FileHeader) || std::memcmp(bytes, MAGIC, sizeof(MAGIC)) != 0) {
+    malformed(path, "not a dataset file");
+  }
+  FileHeader header;
+  std::memcpy(&header, bytes, sizeof(FileHeader));
+  if (header.version != VERSION) {
+    malformed(path, "unsupported dataset version " + std::to_string(header.version));
+  }
+  // Clamped so a corrupt header can't overflow it
+  uint64_t imageSize =
+      std::min<uint64_t>((uint64_t)header.width * header.height, INT_MAX + 1ull) * header.channels;
+  if (header.count > INT_MAX || header.width < 1 || header.height < 1 ||
+      header.channels < 1 || header.classes < 1 || imageSize > INT_MAX ||
+      header.pixelOffset % ALIGNMENT != 0 || header.labelOffset % ALIGNMENT != 0 ||
+      header.pixelOffset < sizeof(FileHeader) || header.labelOffset > size ||
+      header.pixelOffset > header.labelOffset ||
+      header.pixelOffset + header.count * imageSize > header.labelOffset ||
+      header.labelOffset + header.count * sizeof(int32_t) > size) {
+    malformed(path, "header doesn't match the file");
+  }
+  dataset.count = (int)header.count;
+  dataset.width = (int)header.width;
+  dataset.height = (int)header.height;
+  dataset.channels = (int)header.channels;
+  dataset.classes = (int)header.classes;
+  dataset.pixels = bytes + header.pixelOffset;
+  dataset.labels = reinterpret_cast<const int32_t*>(bytes + header.labelOffset);
+  dataset.checkLabels();
+  return dataset;
+}
+
+void Dataset::save(const std::string& path) const {
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    fail("Can't create " + path);
+  }
+  FileHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.count = this->count;
+  header.width = this->width;
+  header.height = this->height;
+  header.channels = this->channels;
+  header.classes = this->classes;
+  uint64_t pixelBytes = (uint64_t)this->count * this->getImageSize();
+  header.pixelOffset = sizeof(FileHeader);
+  header.labelOffset = alignUp(header.pixelOffset + pixelBytes);
+  char padding[ALIGNMENT] = {};
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(this->pixels), pixelBytes);
+  file.write(padding, header.labelOffset - header.pixelOffset - pixelBytes);
+  file.write(reinterpret_cast<const char*>(this->labels), this->count * sizeof(int32_t));
+  file.close();
+  if (file.fail()) {
+    fail("Can't write " + path);
+  }
+}
+
+int Dataset::getSize() const {
+  return this->count;
+}
+
+int Dataset::getWidth() const {
+  return this->width;
+}
+
+int Dataset::getHeight() const {
+  return this->height;
+}
+
+int Dataset::getChannels() const {
+  return this->channels;
+}
+
+int Dataset::getClasses() const {
+  return this->classes;
+}
+
+int Dataset::getImageSize() const {
+  return this->width * this->height * this->channels;
+}
+
+uint8_t* Dataset::getImage(int index) {
+  if (this->pixels != this->ownedPixels.data()) {
+    throw std::invalid_argument("The pixels of a mapped dataset are read only");
+  }
+  return this->ownedPixels.data() + (size_t)index * this->getImageSize();
+}
+
+const uint8_t* Dataset::getImage(int index) const {
+  return this->pixels + (size_t)index * this->getImageSize();
+}
+
+int Dataset::getLabel(int index) const {
+  return this->labels[index];
+}
+
+void Dataset::setLabel(int index, int label) {
+  if (this->labels != this->ownedLabels.data()) {
+    throw std::invalid_argument("The labels of a mapped dataset are read only");
+  }
+  if (label < 0 || label >= this->classes) {
+    throw std::invalid_argument("Label out of range");
+  }
+  this->ownedLabels[index] = label;
+}
+
+void Dataset::loadSample(int index, float* image, float* label) const {
+  const uint8_t* src = this->getImage(index);
+  int size = this->getImageSize();
+  for (int i = 0; i < size; i++) {
+    image[i] = src[i] * (1.0f / 255.0f);
+  }
+  std::fill(label, label + this->classes, 0.0f);
+  label[this->labels[index]] = 1.0f;
+}
+
+Dataset::~Dataset() {
+  this->unmap();
+}
\ No newline at end of file
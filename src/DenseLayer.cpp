@@ -1,6 +1,8 @@
 #include <Activations.hpp>
 #include <Algebra.hpp>
 #include <DenseLayer.hpp>
+#include <Gemm.hpp>
+#include <VectorMath.hpp>
 #include <cmath>
 #include <random>
 
@@ -11,73 +13,123 @@ DenseLayer::DenseLayer(int inputSize, int outputSize, ActivationFunction activat
   this->activation = activation;
   this->weights = Matrix<float>(inputSize, outputSize);
   this->biases = Matrix<float>(1, outputSize);
-  this->activations = Matrix<float>(1, outputSize);
+  this->activations = Matrix<float>(outputSize, 1);
+  this->deltas = Matrix<float>(outputSize, 1);
+  this->weightDeltas = Matrix<float>(inputSize, outputSize);
+  this->biasDeltas = Matrix<float>(1, outputSize);
+  this->output = Tensor4<float>(1, outputSize, 1, 1);
+  this->inputDeltas = Tensor4<float>(1, inputSize, 1, 1);
 }
 
-Tensor3<float> DenseLayer::forward(Tensor3<float> input) {
-  Matrix<float> inputMat = Matrix<float>(1, this->inputSize);
-  for (size_t i = 0; i < input.getWidth(); i++) {
-    inputMat.setValue(0, i, input.getValue(i, 0, 0));
-  }
+TensorView<const float> DenseLayer::forward(TensorView<const float> input) {
+  return this->forwardBatch(Tensor4View<const float>(input)).sample(0);
+}
+
+TensorView<const float> DenseLayer::backwards(TensorView<const float> prevLayerDeltas) {
+  return this->backwardsBatch(Tensor4View<const float>(prevLayerDeltas)).sample(0);
+}
+
+Tensor4View<const float> DenseLayer::forwardBatch(Tensor4View<const float> input) {
+  int n = input.getBatchSize();
+  this->batchSize = n;
+  this->lastInput = input.asMatrix(this->inputSize, n);
+  this->activations.resize(this->outputSize, n);
+  this->output.resize(n, this->outputSize, 1, 1);
+  GemmEpilogue epilogue;
+  epilogue.bias = this->biases.getValues();
+  epilogue.biasMode = COLUMN_BIAS;
+  epilogue.activation = this->activation;
+  epilogue.preActivations = this->activations.getValues();
+  epilogue.ldp = this->outputSize;
+  // output = input * weights^T, one row per sample, so the whole batch is a single GEMM
+  sgemm(false, true, n, this->outputSize, this->inputSize, this->lastInput.getValues(),
+        this->inputSize, this->weights.getValues(), this->inputSize, this->output.getValues(),
+        this->outputSize, false, &epilogue);
+  return this->output.view();
+}
 
-  Matrix<float> outputMatrix = cross(this->weights, inputMat);
-  for (size_t x = 0; x < outputMatrix.getNumCols(); x++) {
-    for (size_t y = 0; y < outputMatrix.getNumRows(); y++) {
-      float val = outputMatrix.getValue(x, y) + this->biases.getValue(0, y);
-      this->activations.setValue(x, y, val);
-      if (this->activation == RELU) {
-        val = relu(val);
-      } else if (this->activation == SIGMOID) {
-        val = sigmoid(val);
-      }
-      outputMatrix.setValue(x, y, val);
+Tensor4View<const float> DenseLayer::backwardsBatch(Tensor4View<const float> prevLayerDeltas) {
+  int n = prevLayerDeltas.getBatchSize();
+  MatrixView<const float> prevLayerDeltasMat = prevLayerDeltas.asMatrix(this->outputSize, n);
+  this->deltas.resize(this->outputSize, n);
+  applyActivationDerivative(this->activation, this->activations.getValues(),
+                            prevLayerDeltasMat.getValues(), this->deltas.getValues(),
+                            this->outputSize * n);
+  this->inputDeltas.resize(n, this->inputSize, 1, 1);
+  crossInto<float>(this->deltas.view(), this->weights.view(),
+                   this->inputDeltas.view().asMatrix(this->inputSize, n), false, false);
+  return this->inputDeltas.view();
+}
+
+void DenseLayer::accumulateGradients() {
+  // Summed over the batch by the GEMM, which adds onto what is already there unless the
+  // buffers were cleared
+  sgemm(true, false, this->outputSize, this->inputSize, this->batchSize,
+        this->deltas.getValues(), this->outputSize, this->lastInput.getValues(),
+        this->lastInput.getRowStride(), this->weightDeltas.getValues(), this->inputSize,
+        this->hasGradients);
+  for (int i = 0; i < this->outputSize; i++) {
+    float biasDelta = this->hasGradients ? this->biasDeltas.getValue(0, i) : 0.0f;
+    for (int b = 0; b < this->batchSize; b++) {
+      biasDelta += this->deltas.getValue(i, b);
     }
+    this->biasDeltas.setValue(0, i, biasDelta);
   }
+  this->hasGradients = true;
+}
 
-  Tensor3<float> outputTensor = Tensor3<float>(outputMatrix.getNumRows(), 1, 1);
-  for (size_t i = 0; i < outputMatrix.getNumRows(); i++) {
-    outputTensor.setValue(i, 0, 0, outputMatrix.getValue(0, i));
-  }
-  this->lastInput = inputMat;
-  return outputTensor;
+void DenseLayer::clearGradients() {
+  this->hasGradients = false;
 }
 
-Tensor3<float> DenseLayer::backwards(Tensor3<float> prevLayerDeltas) {
-  Matrix<float> prevLayerDeltasMat = Matrix<float>(1, prevLayerDeltas.getWidth());
-  for (size_t i = 0; i < prevLayerDeltas.getWidth(); i++) {
-    prevLayerDeltasMat.setValue(0, i, prevLayerDeltas.getValue(i, 0, 0));
-  }
+void DenseLayer::addGradients(const Layer& replica) {
+  const DenseLayer& other = static_cast<const DenseLayer&>(replica);
+  this->weightDeltas = this->weightDeltas + other.weightDeltas;
+  this->biasDeltas = this->biasDeltas + other.biasDeltas;
+}
 
-  if (this->activation == NONE) {
-    this->deltas = prevLayerDeltasMat;
-  } else {
-    this->deltas = hadamard(
-        prevLayerDeltasMat,
-        apply(this->activations, this->activation == RELU ? reluDerivative : sigmoidDerivative));
-  }
-  Matrix<float> prevDeltas = cross(transpose(this->weights), deltas);
-  Tensor3<float> result = Tensor3<float>(this->inputSize, 1, 1);
-  for (size_t i = 0; i < (size_t)this->inputSize; i++) {
-    result.setValue(i, 0, 0, prevDeltas.getValue(0, i));
-  }
-  return result;
+Layer* DenseLayer::clone() const {
+  return new DenseLayer(*this);
 }
 
-void DenseLayer::update(float learningRate) {
-  Matrix<float> weightDeltas = cross(this->deltas, transpose(this->lastInput));
-  this->weights = this->weights - (weightDeltas * learningRate);
-  for (size_t i = 0; i < this->biases.getNumRows(); i++) {
-    float biasDelta = this->deltas.getValue(0, i) * learningRate;
-    this->biases.setValue(0, i, this->biases.getValue(0, i) - biasDelta);
-  }
+void DenseLayer::copyParameters(const Layer& source) {
+  const DenseLayer& other = static_cast<const DenseLayer&>(source);
+  this->weights = other.weights;
+  this->biases = other.biases;
+}
+
+void DenseLayer::copyParametersRelaxed(const Layer& shared) {
+  const DenseLayer& other = static_cast<const DenseLayer&>(shared);
+  relaxedCopy(other.weights.getValues(), this->weights.getValues(),
+              (size_t)this->weights.getNumCols() * this->weights.getNumRows());
+  relaxedCopy(other.biases.getValues(), this->biases.getValues(), this->biases.getNumRows());
+}
+
+void DenseLayer::applyGradientsRelaxed(Layer& shared, float learningRate, int samples) {
+  DenseLayer& other = static_cast<DenseLayer&>(shared);
+  float step = learningRate / samples;
+  relaxedSubtractScaled(other.weights.getValues(), this->weightDeltas.getValues(), step,
+                        (size_t)this->weights.getNumCols() * this->weights.getNumRows());
+  relaxedSubtractScaled(other.biases.getValues(), this->biasDeltas.getValues(), step,
+                        this->biases.getNumRows());
+}
+
+void DenseLayer::collectParameters(std::vector<MatrixView<float>>& out) {
+  out.push_back(this->weights.view());
+  out.push_back(this->biases.view());
+}
+
+void DenseLayer::collectGradients(std::vector<MatrixView<float>>& out) {
+  out.push_back(this->weightDeltas.view());
+  out.push_back(this->biasDeltas.view());
 }
 
 void DenseLayer::initWeights() {
   std::mt19937 rng(std::random_device{}());
-  // He init for ReLU: stddev = sqrt(2 / fan_in)
-  // Xavier init for Sigmoid/None: stddev = sqrt(1 / fan_in)
-  float stddev = (this->activation == RELU) ? std::sqrt(2.0f / this->inputSize)
-                                            : std::sqrt(1.0f / this->inputSize);
+  // He init for the ReLU family: stddev = sqrt(2 / fan_in)
+  // Xavier init for Sigmoid/Tanh/None: stddev = sqrt(1 / fan_in)
+  float stddev = usesHeInit(this->activation) ? std::sqrt(2.0f / this->inputSize)
+                                               : std::sqrt(1.0f / this->inputSize);
   std::normal_distribution<float> dist(0.0f, stddev);
   for (size_t x = 0; x < (size_t)this->weights.getNumCols(); x++) {
     for (size_t y = 0; y < (size_t)this->weights.getNumRows(); y++) {
@@ -95,14 +147,14 @@ void DenseLayer::setWeights(Matrix<float> weights) {
       weights.getNumRows() != (size_t)this->outputSize) {
     throw std::invalid_argument("Weights dimensions don't match layer configuration");
   }
-  this->weights = weights;
+  this->weights = std::move(weights);
 }
 
 void DenseLayer::setBiases(Matrix<float> biases) {
   if (biases.getNumCols() != 1 || biases.getNumRows() != (size_t)this->outputSize) {
     throw std::invalid_argument("Biases dimensions don't match layer configuration");
   }
-  this->biases = biases;
+  this->biases = std::move(biases);
 }
 
 Matrix<float> DenseLayer::getWeights() {
@@ -0,0 +1,228 @@
+#include <DirectConv.hpp>
+#include <SimdOps.hpp>
+#include <algorithm>
+#include <omp.h>
+#include <stdexcept>
+
+namespace {
+
+using V = NativeOps;
+constexpr int B = V::width;
+// Output pixels computed together, their accumulators stay in registers
+constexpr int TILE = B >= 16 ? 12 : 8;
+
+bool worthParallel(double flops) {
+  return flops >= 64.0 * 64.0 * 64.0 && omp_get_max_threads() > 1;
+}
+
+// TILE consecutive output pixels of one output block starting at (ox, oy)
+template <int N>
+void convTile(const float* in, int inChannels, int inW, int inH, int inBlock,
+              const float* filters, const float* bias, int k, int ox, int oy, float* out) {
+  typename V::Vec acc[N];
+  typename V::Vec initial = bias != nullptr ? V::load(bias) : V::set(0.0f);
+  for (int j = 0; j < N; j++) {
+    acc[j] = initial;
+  }
+  size_t blockStride = (size_t)inW * inH * inBlock;
+  for (int c = 0; c < inChannels; c++) {
+    const float* plane = in + (c / inBlock) * blockStride + c % inBlock;
+    const float* w = filters + (size_t)c * k * k * B;
+    for (int ky = 0; ky < k; ky++) {
+      const float* row = plane + ((size_t)(oy + ky) * inW + ox) * inBlock;
+      for (int kx = 0; kx < k; kx++) {
+        typename V::Vec wv = V::load(w + (ky * k + kx) * B);
+        for (int j = 0; j < N; j++) {
+          acc[j] = V::fmadd(V::set(row[(j + kx) * inBlock]), wv, acc[j]);
+        }
+      }
+    }
+  }
+  for (int j = 0; j < N; j++) {
+    V::store(out + (size_t)(ox + j) * B, acc[j]);
+  }
+}
+
+// One (outBlock, c, ky) slice of the filter gradient summed over a batch of samples, one
+// accumulator per kx
+template <int K>
+void gradientRow(const float* plane, int inW, int inBlock, size_t inSample, const float* deltas,
+                 int deltasW, size_t deltasSample, int samples, int pad, int outW, int outH,
+                 int ky, float* dFilters) {
+  typename V::Vec acc[K];
+  for (int kx = 0; kx < K; kx++) {
+    acc[kx] = V::set(0.0f);
+  }
+  for (int s = 0; s < samples; s++) {
+    for (int oy = 0; oy < outH; oy++) {
+      const float* inRow = plane + s * inSample + (size_t)(oy + ky) * inW * inBlock;
+      const float* dRow = deltas + s * deltasSample + ((size_t)(oy + pad) * deltasW + pad) * B;
+      for (int ox = 0; ox < outW; ox++) {
+        typename V::Vec d = V::load(dRow + (size_t)ox * B);
+        for (int kx = 0; kx < K; kx++) {
+          acc[kx] = V::fmadd(V::set(inRow[(ox + kx) * inBlock]), d, acc[kx]);
+        }
+      }
+    }
+  }
+  for (int kx = 0; kx < K; kx++) {
+    V::store(dFilters + (size_t)kx * B, acc[kx]);
+  }
+}
+
+using GradientRowFn = void (*)(const float*, int, int, size_t, const float*, int, size_t, int,
+                               int, int, int, int, float*);
+
+GradientRowFn gradientRowFor(int k) {
+  switch (k) {
+  case 1:
+    return gradientRow<1>;
+  case 2:
+    return gradientRow<2>;
+  case 3:
+    return gradientRow<3>;
+  case 4:
+    return gradientRow<4>;
+  case 5:
+    return gradientRow<5>;
+  case 6:
+    return gradientRow<6>;
+  case 7:
+    return gradientRow<7>;
+  default:
+    throw std::invalid_argument("Filter size not supported by direct convolution");
+  }
+}
+
+} // namespace
+
+int directConvBlock() {
+  return B;
+}
+
+int blockedChannels(int channels) {
+  return (channels + B - 1) / B * B;
+}
+
+void directConv(const float* in, int inChannels, int inW, int inH, int inBlock,
+                const float* filters, const float* bias, int outBlocks, int k, float* out) {
+  if (k > MAX_DIRECT_FILTER) {
+    throw std::invalid_argument("Filter size not supported by direct convolution");
+  }
+  int outW = inW - k + 1;
+  int outH = inH - k + 1;
+  bool parallel = worthParallel(2.0 * outBlocks * B * outW * outH * inChannels * k * k);
+#pragma omp parallel for collapse(2) schedule(static) if (parallel)
+  for (int ob = 0; ob < outBlocks; ob++) {
+    for (int oy = 0; oy < outH; oy++) {
+      const float* w = filters + (size_t)ob * inChannels * k * k * B;
+      const float* b = bias != nullptr ? bias + ob * B : nullptr;
+      float* row = out + ((size_t)ob * outH + oy) * outW * B;
+      int ox = 0;
+      for (; ox + TILE <= outW; ox += TILE) {
+        convTile<TILE>(in, inChannels, inW, inH, inBlock, w, b, k, ox, oy, row);
+      }
+      for (; ox < outW; ox++) {
+        convTile<1>(in, inChannels, inW, inH, inBlock, w, b, k, ox, oy, row);
+      }
+    }
+  }
+}
+
+void directConvFilterGradient(const float* in, int inChannels, int inW, int inH, int inBlock,
+                              const float* deltas, int pad, int outBlocks, int k,
+                              float* dFilters, int samples) {
+  GradientRowFn rowFn = gradientRowFor(k);
+  int outW = inW - k + 1;
+  int outH = inH - k + 1;
+  int deltasW = outW + 2 * pad;
+  int deltasH = outH + 2 * pad;
+  size_t blockStride = (size_t)inW * inH * inBlock;
+  size_t inSample = (size_t)(inChannels + inBlock - 1) / inBlock * blockStride;
+  size_t deltasSample = (size_t)outBlocks * deltasW * deltasH * B;
+  bool parallel =
+      worthParallel(2.0 * samples * outBlocks * B * outW * outH * inChannels * k * k);
+#pragma omp parallel for collapse(3) schedule(static) if (parallel)
+  for (int ob = 0; ob < outBlocks; ob++) {
+    for (int c = 0; c < inChannels; c++) {
+      for (int ky = 0; ky < k; ky++) {
+        const float* plane = in + (c / inBlock) * blockStride + c % inBlock;
+        const float* d = deltas + (size_t)ob * deltasW * deltasH * B;
+        float* dst = dFilters + (((size_t)ob * inChannels + c) * k + ky) * k * B;
+        rowFn(plane, inW, inBlock, inSample, d, deltasW, deltasSample, samples, pad, outW,
+              outH, ky, dst);
+      }
+    }
+  }
+}
+
+void packDirectFilters(const float* flat, int k, int depth, int count, float* forward,
+                       float* backward) {
+  int kk = k * k;
+  int countBlocks = blockedChannels(count) / B;
+  int depthBlocks = blockedChannels(depth) / B;
+  for (int ob = 0; ob < countBlocks; ob++) {
+    for (int c = 0; c < depth; c++) {
+      for (int i = 0; i < kk; i++) {
+        float* dst = forward + (((size_t)ob * depth + c) * kk + i) * B;
+        for (int l = 0; l < B; l++) {
+          int f = ob * B + l;
+          dst[l] = f < count ? flat[(size_t)(c * kk + i) * count + f] : 0.0f;
+        }
+      }
+    }
+  }
+  // The input gradient correlates the deltas with the filters rotated by 180 degrees, with
+  // the roles of filters and channels swapped
+  for (int cb = 0; cb < depthBlocks; cb++) {
+    for (int f = 0; f < count; f++) {
+      for (int i = 0; i < kk; i++) {
+        float* dst = backward + (((size_t)cb * count + f) * kk + i) * B;
+        int flipped = kk - 1 - i;
+        for (int l = 0; l < B; l++) {
+          int c = cb * B + l;
+          dst[l] = c < depth ? flat[(size_t)(c * kk + flipped) * count + f] : 0.0f;
+        }
+      }
+    }
+  }
+}
+
+void unpackDirectFilters(const float* packed, int k, int depth, int count, float* flat) {
+  int kk = k * k;
+  for (int c = 0; c < depth; c++) {
+    for (int i = 0; i < kk; i++) {
+      float* dst = flat + (size_t)(c * kk + i) * count;
+      for (int f = 0; f < count; f++) {
+        dst[f] = packed[(((size_t)(f / B) * depth + c) * kk + i) * B + f % B];
+      }
+    }
+  }
+}
+
+void toBlocked(const float* chw, int channels, int w, int h, int pad, float* blocked) {
+  int paddedW = w + 2 * pad;
+  int paddedH = h + 2 * pad;
+  int blocks = blockedChannels(channels) / B;
+  std::fill(blocked, blocked + (size_t)blocks * paddedW * paddedH * B, 0.0f);
+  for (int c = 0; c < channels; c++) {
+    float* plane = blocked + (size_t)(c / B) * paddedW * paddedH * B + c % B;
+    const float* src = chw + (size_t)c * w * h;
+    for (int y = 0; y < h; y++) {
+      float* dst = plane + ((size_t)(y + pad) * paddedW + pad) * B;
+      for (int x = 0; x < w; x++) {
+        dst[(size_t)x * B] = src[y * w + x];
+      }
+    }
+  }
+}
+
+void fromBlocked(const float* blocked, int channels, int w, int h, float* chw) {
+  for (int c = 0; c < channels; c++) {
+    const float* plane = blocked + (size_t)(c / B) * w * h * B + c % B;
+    float* dst = chw + (size_t)c * w * h;
+    for (int i = 0; i < w * h; i++) {
+      dst[i] = plane[(size_t)i * B];
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include <Fft.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// One Stockham stage of radix P over a sequence of length span = P * m. Element e of the
+// current sub-sequences starts at e * stride, with stride floats of independent data
+// (earlier radices times the batch) after it, so the innermost loop is contiguous.
+// y[(P * j + k) * stride + t] = w^(j k) * DFT_P(x[(j + q * m) * stride + t] over q)[k]
+template <int P>
+void stage(const float* xRe, const float* xIm, float* yRe, float* yIm, int m, size_t stride,
+           const float* twRe, const float* twIm) {
+  // Roots of unity of the P-point DFT, exp(-2 pi i q k / P) at [q * k % P]
+  float rootRe[P], rootIm[P];
+  for (int q = 0; q < P; q++) {
+    double angle = -2.0 * M_PI * q / P;
+    rootRe[q] = (float)std::cos(angle);
+    rootIm[q] = (float)std::sin(angle);
+  }
+  for (int j = 0; j < m; j++) {
+    const float* wRe = twRe + (size_t)j * P;
+    const float* wIm = twIm + (size_t)j * P;
+    const float* inRe[P];
+    const float* inIm[P];
+    float* outRe[P];
+    float* outIm[P];
+    for (int q = 0; q < P; q++) {
+      inRe[q] = xRe + (size_t)(j + q * m) * stride;
+      inIm[q] = xIm + (size_t)(j + q * m) * stride;
+      outRe[q] = yRe + (size_t)(P * j + q) * stride;
+      outIm[q] = yIm + (size_t)(P * j + q) * stride;
+    }
+#pragma omp simd
+    for (size_t t = 0; t < stride; t++) {
+      float aRe[P], aIm[P];
+      for (int q = 0; q < P; q++) {
+        aRe[q] = inRe[q][t];
+        aIm[q] = inIm[q][t];
+      }
+      float dRe[P], dIm[P];
+      if constexpr (P == 2) {
+        dRe[0] = aRe[0] + aRe[1];
+        dIm[0] = aIm[0] + aIm[1];
+        dRe[1] = aRe[0] - aRe[1];
+        dIm[1] = aIm[0] - aIm[1];
+      } else if constexpr (P == 4) {
+        float t0Re = aRe[0] + aRe[2], t0Im = aIm[0] + aIm[2];
+        float t1Re = aRe[0] - aRe[2], t1Im = aIm[0] - aIm[2];
+        float t2Re = aRe[1] + aRe[3], t2Im = aIm[1] + aIm[3];
+        float t3Re = aRe[1] - aRe[3], t3Im = aIm[1] - aIm[3];
+        dRe[0] = t0Re + t2Re;
+        dIm[0] = t0Im + t2Im;
+        dRe[2] = t0Re - t2Re;
+        dIm[2] = t0Im - t2Im;
+        // -i * t3 and +i * t3
+        dRe[1] = t1Re + t3Im;
+        dIm[1] = t1Im - t3Re;
+        dRe[3] = t1Re - t3Im;
+        dIm[3] = t1Im + t3Re;
+      } else {
+        for (int k = 0; k < P; k++) {
+          float sumRe = 0.0f, sumIm = 0.0f;
+          for (int q = 0; q < P; q++) {
+            float cRe = rootRe[q * k % P];
+            float cIm = rootIm[q * k % P];
+            sumRe += aRe[q] * cRe - aIm[q] * cIm;
+            sumIm += aRe[q] * cIm + aIm[q] * cRe;
+          }
+          dRe[k] = sumRe;
+          dIm[k] = sumIm;
+        }
+      }
+      for (int k = 0; k < P; k++) {
+        outRe[k][t] = dRe[k] * wRe[k] - dIm[k] * wIm[k];
+        outIm[k][t] = dRe[k] * wIm[k] + dIm[k] * wRe[k];
+      }
+    }
+  }
+}
+
+// Per thread buffers of the 2D transforms, so steady state calls don't allocate
+thread_local std::vector<float> scratch;
+
+float* scratchFor(size_t size) {
+  if (scratch.size() < size) {
+    scratch.resize(size);
+  }
+  return scratch.data();
+}
+
+} // namespace
+
+int fftSize(int n) {
+  for (int size = std::max(n, 1);; size++) {
+    int rest = size;
+    for (int p : {2, 3, 5}) {
+      while (rest % p == 0) {
+        rest /= p;
+      }
+    }
+    if (rest == 1) {
+      return size;
+    }
+  }
+}
+
+FftPlan::FftPlan() {
+  this->n = 0;
+}
+
+FftPlan::FftPlan(int n) {
+  if (n <= 0 || fftSize(n) != n) {
+    throw std::invalid_argument("FFT size must only have 2, 3 and 5 as prime factors");
+  }
+  this->n = n;
+  int rest = n;
+  for (int p : {4, 2, 3, 5}) {
+    while (rest % p == 0) {
+      this->radices.push_back(p);
+      rest /= p;
+    }
+  }
+  // Stage twiddles w^(j k) for w = exp(-2 pi i / span), span shrinking by each radix
+  int span = n;
+  for (int p : this->radices) {
+    int m = span / p;
+    for (int j = 0; j < m; j++) {
+      for (int k = 0; k < p; k++) {
+        double angle = -2.0 * M_PI * j * k / span;
+        this->twiddlesRe.push_back((float)std::cos(angle));
+        this->twiddlesIm.push_back((float)std::sin(angle));
+      }
+    }
+    span = m;
+  }
+}
+
+int FftPlan::getSize() const {
+  return this->n;
+}
+
+void FftPlan::transform(float* re, float* im, int count, float* work) const {
+  float* xRe = re;
+  float* xIm = im;
+  float* yRe = work;
+  float* yIm = work + (size_t)this->n * count;
+  const float* twRe = this->twiddlesRe.data();
+  const float* twIm = this->twiddlesIm.data();
+  int span = this->n;
+  size_t stride = count;
+  for (int p : this->radices) {
+    int m = span / p;
+    switch (p) {
+    case 2:
+      stage<2>(xRe, xIm, yRe, yIm, m, stride, twRe, twIm);
+      break;
+    case 3:
+      stage<3>(xRe, xIm, yRe, yIm, m, stride, twRe, twIm);
+      break;
+    case 4:
+      stage<4>(xRe, xIm, yRe, yIm, m, stride, twRe, twIm);
+      break;
+    default:
+      stage<5>(xRe, xIm, yRe, yIm, m, stride, twRe, twIm);
+      break;
+    }
+    twRe += (size_t)m * p;
+    twIm += (size_t)m * p;
+    span = m;
+    stride *= p;
+    std::swap(xRe, yRe);
+    std::swap(xIm, yIm);
+  }
+  if (xRe != re) {
+    std::copy(xRe, xRe + (size_t)this->n * count, re);
+    std::copy(xIm, xIm + (size_t)this->n * count, im);
+  }
+}
+
+Fft2d::Fft2d() {
+  this->w = 0;
+  this->h = 0;
+}
+
+Fft2d::Fft2d(int width, int height) : rowPlan(width), columnPlan(height) {
+  this->w = width;
+  this->h = height;
+}
+
+int Fft2d::getWidth() const {
+  return this->w;
+}
+
+int Fft2d::getHeight() const {
+  return this->h;
+}
+
+int Fft2d::getBins() const {
+  return (this->w / 2 + 1) * this->h;
+}
+
+// Two real rows are transformed at once as the real and imaginary parts of one complex row,
+// rows y and y + half, and split apart with the symmetry of real spectra. The columns of
+// the kept half are then transformed in place in the spectrum.
+void Fft2d::forward(const float* src, int srcW, int srcH, float* spectrum) const {
+  size_t size = (size_t)this->w * this->h;
+  float* buffer = scratchFor(4 * size);
+  float* zRe = buffer;
+  float* zIm = buffer + size;
+  float* work = buffer + 2 * size;
+  int half = (srcH + 1) / 2;
+  for (int x = 0; x < srcW; x++) {
+    for (int p = 0; p < half; p++) {
+      zRe[(size_t)x * half + p] = src[(size_t)p * srcW + x];
+      zIm[(size_t)x * half + p] = p + half < srcH ? src[(size_t)(p + half) * srcW + x] : 0.0f;
+    }
+  }
+  std::fill(zRe + (size_t)srcW * half, zRe + (size_t)this->w * half, 0.0f);
+  std::fill(zIm + (size_t)srcW * half, zIm + (size_t)this->w * half, 0.0f);
+  this->rowPlan.transform(zRe, zIm, half, work);
+  int halfW = this->w / 2 + 1;
+  int bins = this->getBins();
+  float* gRe = spectrum;
+  float* gIm = spectrum + bins;
+  for (int kx = 0; kx < halfW; kx++) {
+    const float* re = zRe + (size_t)kx * half;
+    const float* im = zIm + (size_t)kx * half;
+    const float* mirrorRe = zRe + (size_t)((this->w - kx) % this->w) * half;
+    const float* mirrorIm = zIm + (size_t)((this->w - kx) % this->w) * half;
+    for (int p = 0; p < half; p++) {
+      // Row p is (Z[kx] + conj(Z[-kx])) / 2, row p + half is (Z[kx] - conj(Z[-kx])) / 2i
+      gRe[(size_t)p * halfW + kx] = 0.5f * (re[p] + mirrorRe[p]);
+      gIm[(size_t)p * halfW + kx] = 0.5f * (im[p] - mirrorIm[p]);
+      if (p + half < srcH) {
+        gRe[(size_t)(p + half) * halfW + kx] = 0.5f * (im[p] + mirrorIm[p]);
+        gIm[(size_t)(p + half) * halfW + kx] = 0.5f * (mirrorRe[p] - re[p]);
+      }
+    }
+  }
+  std::fill(gRe + (size_t)srcH * halfW, gRe + bins, 0.0f);
+  std::fill(gIm + (size_t)srcH * halfW, gIm + bins, 0.0f);
+  this->columnPlan.transform(gRe, gIm, halfW, work);
+}
+
+// The inverse of forward: columns first, then the rows the caller keeps two at a time, each
+// pair packed as A + iB after rebuilding the missing half from X[kx] = conj(X[w - kx])
+void Fft2d::inverse(const float* spectrum, float* dst, int dstW, int dstH) const {
+  size_t size = (size_t)this->w * this->h;
+  float* buffer = scratchFor(6 * size);
+  float* aRe = buffer;
+  float* aIm = buffer + size;
+  float* tRe = buffer + 2 * size;
+  float* tIm = buffer + 3 * size;
+  float* work = buffer + 4 * size;
+  int halfW = this->w / 2 + 1;
+  int bins = this->getBins();
+  std::copy(spectrum, spectrum + bins, aRe);
+  std::copy(spectrum + bins, spectrum + 2 * bins, aIm);
+  this->columnPlan.transform(aIm, aRe, halfW, work);
+  int half = (dstH + 1) / 2;
+  for (int kx = 0; kx < this->w; kx++) {
+    int source = kx < halfW ? kx : this->w - kx;
+    float sign = kx < halfW ? 1.0f : -1.0f;
+    float* rowRe = tRe + (size_t)kx * half;
+    float* rowIm = tIm + (size_t)kx * half;
+    for (int p = 0; p < half; p++) {
+      float reA = aRe[(size_t)p * halfW + source];
+      float imA = sign * aIm[(size_t)p * halfW + source];
+      float reB = 0.0f, imB = 0.0f;
+      if (p + half < dstH) {
+        reB = aRe[(size_t)(p + half) * halfW + source];
+        imB = sign * aIm[(size_t)(p + half) * halfW + source];
+      }
+      rowRe[p] = reA - imB;
+      rowIm[p] = imA + reB;
+    }
+  }
+  this->rowPlan.transform(tIm, tRe, half, work);
+  float scale = 1.0f / (float)size;
+  for (int p = 0; p < half; p++) {
+    for (int x = 0; x < dstW; x++) {
+      dst[(size_t)p * dstW + x] = tRe[(size_t)x * half + p] * scale;
+      if (p + half < dstH) {
+        dst[(size_t)(p + half) * dstW + x] = tIm[(size_t)x * half + p] * scale;
+      }
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include <FftConv.hpp>
+#include <algorithm>
+#include <omp.h>
+#include <vector>
+
+namespace {
+
+bool worthParallel(size_t work) {
+  return work >= 64 * 64 * 64 && omp_get_max_threads() > 1;
+}
+
+// Per thread accumulators and filter tiles, so steady state calls don't allocate
+thread_local std::vector<float> scratch;
+
+float* scratchFor(size_t size) {
+  if (scratch.size() < size) {
+    scratch.resize(size);
+  }
+  return scratch.data();
+}
+
+// acc += a * b, or a * conj(b) with conjugate set, over bins complex values stored as
+// split planes
+void multiplyAccumulate(const float* a, const float* b, int bins, bool conjugate, float* acc) {
+  const float* aRe = a;
+  const float* aIm = a + bins;
+  const float* bRe = b;
+  const float* bIm = b + bins;
+  float* accRe = acc;
+  float* accIm = acc + bins;
+  float sign = conjugate ? -1.0f : 1.0f;
+#pragma omp simd
+  for (int i = 0; i < bins; i++) {
+    float im = sign * bIm[i];
+    accRe[i] += aRe[i] * bRe[i] - aIm[i] * im;
+    accIm[i] += aRe[i] * im + aIm[i] * bRe[i];
+  }
+}
+
+} // namespace
+
+size_t fftSpectraSize(const Fft2d& fft, int count) {
+  return (size_t)2 * fft.getBins() * count;
+}
+
+void fftTransformPlanes(const Fft2d& fft, const float* planes, int count, int w, int h,
+                        float* spectra) {
+  size_t spectrum = fftSpectraSize(fft, 1);
+  bool parallel = worthParallel((size_t)count * fft.getWidth() * fft.getHeight() * 8);
+#pragma omp parallel for schedule(static) if (parallel)
+  for (int c = 0; c < count; c++) {
+    fft.forward(planes + (size_t)c * w * h, w, h, spectra + c * spectrum);
+  }
+}
+
+void fftTransformFilters(const Fft2d& fft, const float* flat, int k, int depth, int count,
+                         float* spectra) {
+  size_t spectrum = fftSpectraSize(fft, 1);
+  bool parallel = worthParallel((size_t)count * depth * fft.getWidth() * fft.getHeight());
+#pragma omp parallel for collapse(2) schedule(static) if (parallel)
+  for (int f = 0; f < count; f++) {
+    for (int c = 0; c < depth; c++) {
+      float* filter = scratchFor((size_t)k * k);
+      for (int i = 0; i < k * k; i++) {
+        filter[i] = flat[((size_t)c * k * k + i) * count + f];
+      }
+      fft.forward(filter, k, k, spectra + ((size_t)f * depth + c) * spectrum);
+    }
+  }
+}
+
+void fftCorrelate(const Fft2d& fft, const float* inSpectra, int depth,
+                  const float* filterSpectra, int count, const float* bias, int outW,
+                  int outH, float* out) {
+  int bins = fft.getBins();
+  size_t spectrum = fftSpectraSize(fft, 1);
+  bool parallel = worthParallel((size_t)count * depth * bins * 4);
+#pragma omp parallel for schedule(static) if (parallel)
+  for (int f = 0; f < count; f++) {
+    float* acc = scratchFor(spectrum);
+    std::fill(acc, acc + spectrum, 0.0f);
+    for (int c = 0; c < depth; c++) {
+      multiplyAccumulate(inSpectra + c * spectrum,
+                         filterSpectra + ((size_t)f * depth + c) * spectrum, bins, true, acc);
+    }
+    float* plane = out + (size_t)f * outW * outH;
+    fft.inverse(acc, plane, outW, outH);
+    if (bias != nullptr) {
+      for (int i = 0; i < outW * outH; i++) {
+        plane[i] += bias[f];
+      }
+    }
+  }
+}
+
+void fftInputGradient(const Fft2d& fft, const float* deltaSpectra, int count,
+                      const float* filterSpectra, int depth, int inW, int inH, float* out) {
+  int bins = fft.getBins();
+  size_t spectrum = fftSpectraSize(fft, 1);
+  bool parallel = worthParallel((size_t)count * depth * bins * 4);
+#pragma omp parallel for schedule(static) if (parallel)
+  for (int c = 0; c < depth; c++) {
+    float* acc = scratchFor(spectrum);
+    std::fill(acc, acc + spectrum, 0.0f);
+    for (int f = 0; f < count; f++) {
+      multiplyAccumulate(deltaSpectra + f * spectrum,
+                         filterSpectra + ((size_t)f * depth + c) * spectrum, bins, false, acc);
+    }
+    fft.inverse(acc, out + (size_t)c * inW * inH, inW, inH);
+  }
+}
+
+void fftFilterGradient(const Fft2d& fft, const float* inSpectra, int depth,
+                       const float* deltaSpectra, int count, int k, float* flat) {
+  int bins = fft.getBins();
+  size_t spectrum = fftSpectraSize(fft, 1);
+  bool parallel = worthParallel((size_t)count * depth * fft.getWidth() * fft.getHeight());
+#pragma omp parallel for collapse(2) schedule(static) if (parallel)
+  for (int f = 0; f < count; f++) {
+    for (int c = 0; c < depth; c++) {
+      float* acc = scratchFor(spectrum + (size_t)k * k);
+      float* window = acc + spectrum;
+      std::fill(acc, acc + spectrum, 0.0f);
+      multiplyAccumulate(inSpectra + c * spectrum, deltaSpectra + f * spectrum, bins, true,
+                         acc);
+      fft.inverse(acc, window, k, k);
+      for (int i = 0; i < k * k; i++) {
+        flat[((size_t)c * k * k + i) * count + f] = window[i];
+      }
+    }
+  }
+}
\ No newline at end of file
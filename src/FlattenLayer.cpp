@@ -6,35 +6,21 @@ FlattenLayer::FlattenLayer(int inputWidth, int inputHeight, int inputDepth) {
   this->inputDepth = inputDepth;
 }
 
-Tensor3<float> FlattenLayer::forward(Tensor3<float> input) {
-  Tensor3<float> output =
-      Tensor3<float>(input.getWidth() * input.getHeight() * input.getChannels(), 1, 1);
-  for (size_t c = 0; c < input.getChannels(); c++) {
-    int channelBase = c * input.getWidth() * input.getHeight();
-    for (size_t y = 0; y < input.getHeight(); y++) {
-      int rowBase = channelBase + (y * input.getWidth());
-      for (size_t x = 0; x < input.getWidth(); x++) {
-        float val = input.getValue(x, y, c);
-        output.setValue(rowBase + x, 0, 0, val);
-      }
-    }
-  }
-  return output;
+TensorView<const float> FlattenLayer::forward(TensorView<const float> input) {
+  // Tensors are stored channel-major, so flattening only changes the shape
+  return input.reshape(input.getWidth() * input.getHeight() * input.getChannels(), 1, 1);
 }
 
-Tensor3<float> FlattenLayer::backwards(Tensor3<float> prevLayerDeltas) {
-  Tensor3<float> output = Tensor3<float>(this->inputWidth, this->inputHeight, this->inputDepth);
-  for (size_t c = 0; c < output.getChannels(); c++) {
-    int channelBase = c * output.getWidth() * output.getHeight();
-    for (size_t y = 0; y < output.getHeight(); y++) {
-      int rowBase = channelBase + (y * output.getWidth());
-      for (size_t x = 0; x < output.getWidth(); x++) {
-        float val = prevLayerDeltas.getValue(rowBase + x, 0, 0);
-        output.setValue(x, y, c, val);
-      }
-    }
-  }
-  return output;
+TensorView<const float> FlattenLayer::backwards(TensorView<const float> prevLayerDeltas) {
+  return prevLayerDeltas.reshape(this->inputWidth, this->inputHeight, this->inputDepth);
+}
+
+Tensor4View<const float> FlattenLayer::forwardBatch(Tensor4View<const float> input) {
+  return input.reshape(input.getSampleSize(), 1, 1);
+}
+
+Tensor4View<const float> FlattenLayer::backwardsBatch(Tensor4View<const float> prevLayerDeltas) {
+  return prevLayerDeltas.reshape(this->inputWidth, this->inputHeight, this->inputDepth);
 }
 
 int FlattenLayer::getInputWidth() {
@@ -45,4 +31,8 @@ int FlattenLayer::getInputHeight() {
 }
 int FlattenLayer::getInputDepth() {
   return this->inputDepth;
+}
+
+Layer* FlattenLayer::clone() const {
+  return new FlattenLayer(*this);
 }
\ No newline at end of file
@@ -1,34 +1,50 @@
 #include <GAP.hpp>
+#include <algorithm>
 
 GAP::GAP(int inputWidth, int inputHeight, ActivationFunction activation) : Layer(activation) {
   this->inputWidth = inputWidth;
   this->inputHeight = inputHeight;
 }
 
-Tensor3<float> GAP::forward(Tensor3<float> input) {
-  Tensor3<float> output = Tensor3<float>(1, 1, input.getChannels());
-  for (size_t c = 0; c < input.getChannels(); c++) {
+TensorView<const float> GAP::forward(TensorView<const float> input) {
+  return this->forwardBatch(Tensor4View<const float>(input)).sample(0);
+}
+
+TensorView<const float> GAP::backwards(TensorView<const float> prevLayerDeltas) {
+  return this->backwardsBatch(Tensor4View<const float>(prevLayerDeltas)).sample(0);
+}
+
+Tensor4View<const float> GAP::forwardBatch(Tensor4View<const float> input) {
+  int n = input.getBatchSize();
+  int channels = input.getChannels();
+  int area = input.getWidth() * input.getHeight();
+  this->output.resize(n, 1, 1, channels);
+  const float* in = input.getValues();
+  float* out = this->output.getValues();
+  for (int plane = 0; plane < n * channels; plane++) {
     float sum = 0;
-    for (size_t y = 0; y < input.getHeight(); y++) {
-      for (size_t x = 0; x < input.getWidth(); x++) {
-        sum += input.getValue(x, y, c);
-      }
+    for (int i = 0; i < area; i++) {
+      sum += in[(size_t)plane * area + i];
     }
-    output.setValue(0, 0, c, sum / (input.getWidth() * input.getHeight()));
+    out[plane] = sum / area;
   }
-  return output;
+  return this->output.view();
 }
 
-Tensor3<float> GAP::backwards(Tensor3<float> prevLayerDeltas) {
-  Tensor3<float> output =
-      Tensor3<float>(this->inputWidth, this->inputHeight, prevLayerDeltas.getChannels());
-  for (size_t c = 0; c < prevLayerDeltas.getChannels(); c++) {
-    float delta = prevLayerDeltas.getValue(0, 0, c) / (output.getWidth() * output.getHeight());
-    for (size_t y = 0; y < output.getHeight(); y++) {
-      for (size_t x = 0; x < output.getWidth(); x++) {
-        output.setValue(x, y, c, delta);
-      }
-    }
+Tensor4View<const float> GAP::backwardsBatch(Tensor4View<const float> prevLayerDeltas) {
+  int n = prevLayerDeltas.getBatchSize();
+  int channels = prevLayerDeltas.getChannels();
+  int area = this->inputWidth * this->inputHeight;
+  this->inputDeltas.resize(n, this->inputWidth, this->inputHeight, channels);
+  const float* deltas = prevLayerDeltas.getValues();
+  float* out = this->inputDeltas.getValues();
+  for (int plane = 0; plane < n * channels; plane++) {
+    float delta = deltas[plane] / area;
+    std::fill(out + (size_t)plane * area, out + (size_t)(plane + 1) * area, delta);
   }
-  return output;
+  return this->inputDeltas.view();
+}
+
+Layer* GAP::clone() const {
+  return new GAP(*this);
 }
\ No newline at end of file
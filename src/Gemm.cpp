@@ -0,0 +1,399 @@
+#include <Gemm.hpp>
+#include <Storage.hpp>
+#include <VectorMath.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_X86 1
+#endif
+
+// Blocked GEMM in the style of GotoBLAS/BLIS: B is packed into KC x NC panels that
+// stay in L2/L3, A into MC x KC panels that stay in L2, and a register tiled
+// micro-kernel computes MR x NR tiles of C streaming both packed panels from L1.
+
+namespace {
+
+constexpr int MAX_MR = 14;
+constexpr int MAX_NR = 32;
+
+typedef void (*MicroKernel)(int kc, const float* a, const float* b, float* c, int ldc,
+                            bool accumulate);
+
+struct GemmKernel {
+  const char* name;
+  int mr, nr;
+  int mc, kc, nc;
+  MicroKernel micro;
+};
+
+// Portable fallback, written so the compiler can vectorize the inner loop on its own
+void microScalar(int kc, const float* a, const float* b, float* c, int ldc, bool accumulate) {
+  constexpr int MR = 4, NR = 8;
+  float acc[MR][NR] = {};
+  for (int p = 0; p < kc; p++) {
+    for (int i = 0; i < MR; i++) {
+      float ai = a[i];
+      for (int j = 0; j < NR; j++) {
+        acc[i][j] += ai * b[j];
+      }
+    }
+    a += MR;
+    b += NR;
+  }
+  for (int i = 0; i < MR; i++) {
+    for (int j = 0; j < NR; j++) {
+      c[i * ldc + j] = accumulate ? c[i * ldc + j] + acc[i][j] : acc[i][j];
+    }
+  }
+}
+
+#ifdef GEMM_X86
+// 6 x 16 tile: 12 ymm accumulators, 2 for the B row and 1 for the A broadcast
+__attribute__((target("avx2,fma"))) void microAvx2(int kc, const float* a, const float* b,
+                                                   float* c, int ldc, bool accumulate) {
+  constexpr int MR = 6;
+  __m256 acc[MR][2];
+#pragma GCC unroll 6
+  for (int i = 0; i < MR; i++) {
+    acc[i][0] = _mm256_setzero_ps();
+    acc[i][1] = _mm256_setzero_ps();
+  }
+  for (int p = 0; p < kc; p++) {
+    __m256 b0 = _mm256_load_ps(b);
+    __m256 b1 = _mm256_load_ps(b + 8);
+#pragma GCC unroll 6
+    for (int i = 0; i < MR; i++) {
+      __m256 ai = _mm256_broadcast_ss(a + i);
+      acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+    }
+    a += MR;
+    b += 16;
+  }
+#pragma GCC unroll 6
+  for (int i = 0; i < MR; i++) {
+    float* row = c + i * ldc;
+    if (accumulate) {
+      acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(row));
+      acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(row + 8));
+    }
+    _mm256_storeu_ps(row, acc[i][0]);
+    _mm256_storeu_ps(row + 8, acc[i][1]);
+  }
+}
+
+// 14 x 32 tile: 28 zmm accumulators, 2 for the B row and 1 for the A broadcast
+__attribute__((target("avx512f"))) void microAvx512(int kc, const float* a, const float* b,
+                                                    float* c, int ldc, bool accumulate) {
+  constexpr int MR = 14;
+  __m512 acc[MR][2];
+#pragma GCC unroll 14
+  for (int i = 0; i < MR; i++) {
+    acc[i][0] = _mm512_setzero_ps();
+    acc[i][1] = _mm512_setzero_ps();
+  }
+  for (int p = 0; p < kc; p++) {
+    __m512 b0 = _mm512_load_ps(b);
+    __m512 b1 = _mm512_load_ps(b + 16);
+#pragma GCC unroll 14
+    for (int i = 0; i < MR; i++) {
+      __m512 ai = _mm512_set1_ps(a[i]);
+      acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+    }
+    a += MR;
+    b += 32;
+  }
+#pragma GCC unroll 14
+  for (int i = 0; i < MR; i++) {
+    float* row = c + i * ldc;
+    if (accumulate) {
+      acc[i][0] = _mm512_add_ps(acc[i][0], _mm512_loadu_ps(row));
+      acc[i][1] = _mm512_add_ps(acc[i][1], _mm512_loadu_ps(row + 16));
+    }
+    _mm512_storeu_ps(row, acc[i][0]);
+    _mm512_storeu_ps(row + 16, acc[i][1]);
+  }
+}
+#endif
+
+const GemmKernel SCALAR_KERNEL = {"scalar", 4, 8, 128, 256, 2048, microScalar};
+#ifdef GEMM_X86
+const GemmKernel AVX2_KERNEL = {"avx2", 6, 16, 120, 256, 4080, microAvx2};
+const GemmKernel AVX512_KERNEL = {"avx512", 14, 32, 112, 256, 4096, microAvx512};
+#endif
+
+const GemmKernel& selectKernel() {
+  const char* forced = std::getenv("CNN_GEMM_KERNEL");
+  std::string_view name = forced ? forced : "";
+  if (name == "scalar") {
+    return SCALAR_KERNEL;
+  }
+#ifdef GEMM_X86
+  __builtin_cpu_init();
+  bool hasAvx512 = __builtin_cpu_supports("avx512f");
+  bool hasAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  if (hasAvx512 && (name.empty() || name == "avx512")) {
+    return AVX512_KERNEL;
+  }
+  if (hasAvx2 && (name.empty() || name == "avx2" || name == "avx512")) {
+    return AVX2_KERNEL;
+  }
+#endif
+  return SCALAR_KERNEL;
+}
+
+const GemmKernel& kernel() {
+  static const GemmKernel& selected = selectKernel();
+  return selected;
+}
+
+// Packing buffers are reused across calls so a steady state GEMM does not allocate
+struct PackBuffer {
+  float* data = nullptr;
+  size_t capacity = 0;
+
+  float* reserve(size_t size) {
+    if (size > this->capacity) {
+      AlignedStorage::deallocate(this->data, this->capacity);
+      this->data = AlignedStorage::allocate<float>(size);
+      this->capacity = size;
+    }
+    return this->data;
+  }
+  ~PackBuffer() {
+    AlignedStorage::deallocate(this->data, this->capacity);
+  }
+};
+
+thread_local PackBuffer packedABuffer;
+thread_local PackBuffer packedBBuffer;
+
+// Copies the mc x kc block of op(A) into mr tall column-major panels, zero padding the last one
+void packA(const GemmKernel& kern, bool trans, int mc, int kc, const float* a, int lda,
+           float* packed) {
+  int panels = (mc + kern.mr - 1) / kern.mr;
+#pragma omp for schedule(static)
+  for (int panel = 0; panel < panels; panel++) {
+    int i0 = panel * kern.mr;
+    int rows = std::min(kern.mr, mc - i0);
+    float* dst = packed + (size_t)panel * kern.mr * kc;
+    for (int p = 0; p < kc; p++) {
+      int i = 0;
+      if (trans) {
+        const float* src = a + (size_t)p * lda + i0;
+        for (; i < rows; i++) {
+          dst[i] = src[i];
+        }
+      } else {
+        for (; i < rows; i++) {
+          dst[i] = a[(size_t)(i0 + i) * lda + p];
+        }
+      }
+      for (; i < kern.mr; i++) {
+        dst[i] = 0.0f;
+      }
+      dst += kern.mr;
+    }
+  }
+}
+
+// Copies the kc x nc block of op(B) into nr wide row-major panels, zero padding the last one
+void packB(const GemmKernel& kern, bool trans, int kc, int nc, const float* b, int ldb,
+           float* packed) {
+  int panels = (nc + kern.nr - 1) / kern.nr;
+#pragma omp for schedule(static)
+  for (int panel = 0; panel < panels; panel++) {
+    int j0 = panel * kern.nr;
+    int cols = std::min(kern.nr, nc - j0);
+    float* dst = packed + (size_t)panel * kern.nr * kc;
+    for (int p = 0; p < kc; p++) {
+      int j = 0;
+      if (trans) {
+        for (; j < cols; j++) {
+          dst[j] = b[(size_t)(j0 + j) * ldb + p];
+        }
+      } else {
+        const float* src = b + (size_t)p * ldb + j0;
+        for (; j < cols; j++) {
+          dst[j] = src[j];
+        }
+      }
+      for (; j < kern.nr; j++) {
+        dst[j] = 0.0f;
+      }
+      dst += kern.nr;
+    }
+  }
+}
+
+// Applies the epilogue in place to a rows x cols block of C starting at (row0, col0)
+void finishTile(const GemmEpilogue& ep, int rows, int cols, int row0, int col0, float* c,
+                int ldc) {
+  for (int i = 0; i < rows; i++) {
+    float* row = c + (size_t)i * ldc;
+    if (ep.biasMode == ROW_BIAS) {
+      float bias = ep.bias[row0 + i];
+      for (int j = 0; j < cols; j++) {
+        row[j] += bias;
+      }
+    } else if (ep.biasMode == COLUMN_BIAS) {
+      const float* bias = ep.bias + col0;
+      for (int j = 0; j < cols; j++) {
+        row[j] += bias[j];
+      }
+    }
+    if (ep.preActivations != nullptr) {
+      std::memcpy(ep.preActivations + (size_t)(row0 + i) * ep.ldp + col0, row,
+                  sizeof(float) * cols);
+    }
+    if (ep.activation != NONE) {
+      applyActivation(ep.activation, row, row, cols);
+    }
+  }
+}
+
+// row0 and col0 locate the mc x nc block inside the full C, which the epilogue needs to
+// index biases and the pre-activation store. The epilogue is only passed in on the last
+// k block.
+void macroKernel(const GemmKernel& kern, int mc, int nc, int kc, const float* packedA,
+                 const float* packedB, float* c, int ldc, bool accumulate, int row0, int col0,
+                 const GemmEpilogue* epilogue) {
+  int rowTiles = (mc + kern.mr - 1) / kern.mr;
+  int colTiles = (nc + kern.nr - 1) / kern.nr;
+#pragma omp for collapse(2) schedule(static)
+  for (int jt = 0; jt < colTiles; jt++) {
+    for (int it = 0; it < rowTiles; it++) {
+      int i0 = it * kern.mr;
+      int j0 = jt * kern.nr;
+      int rows = std::min(kern.mr, mc - i0);
+      int cols = std::min(kern.nr, nc - j0);
+      const float* a = packedA + (size_t)it * kern.mr * kc;
+      const float* b = packedB + (size_t)jt * kern.nr * kc;
+      float* dst = c + (size_t)i0 * ldc + j0;
+      if (rows == kern.mr && cols == kern.nr) {
+        kern.micro(kc, a, b, dst, ldc, accumulate);
+      } else {
+        // Edge tiles are computed in full into a scratch tile and only the valid part is kept
+        alignas(64) float tile[MAX_MR * MAX_NR];
+        kern.micro(kc, a, b, tile, kern.nr, false);
+        for (int i = 0; i < rows; i++) {
+          for (int j = 0; j < cols; j++) {
+            float v = tile[i * kern.nr + j];
+            dst[(size_t)i * ldc + j] = accumulate ? dst[(size_t)i * ldc + j] + v : v;
+          }
+        }
+      }
+      if (epilogue != nullptr) {
+        finishTile(*epilogue, rows, cols, row0 + i0, col0 + j0, dst, ldc);
+      }
+    }
+  }
+}
+
+} // namespace
+
+void sgemm(bool transA, bool transB, int m, int n, int k, const float* a, int lda,
+           const float* b, int ldb, float* c, int ldc, bool accumulate,
+           const GemmEpilogue* epilogue) {
+  if (m <= 0 || n <= 0) {
+    return;
+  }
+  if (k <= 0) {
+    if (!accumulate) {
+      for (int i = 0; i < m; i++) {
+        std::memset(c + (size_t)i * ldc, 0, sizeof(float) * n);
+      }
+    }
+    if (epilogue != nullptr) {
+      finishTile(*epilogue, m, n, 0, 0, c, ldc);
+    }
+    return;
+  }
+  if (m == 1 && n > 1) {
+    // A row vector times a matrix is the matrix-vector product C^T = op(B)^T * op(A)^T
+    GemmEpilogue transposed;
+    const GemmEpilogue* transposedEpilogue = nullptr;
+    if (epilogue != nullptr) {
+      transposed = *epilogue;
+      transposed.biasMode = epilogue->biasMode == ROW_BIAS      ? COLUMN_BIAS
+                            : epilogue->biasMode == COLUMN_BIAS ? ROW_BIAS
+                                                                : NO_BIAS;
+      transposed.ldp = 1;
+      transposedEpilogue = &transposed;
+    }
+    sgemm(!transB, !transA, n, 1, k, b, ldb, a, lda, c, 1, accumulate, transposedEpilogue);
+    return;
+  }
+  if (n == 1) {
+    // Matrix-vector products gain nothing from packing
+    size_t strideB = transB ? 1 : ldb;
+    if (transA) {
+      if (!accumulate) {
+        for (int i = 0; i < m; i++) {
+          c[(size_t)i * ldc] = 0.0f;
+        }
+      }
+      for (int p = 0; p < k; p++) {
+        const float* row = a + (size_t)p * lda;
+        float bp = b[p * strideB];
+#pragma omp simd
+        for (int i = 0; i < m; i++) {
+          c[(size_t)i * ldc] += row[i] * bp;
+        }
+      }
+    } else {
+      for (int i = 0; i < m; i++) {
+        const float* row = a + (size_t)i * lda;
+        float sum = 0.0f;
+#pragma omp simd reduction(+ : sum)
+        for (int p = 0; p < k; p++) {
+          sum += row[p] * b[p * strideB];
+        }
+        c[(size_t)i * ldc] = accumulate ? c[(size_t)i * ldc] + sum : sum;
+      }
+    }
+    if (epilogue != nullptr) {
+      finishTile(*epilogue, m, 1, 0, 0, c, ldc);
+    }
+    return;
+  }
+  const GemmKernel& kern = kernel();
+  int kcMax = std::min(k, kern.kc);
+  int ncMax = std::min(n, kern.nc);
+  int mcMax = std::min(m, kern.mc);
+  size_t packedBSize = (size_t)kcMax * ((ncMax + kern.nr - 1) / kern.nr) * kern.nr;
+  size_t packedASize = (size_t)kcMax * ((mcMax + kern.mr - 1) / kern.mr) * kern.mr;
+  float* packedB = packedBBuffer.reserve(packedBSize);
+  float* packedA = packedABuffer.reserve(packedASize);
+  // Small products (single dense GEMVs, tiny conv layers) are not worth waking the team up
+  bool parallel = (double)m * n * k >= 64.0 * 64.0 * 64.0 && omp_get_max_threads() > 1;
+
+#pragma omp parallel if (parallel)
+  for (int jc = 0; jc < n; jc += kern.nc) {
+    int nc = std::min(kern.nc, n - jc);
+    for (int pc = 0; pc < k; pc += kern.kc) {
+      int kc = std::min(kern.kc, k - pc);
+      bool acc = accumulate || pc > 0;
+      const GemmEpilogue* ep = pc + kc == k ? epilogue : nullptr;
+      const float* blockB = transB ? b + (size_t)jc * ldb + pc : b + (size_t)pc * ldb + jc;
+      packB(kern, transB, kc, nc, blockB, ldb, packedB);
+      for (int ic = 0; ic < m; ic += kern.mc) {
+        int mc = std::min(kern.mc, m - ic);
+        const float* blockA = transA ? a + (size_t)pc * lda + ic : a + (size_t)ic * lda + pc;
+        packA(kern, transA, mc, kc, blockA, lda, packedA);
+        macroKernel(kern, mc, nc, kc, packedA, packedB, c + (size_t)ic * ldc + jc, ldc, acc, ic,
+                    jc, ep);
+      }
+    }
+  }
+}
+
+const char* sgemmKernelName() {
+  return kernel().name;
+}
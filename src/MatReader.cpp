@@ -0,0 +1,139 @@
+#include <MatReader.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// Samples looked at to tell [0, 1] double pixels from [0, 255] ones
+constexpr int SCALE_SAMPLES = 1024;
+
+size_t elementSize(matio_classes type) {
+  switch (type) {
+  case MAT_C_DOUBLE:
+    return sizeof(double);
+  case MAT_C_SINGLE:
+    return sizeof(float);
+  case MAT_C_UINT8:
+    return sizeof(uint8_t);
+  default:
+    return 0;
+  }
+}
+
+} // namespace
+
+MatReader::MatReader(const std::string& path) {
+  this->file = Mat_Open(path.c_str(), MAT_ACC_RDONLY);
+  if (!this->file) {
+    throw std::runtime_error("Couldn't open " + path);
+  }
+  // Only the headers, the values are read a slab at a time
+  this->data = Mat_VarReadInfo(this->file, "data");
+  this->labels = Mat_VarReadInfo(this->file, "label");
+  if (!this->data || !this->labels) {
+    this->close();
+    throw std::runtime_error(path + ": needs the variables 'data' and 'label'");
+  }
+  if (this->data->rank != 2 || this->labels->rank != 2 ||
+      (this->data->class_type != MAT_C_DOUBLE && this->data->class_type != MAT_C_UINT8) ||
+      elementSize(this->labels->class_type) == 0) {
+    this->close();
+    throw std::runtime_error(path + ": unsupported data or label type");
+  }
+  size_t rows = this->data->dims[0];
+  size_t cols = this->data->dims[1];
+  if (rows < 1 || rows > INT_MAX || cols > INT_MAX ||
+      this->labels->dims[0] * this->labels->dims[1] != cols ||
+      (this->labels->dims[0] != 1 && this->labels->dims[1] != 1)) {
+    this->close();
+    throw std::runtime_error(path + ": expected one label per column of data");
+  }
+  this->imageSize = (int)rows;
+  this->count = (int)cols;
+
+  if (this->data->class_type == MAT_C_DOUBLE) {
+    // Some MNIST .mat files store pixels as double in [0,255], others in [0,1]
+    int n = std::min(this->count, SCALE_SAMPLES);
+    this->readSlab(this->data, 0, n, true);
+    const double* values = reinterpret_cast<const double*>(this->raw.data());
+    double maxPixel = 0.0;
+    for (size_t i = 0; i < (size_t)n * this->imageSize; i++) {
+      maxPixel = std::max(maxPixel, values[i]);
+    }
+    this->pixelScale = maxPixel > 1.0 ? 1.0 : 255.0;
+  }
+}
+
+void MatReader::readSlab(matvar_t* variable, int first, int n, bool images) {
+  this->raw.resize((size_t)n * (images ? this->imageSize : 1) *
+                   elementSize(variable->class_type));
+  // Labels may be stored as a row or as a column
+  bool row = images || variable->dims[0] == 1;
+  int start[2] = {row ? 0 : first, row ? first : 0};
+  int stride[2] = {1, 1};
+  int edge[2] = {row ? (images ? this->imageSize : 1) : n, row ? n : 1};
+  if (n > 0 && Mat_VarReadData(this->file, variable, this->raw.data(), start, stride, edge)) {
+    throw std::runtime_error(std::string("Failed to read variable ") + variable->name);
+  }
+}
+
+void MatReader::read(int first, int n, Dataset& out, int at) {
+  if (first < 0 || n < 0 || first + n > this->count || at < 0 || at + n > out.getSize() ||
+      out.getImageSize() != this->imageSize) {
+    throw std::invalid_argument("Read outside the file or the dataset");
+  }
+  this->readSlab(this->data, first, n, true);
+  size_t values = (size_t)n * this->imageSize;
+  uint8_t* pixels = out.getImage(at);
+  if (this->data->class_type == MAT_C_UINT8) {
+    std::copy(this->raw.begin(), this->raw.begin() + values, pixels);
+  } else {
+    const double* source = reinterpret_cast<const double*>(this->raw.data());
+    for (size_t i = 0; i < values; i++) {
+      double value = std::round(source[i] * this->pixelScale);
+      pixels[i] = static_cast<uint8_t>(std::clamp(value, 0.0, 255.0));
+    }
+  }
+
+  this->readSlab(this->labels, first, n, false);
+  for (int i = 0; i < n; i++) {
+    int label;
+    if (this->labels->class_type == MAT_C_DOUBLE) {
+      label = static_cast<int>(reinterpret_cast<const double*>(this->raw.data())[i]);
+    } else if (this->labels->class_type == MAT_C_SINGLE) {
+      label = static_cast<int>(reinterpret_cast<const float*>(this->raw.data())[i]);
+    } else {
+      label = this->raw[i];
+    }
+    out.setLabel(at + i, label);
+  }
+}
+
+int MatReader::getSize() const {
+  return this->count;
+}
+
+int MatReader::getImageSize() const {
+  return this->imageSize;
+}
+
+void MatReader::close() {
+  if (this->data) {
+    Mat_VarFree(this->data);
+    this->data = nullptr;
+  }
+  if (this->labels) {
+    Mat_VarFree(this->labels);
+    this->labels = nullptr;
+  }
+  if (this->file) {
+    Mat_Close(this->file);
+    this->file = nullptr;
+  }
+}
+
+MatReader::~MatReader() {
+  this->close();
+}
\ No newline at end of file
@@ -1,31 +1,33 @@
 #include <Matrix.hpp>
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <vector>
 
-template <typename T>
-Matrix<T>::Matrix() {
+template <typename T, typename Storage>
+Matrix<T, Storage>::Matrix() {
   this->numRows = 0;
   this->numCols = 0;
   this->values = nullptr;
 }
 
-template <typename T>
-Matrix<T>::Matrix(int c, int r) {
+template <typename T, typename Storage>
+Matrix<T, Storage>::Matrix(int c, int r) {
   this->numRows = r;
   this->numCols = c;
-  this->values = new T[r * c]();
+  this->values = Storage::template allocate<T>(r * c);
+  std::fill(this->values, this->values + r * c, T(0));
 }
 
-template <typename T>
-Matrix<T>::Matrix(std::vector<T> vals, int cols) {
+template <typename T, typename Storage>
+Matrix<T, Storage>::Matrix(std::vector<T> vals, int cols) {
   if (vals.size() % cols != 0) {
     throw std::invalid_argument(
         "Cant make a matrix with the specified vector size and column size");
   }
   this->numCols = cols;
   this->numRows = vals.size() / cols;
-  this->values = new T[this->numCols * this->numRows];
+  this->values = Storage::template allocate<T>(this->numCols * this->numRows);
   for (size_t y = 0; y < this->numRows; y++) {
     for (size_t x = 0; x < this->numCols; x++) {
       this->values[(this->numCols * y) + x] = vals[(this->numCols * y) + x];
@@ -33,64 +35,102 @@ Matrix<T>::Matrix(std::vector<T> vals, int cols) {
   }
 };
 
-template <typename T>
-Matrix<T>::Matrix(const Matrix<T>& other) {
+template <typename T, typename Storage>
+Matrix<T, Storage>::Matrix(const Matrix<T, Storage>& other) {
   this->numRows = other.numRows;
   this->numCols = other.numCols;
-  this->values = new T[this->numRows * this->numCols];
+  this->values = Storage::template allocate<T>(this->numRows * this->numCols);
   for (size_t i = 0; i < this->numRows * this->numCols; i++) {
     this->values[i] = other.values[i];
   }
 }
 
-template <typename T>
-Matrix<T>::Matrix(Matrix<T>&& other) noexcept {
+template <typename T, typename Storage>
+Matrix<T, Storage>::Matrix(Matrix<T, Storage>&& other) noexcept {
   this->numRows = other.numRows;
   this->numCols = other.numCols;
   this->values = other.values;
+  this->borrowed = other.borrowed;
   other.values = nullptr;
+  other.borrowed = false;
   other.numRows = 0;
   other.numCols = 0;
 }
 
-template <typename T>
-int Matrix<T>::getNumCols() {
+template <typename T, typename Storage>
+Matrix<T, Storage> Matrix<T, Storage>::borrow(T* values, int cols, int rows) {
+  Matrix<T, Storage> matrix;
+  matrix.values = values;
+  matrix.numCols = cols;
+  matrix.numRows = rows;
+  matrix.borrowed = true;
+  return matrix;
+}
+
+template <typename T, typename Storage>
+int Matrix<T, Storage>::getNumCols() const {
   return this->numCols;
 }
 
-template <typename T>
-int Matrix<T>::getNumRows() {
+template <typename T, typename Storage>
+int Matrix<T, Storage>::getNumRows() const {
   return this->numRows;
 }
 
-template <typename T>
-T* Matrix<T>::getValues() {
+template <typename T, typename Storage>
+T* Matrix<T, Storage>::getValues() {
+  return this->values;
+}
+
+template <typename T, typename Storage>
+const T* Matrix<T, Storage>::getValues() const {
   return this->values;
 }
 
-template <typename T>
-T Matrix<T>::getValue(int x, int y) {
+template <typename T, typename Storage>
+MatrixView<T> Matrix<T, Storage>::view() {
+  return MatrixView<T>(this->values, this->numCols, this->numRows);
+}
+
+template <typename T, typename Storage>
+MatrixView<const T> Matrix<T, Storage>::view() const {
+  return MatrixView<const T>(this->values, this->numCols, this->numRows);
+}
+
+template <typename T, typename Storage>
+T Matrix<T, Storage>::getValue(int x, int y) const {
   if (x >= this->numCols || y >= this->numRows) {
     throw std::invalid_argument("Coordinates out of bounds");
   }
   return this->values[(y * this->numCols) + x];
 }
 
-template <typename T>
-void Matrix<T>::setValue(int x, int y, T value) {
+template <typename T, typename Storage>
+void Matrix<T, Storage>::setValue(int x, int y, T value) {
   if (x >= this->numCols || y >= this->numRows) {
     throw std::invalid_argument("Coordinates out of bounds");
   }
   this->values[(y * this->numCols) + x] = value;
 }
 
-template <typename T>
-Matrix<T>& Matrix<T>::operator=(const Matrix<T>& m) {
+template <typename T, typename Storage>
+void Matrix<T, Storage>::resize(int c, int r) {
+  if (c * r != this->numCols * this->numRows) {
+    if (!this->borrowed) {
+      Storage::deallocate(this->values, this->numCols * this->numRows);
+    }
+    this->values = Storage::template allocate<T>(c * r);
+    this->borrowed = false;
+    std::fill(this->values, this->values + c * r, T(0));
+  }
+  this->numCols = c;
+  this->numRows = r;
+}
+
+template <typename T, typename Storage>
+Matrix<T, Storage>& Matrix<T, Storage>::operator=(const Matrix<T, Storage>& m) {
   if (this != &m) {
-    delete[] this->values;
-    this->numRows = m.numRows;
-    this->numCols = m.numCols;
-    this->values = new T[this->numRows * this->numCols];
+    this->resize(m.numCols, m.numRows);
     for (size_t i = 0; i < this->numRows * this->numCols; i++) {
       this->values[i] = m.values[i];
     }
@@ -98,68 +138,33 @@ Matrix<T>& Matrix<T>::operator=(const Matrix<T>& m) {
   return *this;
 }
 
-template <typename T>
-Matrix<T> Matrix<T>::operator+(const Matrix<T>& m) {
-  if (this->numCols != m.numCols || this->numRows != m.numRows) {
-    throw std::invalid_argument("Matrices dimensions don't match");
-  }
-  int n = this->numRows * this->numCols;
-  Matrix<T> result = Matrix<T>(this->numCols, this->numRows);
-  for (int i = 0; i < n; i++) {
-    result.values[i] = this->values[i] + m.values[i];
-  }
-  return result;
-}
-
-template <typename T>
-Matrix<T> Matrix<T>::operator-(const Matrix<T>& m) {
-  if (this->numCols != m.numCols || this->numRows != m.numRows) {
-    throw std::invalid_argument("Matrices dimensions don't match");
-  }
-  int n = this->numRows * this->numCols;
-  Matrix<T> result = Matrix<T>(this->numCols, this->numRows);
-  for (int i = 0; i < n; i++) {
-    result.values[i] = this->values[i] - m.values[i];
-  }
-  return result;
-}
-
-template <typename T>
-template <typename U>
-Matrix<T> Matrix<T>::operator*(const U& num) {
-  int n = this->numRows * this->numCols;
-  T factor = static_cast<T>(num);
-  Matrix<T> result = Matrix<T>(this->numCols, this->numRows);
-  for (int i = 0; i < n; i++) {
-    result.values[i] = this->values[i] * factor;
-  }
-  return result;
-}
-
-template <typename T>
-template <typename U>
-Matrix<T> Matrix<T>::operator/(const U& num) {
-  if (static_cast<T>(num) == static_cast<T>(0)) {
-    throw std::invalid_argument("Potential division by 0");
-  }
-  int n = this->numRows * this->numCols;
-  T factor = static_cast<T>(num);
-  Matrix<T> result = Matrix<T>(this->numCols, this->numRows);
-  for (int i = 0; i < n; i++) {
-    result.values[i] = this->values[i] / factor;
+template <typename T, typename Storage>
+Matrix<T, Storage>& Matrix<T, Storage>::operator=(Matrix<T, Storage>&& m) noexcept {
+  if (this != &m) {
+    if (!this->borrowed) {
+      Storage::deallocate(this->values, this->numCols * this->numRows);
+    }
+    this->numRows = m.numRows;
+    this->numCols = m.numCols;
+    this->values = m.values;
+    this->borrowed = m.borrowed;
+    m.values = nullptr;
+    m.borrowed = false;
+    m.numRows = 0;
+    m.numCols = 0;
   }
-  return result;
+  return *this;
 }
 
-template <typename T>
-Matrix<T>::~Matrix() {
-  if (this->values != nullptr) {
-    delete[] this->values;
+template <typename T, typename Storage>
+Matrix<T, Storage>::~Matrix() {
+  if (this->values != nullptr && !this->borrowed) {
+    Storage::deallocate(this->values, this->numCols * this->numRows);
   }
 }
 
-template <typename T>
-std::ostream& operator<<(std::ostream& os, const Matrix<T>& m) {
+template <typename T, typename Storage>
+std::ostream& operator<<(std::ostream& os, const Matrix<T, Storage>& m) {
   os << "[";
   for (size_t y = 0; y < m.numRows; y++) {
     if (y > 0)
@@ -178,13 +183,8 @@ std::ostream& operator<<(std::ostream& os, const Matrix<T>& m) {
   return os;
 }
 
-template class Matrix<float>;
-
-template std::ostream& operator<<(std::ostream& os, const Matrix<float>& m);
+template class Matrix<float, PooledStorage>;
+template class Matrix<float, AlignedStorage>;
 
-template Matrix<float> Matrix<float>::operator* <int>(const int&);
-template Matrix<float> Matrix<float>::operator* <float>(const float&);
-template Matrix<float> Matrix<float>::operator* <double>(const double&);
-template Matrix<float> Matrix<float>::operator/ <int>(const int&);
-template Matrix<float> Matrix<float>::operator/ <float>(const float&);
-template Matrix<float> Matrix<float>::operator/ <double>(const double&);
\ No newline at end of file
+template std::ostream& operator<<(std::ostream& os, const Matrix<float, PooledStorage>& m);
+template std::ostream& operator<<(std::ostream& os, const Matrix<float, AlignedStorage>& m);
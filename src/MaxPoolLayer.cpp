@@ -1,59 +1,98 @@
 #include <MaxPoolLayer.hpp>
+#include <algorithm>
 #include <cmath>
+#include <omp.h>
 
 MaxPoolLayer::MaxPoolLayer(int size, int depth) {
   this->poolSize = size;
   this->poolDepth = depth;
 }
 
-Tensor3<float> MaxPoolLayer::forward(Tensor3<float> input) {
+namespace {
+
+bool worthParallel(size_t elements) {
+  return elements >= 64 * 64 * 64 && omp_get_max_threads() > 1;
+}
+
+} // namespace
+
+TensorView<const float> MaxPoolLayer::forward(TensorView<const float> input) {
+  return this->forwardBatch(Tensor4View<const float>(input)).sample(0);
+}
+
+TensorView<const float> MaxPoolLayer::backwards(TensorView<const float> deltas) {
+  return this->backwardsBatch(Tensor4View<const float>(deltas)).sample(0);
+}
+
+Tensor4View<const float> MaxPoolLayer::forwardBatch(Tensor4View<const float> input) {
   this->inputWidth = input.getWidth();
   this->inputHeight = input.getHeight();
+  int n = input.getBatchSize();
   int slidesW = input.getWidth() / this->poolSize;
   int slidesH = input.getHeight() / this->poolSize;
-  Tensor3<float> output = Tensor3<float>(slidesW, slidesH, this->poolDepth);
-  this->maxIndexes.clear();
-  for (size_t c = 0; c < this->poolDepth; c++) {
-    this->maxIndexes.push_back(std::vector<int>());
-    for (size_t y = 0; y < slidesH; y++) {
-      for (size_t x = 0; x < slidesW; x++) {
+  this->output.resize(n, slidesW, slidesH, this->poolDepth);
+  // Offset of the maximum inside each window, one entry per output element
+  this->maxIndexes.resize((size_t)n * this->poolDepth * slidesH * slidesW);
+  const float* in = input.getValues();
+  float* out = this->output.getValues();
+  int* maxIndexes = this->maxIndexes.data();
+  int planes = n * this->poolDepth;
+  int inputArea = this->inputWidth * this->inputHeight;
+  bool parallel = worthParallel((size_t)planes * inputArea);
+  // Every (sample, channel) plane is pooled independently
+#pragma omp parallel for schedule(static) if (parallel)
+  for (int plane = 0; plane < planes; plane++) {
+    const float* channel = in + (size_t)plane * inputArea;
+    for (int y = 0; y < slidesH; y++) {
+      for (int x = 0; x < slidesW; x++) {
         float maxVal = -MAXFLOAT;
         int maxDisplacement = 0;
-        for (size_t poolY = 0; poolY < this->poolSize; poolY++) {
-          int inY = y * this->poolSize + poolY;
-          for (size_t poolX = 0; poolX < this->poolSize; poolX++) {
-            int inX = x * this->poolSize + poolX;
-            float val = input.getValue(inX, inY, c);
+        for (int poolY = 0; poolY < this->poolSize; poolY++) {
+          const float* row = channel + (y * this->poolSize + poolY) * this->inputWidth;
+          for (int poolX = 0; poolX < this->poolSize; poolX++) {
+            float val = row[x * this->poolSize + poolX];
             if (val > maxVal) {
               maxVal = val;
               maxDisplacement = poolY * this->poolSize + poolX;
             }
           }
         }
-        output.setValue(x, y, c, maxVal);
-        this->maxIndexes[c].push_back(maxDisplacement);
+        size_t index = ((size_t)plane * slidesH + y) * slidesW + x;
+        out[index] = maxVal;
+        maxIndexes[index] = maxDisplacement;
       }
     }
   }
-  return output;
+  return this->output.view();
 }
 
-Tensor3<float> MaxPoolLayer::backwards(Tensor3<float> deltas) {
-  Tensor3<float> output = Tensor3<float>(this->inputWidth, this->inputHeight, this->poolDepth);
-  for (size_t c = 0; c < this->poolDepth; c++) {
-    for (size_t y = 0; y < deltas.getHeight(); y++) {
-      for (size_t x = 0; x < deltas.getWidth(); x++) {
-        float delta = deltas.getValue(x, y, c);
-        int maxIndex = this->maxIndexes[c][y * deltas.getWidth() + x];
-        int poolY = maxIndex / this->poolSize;
-        int poolX = maxIndex % this->poolSize;
+Tensor4View<const float> MaxPoolLayer::backwardsBatch(Tensor4View<const float> deltas) {
+  int n = deltas.getBatchSize();
+  int slidesW = deltas.getWidth();
+  int slidesH = deltas.getHeight();
+  this->inputDeltas.resize(n, this->inputWidth, this->inputHeight, this->poolDepth);
+  const float* in = deltas.getValues();
+  float* out = this->inputDeltas.getValues();
+  const int* maxIndexes = this->maxIndexes.data();
+  int planes = n * this->poolDepth;
+  int inputArea = this->inputWidth * this->inputHeight;
+  bool parallel = worthParallel((size_t)planes * inputArea);
+#pragma omp parallel for schedule(static) if (parallel)
+  for (int plane = 0; plane < planes; plane++) {
+    float* channel = out + (size_t)plane * inputArea;
+    std::fill(channel, channel + inputArea, 0.0f);
+    for (int y = 0; y < slidesH; y++) {
+      for (int x = 0; x < slidesW; x++) {
+        size_t index = ((size_t)plane * slidesH + y) * slidesW + x;
+        int poolY = maxIndexes[index] / this->poolSize;
+        int poolX = maxIndexes[index] % this->poolSize;
         int outY = y * this->poolSize + poolY;
         int outX = x * this->poolSize + poolX;
-        output.setValue(outX, outY, c, delta);
+        channel[outY * this->inputWidth + outX] = in[index];
       }
     }
   }
-  return output;
+  return this->inputDeltas.view();
 }
 
 int MaxPoolLayer::getPoolSize() {
@@ -61,4 +100,8 @@ int MaxPoolLayer::getPoolSize() {
 }
 int MaxPoolLayer::getPoolDepth() {
   return this->poolDepth;
+}
+
+Layer* MaxPoolLayer::clone() const {
+  return new MaxPoolLayer(*this);
 }
\ No newline at end of file
@@ -5,154 +5,690 @@
 #include <GAP.hpp>
 #include <MaxPoolLayer.hpp>
 #include <Network.hpp>
+#include <VectorMath.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <omp.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Network::Network() {
+  this->optimizer = new SgdOptimizer(0.01f);
+}
 
 void Network::addLayer(Layer* layer) {
   layer->initWeights();
   this->layers.push_back(layer);
+  this->clearReplicas();
+  this->optimizer->reset();
 }
 
-Tensor3<float> Network::forward(Tensor3<float> input) {
-  Tensor3<float> output = input;
+const Tensor3<float>& Network::forward(const Tensor3<float>& input) {
+  TensorView<const float> current = input.view();
   for (size_t i = 0; i < this->layers.size(); i++) {
-    output = this->layers[i]->forward(output);
-  }
-  // Numerically stable softmax: subtract max before exponentiating
-  float maxVal = output.getValue(0, 0, 0);
-  for (size_t i = 1; i < output.getWidth(); i++) {
-    float val = output.getValue(i, 0, 0);
-    if (val > maxVal)
-      maxVal = val;
-  }
-  float sum = 0;
-  for (size_t i = 0; i < output.getWidth(); i++) {
-    float val = expf(output.getValue(i, 0, 0) - maxVal);
-    output.setValue(i, 0, 0, val);
-    sum += val;
-  }
-  for (size_t i = 0; i < output.getWidth(); i++) {
-    output.setValue(i, 0, 0, output.getValue(i, 0, 0) / sum);
+    current = this->layers[i]->forward(current);
   }
+  Tensor3<float>& output = this->output;
+  output.resize(current.getWidth(), current.getHeight(), current.getChannels());
+  softmax(current.getValues(), output.getValues(),
+          current.getWidth() * current.getHeight() * current.getChannels());
   return output;
 }
 
-void Network::backwards(Tensor3<float> result, Tensor3<float> expected) {
-  // Gradient of MSE loss w.r.t. softmax output: dL/ds_i = 2*(s_i - y_i)
-  // Gradient through softmax jacobian: dL/dz_i = s_i * (dL/ds_i - sum_j(dL/ds_j * s_j))
-  int n = result.getWidth();
+namespace {
+
+// Gradient of MSE loss w.r.t. softmax output: dL/ds_i = 2*(s_i - y_i)
+// Gradient through softmax jacobian: dL/dz_i = s_i * (dL/ds_i - sum_j(dL/ds_j * s_j))
+void lossGradient(const float* result, const float* expected, int n, float* out) {
   float dot = 0.0f;
   for (int i = 0; i < n; i++) {
-    float si = result.getValue(i, 0, 0);
-    float yi = const_cast<Tensor3<float>&>(expected).getValue(i, 0, 0);
-    dot += 2.0f * (si - yi) * si;
+    dot += 2.0f * (result[i] - expected[i]) * result[i];
   }
-  Tensor3<float> output = Tensor3<float>(n, 1, 1);
   for (int i = 0; i < n; i++) {
-    float si = result.getValue(i, 0, 0);
-    float yi = const_cast<Tensor3<float>&>(expected).getValue(i, 0, 0);
-    float grad = si * (2.0f * (si - yi) - dot);
-    output.setValue(i, 0, 0, grad);
+    out[i] = result[i] * (2.0f * (result[i] - expected[i]) - dot);
+  }
+}
+
+// Runs a batch through layers and writes one softmax per sample to output
+void forwardLayers(std::vector<Layer*>& layers, Tensor4View<const float> input,
+                   Tensor4<float>& output) {
+  Tensor4View<const float> current = input;
+  for (size_t i = 0; i < layers.size(); i++) {
+    current = layers[i]->forwardBatch(current);
   }
+  output.resize(current.getBatchSize(), current.getWidth(), current.getHeight(),
+                current.getChannels());
+  int classes = current.getSampleSize();
+  for (int b = 0; b < current.getBatchSize(); b++) {
+    softmax(current.getValues() + (size_t)b * classes, output.getValues() + (size_t)b * classes,
+            classes);
+  }
+}
+
+// expected holds one label per sample of result
+void batchLossGradient(const Tensor4<float>& result, const float* expected,
+                       Tensor4<float>& outputDeltas) {
+  int n = result.getBatchSize();
+  int classes = result.getWidth();
+  outputDeltas.resize(n, classes, 1, 1);
+  for (int b = 0; b < n; b++) {
+    lossGradient(result.getValues() + (size_t)b * classes, expected + (size_t)b * classes,
+                 classes, outputDeltas.getValues() + (size_t)b * classes);
+  }
+}
+
+void backwardsLayers(std::vector<Layer*>& layers, const Tensor4<float>& result,
+                     const float* expected, Tensor4<float>& outputDeltas) {
+  batchLossGradient(result, expected, outputDeltas);
+  Tensor4View<const float> deltas = outputDeltas.view();
+  for (int i = (int)layers.size() - 1; i >= 0; i--) {
+    deltas = layers[i]->backwardsBatch(deltas);
+  }
+}
+
+} // namespace
+
+void Network::backwards(const Tensor3<float>& result, const Tensor3<float>& expected) {
+  int n = result.getWidth();
+  this->outputDeltas.resize(n, 1, 1);
+  lossGradient(result.getValues(), expected.getValues(), n, this->outputDeltas.getValues());
+  this->lastBatchSize = 1;
+  TensorView<const float> deltas = this->outputDeltas.view();
   for (int i = (int)this->layers.size() - 1; i >= 0; i--) {
-    output = this->layers[i]->backwards(output);
+    deltas = this->layers[i]->backwards(deltas);
   }
 }
 
-void Network::update(float learningRate) {
+const Tensor4<float>& Network::forwardBatch(const Tensor4<float>& input) {
+  forwardLayers(this->layers, input.view(), this->batchOutput);
+  return this->batchOutput;
+}
+
+void Network::backwardsBatch(const Tensor4<float>& result, const Tensor4<float>& expected) {
+  backwardsLayers(this->layers, result, expected.getValues(), this->batchOutputDeltas);
+  this->lastBatchSize = result.getBatchSize();
+}
+
+void Network::accumulateGradients() {
   for (size_t i = 0; i < this->layers.size(); i++) {
-    this->layers[i]->update(learningRate);
+    this->layers[i]->accumulateGradients();
+  }
+  this->accumulatedSamples += this->lastBatchSize;
+}
+
+void Network::step() {
+  if (this->accumulatedSamples == 0) {
+    return;
+  }
+  this->parameterViews.clear();
+  this->gradientViews.clear();
+  for (Layer* layer : this->layers) {
+    layer->collectParameters(this->parameterViews);
+    layer->collectGradients(this->gradientViews);
+  }
+  this->optimizer->step(this->parameterViews, this->gradientViews, this->accumulatedSamples);
+  for (Layer* layer : this->layers) {
+    layer->clearGradients();
+    layer->invalidateCaches();
+  }
+  this->accumulatedSamples = 0;
+}
+
+void Network::update() {
+  this->accumulateGradients();
+  this->step();
+}
+
+void Network::setOptimizer(Optimizer* optimizer) {
+  if (optimizer == nullptr) {
+    throw std::invalid_argument("Optimizer can't be null");
+  }
+  delete this->optimizer;
+  this->optimizer = optimizer;
+}
+
+Optimizer& Network::getOptimizer() {
+  return *this->optimizer;
+}
+
+void Network::collectParameters(std::vector<MatrixView<float>>& out) {
+  for (Layer* layer : this->layers) {
+    layer->collectParameters(out);
+  }
+}
+
+const Tensor4<float>& Network::trainBatch(const Tensor4<float>& input,
+                                          const Tensor4<float>& expected) {
+  int n = input.getBatchSize();
+  int workers = std::min(this->threads, n);
+  if (workers <= 1) {
+    const Tensor4<float>& output = this->forwardBatch(input);
+    this->backwardsBatch(output, expected);
+    this->update();
+    return output;
+  }
+  this->prepareWorkers(workers);
+  int team = workers;
+  // Kernels called from the workers see a nested region and stay on their thread
+#pragma omp parallel num_threads(workers)
+  {
+    int t = omp_get_thread_num();
+    int size = omp_get_num_threads();
+    if (t == 0) {
+      team = size;
+    }
+    std::vector<Layer*>& layers = t == 0 ? this->layers : this->replicas[t - 1];
+    if (t > 0) {
+      for (size_t i = 0; i < layers.size(); i++) {
+        layers[i]->copyParameters(*this->layers[i]);
+        layers[i]->clearGradients();
+      }
+    }
+    int begin = (int)((long long)n * t / size);
+    int end = (int)((long long)n * (t + 1) / size);
+    Tensor4View<const float> slice(input.getValues() + (size_t)begin * input.getSampleSize(),
+                                   end - begin, input.getWidth(), input.getHeight(),
+                                   input.getChannels());
+    forwardLayers(layers, slice, this->workerOutputs[t]);
+    backwardsLayers(layers, this->workerOutputs[t],
+                    expected.getValues() + (size_t)begin * expected.getSampleSize(),
+                    this->workerDeltas[t]);
+    for (size_t i = 0; i < layers.size(); i++) {
+      layers[i]->accumulateGradients();
+    }
+    // After the round with a given stride, worker t holds the sum of workers t to
+    // t + 2 * stride - 1. The order of the additions only depends on the team size, so
+    // results don't change from run to run.
+    for (int stride = 1; stride < size; stride *= 2) {
+#pragma omp barrier
+      if (t % (2 * stride) == 0 && t + stride < size) {
+        std::vector<Layer*>& other = this->replicas[t + stride - 1];
+        for (size_t i = 0; i < layers.size(); i++) {
+          layers[i]->addGradients(*other[i]);
+        }
+      }
+    }
+  }
+  this->accumulatedSamples += n;
+  this->step();
+  const Tensor4<float>& first = this->workerOutputs[0];
+  int classes = first.getSampleSize();
+  this->batchOutput.resize(n, first.getWidth(), first.getHeight(), first.getChannels());
+  for (int t = 0; t < team; t++) {
+    const Tensor4<float>& part = this->workerOutputs[t];
+    size_t begin = (size_t)((long long)n * t / team) * classes;
+    std::copy(part.getValues(), part.getValues() + (size_t)part.getBatchSize() * classes,
+              this->batchOutput.getValues() + begin);
+  }
+  return this->batchOutput;
+}
+
+const Tensor4<float>& Network::trainAsync(const Tensor4<float>& input,
+                                          const Tensor4<float>& expected, int batchSize) {
+  int n = input.getBatchSize();
+  int batches = (n + batchSize - 1) / batchSize;
+  int workers = std::min(this->threads, batches);
+  // The network's own layers hold the shared parameters, every worker trains a replica
+  this->prepareWorkers(workers + 1);
+  int classes = expected.getSampleSize();
+  float learningRate = this->optimizer->getLearningRate();
+  this->batchOutput.resize(n, expected.getWidth(), expected.getHeight(), expected.getChannels());
+#pragma omp parallel num_threads(workers)
+  {
+    int t = omp_get_thread_num();
+    std::vector<Layer*>& layers = this->replicas[t];
+#pragma omp for schedule(dynamic)
+    for (int batch = 0; batch < batches; batch++) {
+      int begin = batch * batchSize;
+      int size = std::min(batchSize, n - begin);
+      for (size_t i = 0; i < layers.size(); i++) {
+        layers[i]->copyParametersRelaxed(*this->layers[i]);
+      }
+      Tensor4View<const float> slice(input.getValues() + (size_t)begin * input.getSampleSize(),
+                                     size, input.getWidth(), input.getHeight(),
+                                     input.getChannels());
+      Tensor4<float>& output = this->workerOutputs[t];
+      forwardLayers(layers, slice, output);
+      std::copy(output.getValues(), output.getValues() + (size_t)size * classes,
+                this->batchOutput.getValues() + (size_t)begin * classes);
+      backwardsLayers(layers, output, expected.getValues() + (size_t)begin * classes,
+                      this->workerDeltas[t]);
+      for (size_t i = 0; i < layers.size(); i++) {
+        layers[i]->clearGradients();
+        layers[i]->accumulateGradients();
+        layers[i]->applyGradientsRelaxed(*this->layers[i], learningRate, size);
+      }
+    }
+  }
+  for (size_t i = 0; i < this->layers.size(); i++) {
+    this->layers[i]->invalidateCaches();
+  }
+  return this->batchOutput;
+}
+
+void Network::setCommunicator(RingAllreduce* communicator) {
+  this->communicator = communicator;
+}
+
+void Network::broadcastParameters() {
+  if (this->communicator == nullptr) {
+    return;
+  }
+  this->exchanged.clear();
+  for (Layer* layer : this->layers) {
+    layer->collectParameters(this->exchanged);
+  }
+  for (MatrixView<float>& parameters : this->exchanged) {
+    size_t count = (size_t)parameters.getNumCols() * parameters.getNumRows();
+    this->communicator->broadcast(parameters.getValues(), sizeof(float) * count);
+  }
+  for (Layer* layer : this->layers) {
+    layer->invalidateCaches();
+  }
+}
+
+const Tensor4<float>& Network::trainDistributed(const Tensor4<float>& input,
+                                                const Tensor4<float>& expected,
+                                                int totalSamples) {
+  forwardLayers(this->layers, input.view(), this->batchOutput);
+  batchLossGradient(this->batchOutput, expected.getValues(), this->batchOutputDeltas);
+  Tensor4View<const float> deltas = this->batchOutputDeltas.view();
+  for (int i = (int)this->layers.size() - 1; i >= 0; i--) {
+    deltas = this->layers[i]->backwardsBatch(deltas);
+    if (this->communicator == nullptr) {
+      continue;
+    }
+    this->layers[i]->accumulateGradients();
+    this->exchanged.clear();
+    this->layers[i]->collectGradients(this->exchanged);
+    for (MatrixView<float>& gradients : this->exchanged) {
+      size_t count = (size_t)gradients.getNumCols() * gradients.getNumRows();
+      this->communicator->allreduceAsync(gradients.getValues(), count);
+    }
+  }
+  if (this->communicator != nullptr) {
+    this->communicator->wait();
+  } else {
+    for (size_t i = 0; i < this->layers.size(); i++) {
+      this->layers[i]->accumulateGradients();
+    }
   }
+  this->accumulatedSamples += totalSamples;
+  this->step();
+  return this->batchOutput;
+}
+
+void Network::setThreads(int threads) {
+  if (threads < 1) {
+    throw std::invalid_argument("Thread count must be positive");
+  }
+  this->threads = threads;
+}
+
+void Network::prepareWorkers(int workers) {
+  while ((int)this->replicas.size() < workers - 1) {
+    std::vector<Layer*> replica;
+    for (Layer* layer : this->layers) {
+      replica.push_back(layer->clone());
+    }
+    this->replicas.push_back(replica);
+  }
+  if ((int)this->workerOutputs.size() < workers) {
+    this->workerOutputs.resize(workers);
+    this->workerDeltas.resize(workers);
+  }
+}
+
+void Network::clearReplicas() {
+  for (std::vector<Layer*>& replica : this->replicas) {
+    for (Layer* layer : replica) {
+      delete layer;
+    }
+  }
+  this->replicas.clear();
+}
+
+namespace {
+
+// Weight files start with a WeightHeader, followed by the layer table at tableOffset with
+// one LayerRecord per layer. Every parameter tensor is a section of its own starting at a
+// multiple of STORAGE_ALIGNMENT bytes, so layers can use a mapped file in place, and the
+// file is padded to a multiple of it. The checksum covers everything after the header.
+// Fields are in the byte order of the machine that wrote the file.
+constexpr char WEIGHT_MAGIC[8] = {'C', 'N', 'N', 'W', 'G', 'H', 'T', '\0'};
+constexpr uint32_t WEIGHT_VERSION = 2;
+
+struct WeightHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t layerCount;
+  uint64_t tableOffset;
+  uint64_t fileSize;
+  uint64_t checksum;
+  uint8_t reserved[24];
+};
+static_assert(sizeof(WeightHeader) == 64);
+
+// shape holds the constructor arguments of the layer type, offsets and counts the sections
+// of its parameters in collectParameters order, a count of 0 marking an unused slot
+struct LayerRecord {
+  uint32_t type;
+  uint32_t activation;
+  int32_t shape[6];
+  uint64_t offsets[2];
+  uint64_t counts[2];
+};
+static_assert(sizeof(LayerRecord) == 64);
+
+uint64_t alignSection(uint64_t offset) {
+  return (offset + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+}
+
+// FNV-1a over 64 bit words with the high half folded back in, size a multiple of 8
+uint64_t weightChecksum(const uint8_t* bytes, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ull;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+// Fills record with the layer's type, activation and shape, false for a layer type the
+// format doesn't know
+bool describeLayer(Layer* layer, LayerRecord& record) {
+  record = LayerRecord{};
+  record.activation = NONE;
+  if (ConvolutionalLayer* convLayer = dynamic_cast<ConvolutionalLayer*>(layer)) {
+    record.type = CONVOLUTIONAL;
+    record.activation = convLayer->getActivation();
+    record.shape[0] = convLayer->getFilterCount();
+    record.shape[1] = convLayer->getFilterSize();
+    record.shape[2] = convLayer->getFilterDepth();
+    record.shape[3] = convLayer->getStride();
+    record.shape[4] = convLayer->getPadding();
+  } else if (DenseLayer* denseLayer = dynamic_cast<DenseLayer*>(layer)) {
+    record.type = DENSE;
+    record.activation = denseLayer->getActivation();
+    record.shape[0] = denseLayer->getInputSize();
+    record.shape[1] = denseLayer->getOutputSize();
+  } else if (MaxPoolLayer* poolLayer = dynamic_cast<MaxPoolLayer*>(layer)) {
+    record.type = MAXPOOL;
+    record.shape[0] = poolLayer->getPoolSize();
+    record.shape[1] = poolLayer->getPoolDepth();
+  } else if (FlattenLayer* flattenLayer = dynamic_cast<FlattenLayer*>(layer)) {
+    record.type = FLATTEN;
+    record.shape[0] = flattenLayer->getInputWidth();
+    record.shape[1] = flattenLayer->getInputHeight();
+    record.shape[2] = flattenLayer->getInputDepth();
+  } else if (GAP* gapLayer = dynamic_cast<GAP*>(layer)) {
+    record.type = GAP_LAYER;
+    record.shape[0] = gapLayer->getInputWidth();
+    record.shape[1] = gapLayer->getInputHeight();
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Returns the size of the file for layers and sets tensors to the parameters it holds, in
+// file order. With an image it writes everything but the checksum into it, with offsets as
+// well it leaves the parameters out and sets offsets to where each of tensors goes instead.
+uint64_t layoutWeights(const std::vector<Layer*>& layers, std::vector<MatrixView<float>>& tensors,
+                       uint8_t* image, std::vector<uint64_t>* offsets = nullptr) {
+  LayerRecord record;
+  uint32_t count = 0;
+  for (Layer* layer : layers) {
+    count += describeLayer(layer, record);
+  }
+  uint64_t offset = alignSection(sizeof(WeightHeader) + count * sizeof(LayerRecord));
+  uint32_t index = 0;
+  tensors.clear();
+  if (offsets) {
+    offsets->clear();
+  }
+  for (Layer* layer : layers) {
+    if (!describeLayer(layer, record)) {
+      if (image) {
+        std::cerr << "Unknown layer type during saveWeights, skipping layer" << std::endl;
+      }
+      continue;
+    }
+    size_t first = tensors.size();
+    layer->collectParameters(tensors);
+    for (size_t t = first; t < tensors.size(); t++) {
+      uint64_t values = (uint64_t)tensors[t].getNumCols() * tensors[t].getNumRows();
+      record.counts[t - first] = values;
+      record.offsets[t - first] = offset;
+      if (offsets) {
+        offsets->push_back(offset);
+      } else if (image) {
+        std::memcpy(image + offset, tensors[t].getValues(), values * sizeof(float));
+      }
+      offset = alignSection(offset + values * sizeof(float));
+    }
+    if (image) {
+      std::memcpy(image + sizeof(WeightHeader) + index * sizeof(LayerRecord), &record,
+                  sizeof(record));
+    }
+    index++;
+  }
+  if (image) {
+    WeightHeader header{};
+    std::memcpy(header.magic, WEIGHT_MAGIC, sizeof(WEIGHT_MAGIC));
+    header.version = WEIGHT_VERSION;
+    header.layerCount = count;
+    header.tableOffset = sizeof(WeightHeader);
+    header.fileSize = offset;
+    std::memcpy(image, &header, sizeof(header));
+  }
+  return offset;
+}
+
+} // namespace
+
+size_t Network::getWeightImageSize() {
+  return layoutWeights(this->layers, this->parameterViews, nullptr);
+}
+
+void Network::writeWeightImage(uint8_t* image) {
+  layoutWeights(this->layers, this->parameterViews, image);
+}
+
+void Network::writeWeightLayout(uint8_t* image, std::vector<MatrixView<float>>& tensors,
+                                std::vector<uint64_t>& offsets) {
+  layoutWeights(this->layers, tensors, image, &offsets);
+}
+
+void Network::sealWeightImage(uint8_t* image) {
+  WeightHeader header;
+  std::memcpy(&header, image, sizeof(header));
+  header.checksum =
+      weightChecksum(image + sizeof(WeightHeader), header.fileSize - sizeof(WeightHeader));
+  std::memcpy(image, &header, sizeof(header));
 }
 
 void Network::saveWeights(std::string path) {
+  std::vector<uint8_t> bytes(this->getWeightImageSize());
+  this->writeWeightImage(bytes.data());
+  sealWeightImage(bytes.data());
   auto file = std::ofstream(path, std::ios::binary);
   if (!file.is_open()) {
     std::cerr << "Failed to open file for saving weights: " << path << std::endl;
     return;
   }
-  for (auto* layer : this->layers) {
-    if (ConvolutionalLayer* convLayer = dynamic_cast<ConvolutionalLayer*>(layer)) {
-      Matrix<float> filters = convLayer->getFilters();
-      Matrix<float> biases = convLayer->getBiases();
-      LayerType type = CONVOLUTIONAL;
-      file.write(reinterpret_cast<char*>(&type), sizeof(LayerType));
-      int filterCount = convLayer->getFilterCount();
-      int filterSize = convLayer->getFilterSize();
-      int filterDepth = convLayer->getFilterDepth();
-      file.write(reinterpret_cast<char*>(&filterCount), sizeof(int));
-      file.write(reinterpret_cast<char*>(&filterSize), sizeof(int));
-      file.write(reinterpret_cast<char*>(&filterDepth), sizeof(int));
-      file.write(reinterpret_cast<char*>(filters.getValues()),
-                 sizeof(float) * filters.getNumRows() * filters.getNumCols());
-      file.write(reinterpret_cast<char*>(biases.getValues()),
-                 sizeof(float) * biases.getNumRows() * biases.getNumCols());
+  file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  file.close();
+  if (file.fail()) {
+    std::cerr << "Failed to write weights: " << path << std::endl;
+  }
+}
+
+bool Network::loadWeights(std::string path, size_t offset) {
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    std::cerr << "Failed to open file for loading weights: " << path << std::endl;
+    return false;
+  }
+  struct stat info;
+  WeightHeader header;
+  if (fstat(file, &info) != 0 || (size_t)info.st_size < offset + sizeof(WeightHeader) ||
+      pread(file, &header, sizeof(header), offset) != (ssize_t)sizeof(header) ||
+      std::memcmp(header.magic, WEIGHT_MAGIC, sizeof(WEIGHT_MAGIC)) != 0) {
+    close(file);
+    if (offset > 0) {
+      std::cerr << "No weights at offset " << offset << " of " << path << std::endl;
+      return false;
+    }
+    return this->loadLegacyWeights(path);
+  }
+  if (header.fileSize > (size_t)info.st_size - offset || header.fileSize < sizeof(WeightHeader)) {
+    close(file);
+    std::cerr << "Truncated weight file: " << path << std::endl;
+    return false;
+  }
+  size_t size = header.fileSize;
+  // Private and writable so training a loaded model copies only the pages it changes
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, offset);
+  close(file);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "Failed to map weights: " << path << std::endl;
+    return false;
+  }
+  uint8_t* bytes = static_cast<uint8_t*>(mapping);
+  if (header.version != WEIGHT_VERSION || size % sizeof(uint64_t) != 0 ||
+      header.tableOffset < sizeof(WeightHeader) ||
+      header.tableOffset > size ||
+      header.layerCount > (size - header.tableOffset) / sizeof(LayerRecord) ||
+      weightChecksum(bytes + sizeof(WeightHeader), size - sizeof(WeightHeader)) !=
+          header.checksum) {
+    std::cerr << "Corrupt or unsupported weight file: " << path << std::endl;
+    munmap(mapping, size);
+    return false;
+  }
+  this->clearLayers();
+  this->optimizer->reset();
+  this->accumulatedSamples = 0;
+  this->weightMapping = mapping;
+  this->weightMappingSize = size;
 
+  for (uint32_t i = 0; i < header.layerCount; i++) {
+    LayerRecord record;
+    std::memcpy(&record, bytes + header.tableOffset + i * sizeof(LayerRecord), sizeof(record));
+    const int* shape = record.shape;
+    ActivationFunction activation = static_cast<ActivationFunction>(record.activation);
+    Layer* layer = nullptr;
+    try {
+      // An activation this build doesn't know, from a newer one, would run as the identity
+      if (record.activation > GELU) {
+        layer = nullptr;
+      } else if (record.type == CONVOLUTIONAL) {
+        layer = new ConvolutionalLayer(shape[1], shape[2], shape[0], activation, shape[3],
+                                       shape[4]);
+      } else if (record.type == DENSE) {
+        layer = new DenseLayer(shape[0], shape[1], activation);
+      } else if (record.type == MAXPOOL) {
+        layer = new MaxPoolLayer(shape[0], shape[1]);
+      } else if (record.type == FLATTEN) {
+        layer = new FlattenLayer(shape[0], shape[1], shape[2]);
+      } else if (record.type == GAP_LAYER) {
+        layer = new GAP(shape[0], shape[1]);
+      }
+    } catch (const std::invalid_argument&) {
+      layer = nullptr;
+    }
+    if (layer == nullptr) {
+      std::cerr << "Bad layer " << i << " in weight file: " << path << std::endl;
+      this->clearLayers();
+      return false;
+    }
+    this->layers.push_back(layer);
+    // The layer's own parameters give the shapes its sections must have
+    std::vector<MatrixView<float>> expected;
+    layer->collectParameters(expected);
+    std::vector<Matrix<float>> sections;
+    for (size_t t = 0; t < expected.size(); t++) {
+      uint64_t count = (uint64_t)expected[t].getNumCols() * expected[t].getNumRows();
+      if (t >= 2 || record.counts[t] != count || record.offsets[t] % STORAGE_ALIGNMENT != 0 ||
+          record.offsets[t] > size || count > (size - record.offsets[t]) / sizeof(float)) {
+        std::cerr << "Bad parameters for layer " << i << " in weight file: " << path
+                  << std::endl;
+        this->clearLayers();
+        return false;
+      }
+      float* values = reinterpret_cast<float*>(bytes + record.offsets[t]);
+      sections.push_back(Matrix<float>::borrow(values, expected[t].getNumCols(),
+                                               expected[t].getNumRows()));
+    }
+    if (ConvolutionalLayer* convLayer = dynamic_cast<ConvolutionalLayer*>(layer)) {
+      convLayer->setFilters(std::move(sections[0]));
+      convLayer->setBiases(std::move(sections[1]));
     } else if (DenseLayer* denseLayer = dynamic_cast<DenseLayer*>(layer)) {
-      Matrix<float> weights = denseLayer->getWeights();
-      Matrix<float> biases = denseLayer->getBiases();
-      LayerType type = DENSE;
-      file.write(reinterpret_cast<char*>(&type), sizeof(LayerType));
-      int inputSize = denseLayer->getInputSize();
-      int outputSize = denseLayer->getOutputSize();
-      file.write(reinterpret_cast<char*>(&inputSize), sizeof(int));
-      file.write(reinterpret_cast<char*>(&outputSize), sizeof(int));
-      file.write(reinterpret_cast<char*>(weights.getValues()),
-                 sizeof(float) * weights.getNumRows() * weights.getNumCols());
-      file.write(reinterpret_cast<char*>(biases.getValues()),
-                 sizeof(float) * biases.getNumRows() * biases.getNumCols());
-    } else if (MaxPoolLayer* poolLayer = dynamic_cast<MaxPoolLayer*>(layer)) {
-      LayerType type = MAXPOOL;
-      file.write(reinterpret_cast<char*>(&type), sizeof(LayerType));
-      int poolSize = poolLayer->getPoolSize();
-      int poolDepth = poolLayer->getPoolDepth();
-      file.write(reinterpret_cast<char*>(&poolSize), sizeof(int));
-      file.write(reinterpret_cast<char*>(&poolDepth), sizeof(int));
-    } else if (FlattenLayer* flattenLayer = dynamic_cast<FlattenLayer*>(layer)) {
-      LayerType type = FLATTEN;
-      file.write(reinterpret_cast<char*>(&type), sizeof(LayerType));
-      int inputWidth = flattenLayer->getInputWidth();
-      int inputHeight = flattenLayer->getInputHeight();
-      int inputDepth = flattenLayer->getInputDepth();
-      file.write(reinterpret_cast<char*>(&inputWidth), sizeof(int));
-      file.write(reinterpret_cast<char*>(&inputHeight), sizeof(int));
-      file.write(reinterpret_cast<char*>(&inputDepth), sizeof(int));
-    } else if (GAP* gapLayer = dynamic_cast<GAP*>(layer)) {
-      LayerType type = GAP_LAYER;
-      file.write(reinterpret_cast<char*>(&type), sizeof(LayerType));
-      int inputWidth = gapLayer->getInputWidth();
-      int inputHeight = gapLayer->getInputHeight();
-      file.write(reinterpret_cast<char*>(&inputWidth), sizeof(int));
-      file.write(reinterpret_cast<char*>(&inputHeight), sizeof(int));
-    } else {
-      std::cerr << "Unknown layer type during saveWeights, skipping layer" << std::endl;
+      denseLayer->setWeights(std::move(sections[0]));
+      denseLayer->setBiases(std::move(sections[1]));
     }
   }
-  file.close();
+  return true;
+}
+
+void Network::restoreOptimizerState(int steps, const float* state, size_t size) {
+  this->parameterViews.clear();
+  for (Layer* layer : this->layers) {
+    layer->collectParameters(this->parameterViews);
+  }
+  this->optimizer->restoreState(this->parameterViews, steps, state, size);
 }
 
-void Network::loadWeights(std::string path) {
+void Network::clearLayers() {
+  for (Layer* layer : this->layers) {
+    delete layer;
+  }
+  this->layers.clear();
+  this->clearReplicas();
+  if (this->weightMapping != nullptr) {
+    munmap(this->weightMapping, this->weightMappingSize);
+    this->weightMapping = nullptr;
+    this->weightMappingSize = 0;
+  }
+}
+
+bool Network::loadLegacyWeights(std::string path) {
   auto file = std::ifstream(path, std::ios::binary);
   if (!file.is_open()) {
     std::cerr << "Failed to open file for loading weights: " << path << std::endl;
-    return;
+    return false;
   }
-  this->layers.clear();
+  this->clearLayers();
+  this->optimizer->reset();
+  this->accumulatedSamples = 0;
   while (file.peek() != EOF) {
     LayerType type;
     file.read(reinterpret_cast<char*>(&type), sizeof(LayerType));
-    if (type == CONVOLUTIONAL) {
+    if (type == CONVOLUTIONAL || type == STRIDED_CONVOLUTIONAL) {
       int filterCount, filterSize, filterDepth;
+      int stride = 1, padding = 0;
       file.read(reinterpret_cast<char*>(&filterCount), sizeof(int));
       file.read(reinterpret_cast<char*>(&filterSize), sizeof(int));
       file.read(reinterpret_cast<char*>(&filterDepth), sizeof(int));
+      if (type == STRIDED_CONVOLUTIONAL) {
+        file.read(reinterpret_cast<char*>(&stride), sizeof(int));
+        file.read(reinterpret_cast<char*>(&padding), sizeof(int));
+      }
       Matrix<float> filters(filterCount, filterSize * filterSize * filterDepth);
       Matrix<float> biases(1, filterCount);
       file.read(reinterpret_cast<char*>(filters.getValues()),
                 sizeof(float) * filters.getNumRows() * filters.getNumCols());
       file.read(reinterpret_cast<char*>(biases.getValues()),
                 sizeof(float) * biases.getNumRows() * biases.getNumCols());
-      ConvolutionalLayer* convLayer = new ConvolutionalLayer(filterSize, filterDepth, filterCount);
+      ConvolutionalLayer* convLayer =
+          new ConvolutionalLayer(filterSize, filterDepth, filterCount, RELU, stride, padding);
       convLayer->setFilters(filters);
       convLayer->setBiases(biases);
       this->layers.push_back(convLayer);
@@ -193,10 +729,10 @@ void Network::loadWeights(std::string path) {
     }
   }
   file.close();
+  return true;
 }
 
 Network::~Network() {
-  for (size_t i = 0; i < this->layers.size(); i++) {
-    delete this->layers[i];
-  }
+  this->clearLayers();
+  delete this->optimizer;
 }
@@ -0,0 +1,290 @@
+#include <Optimizer.hpp>
+#include <SimdOps.hpp>
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+#include <stdexcept>
+
+namespace {
+
+// SSE2 at least, the kernels are bound by memory traffic once a step leaves the cache and
+// gain little from wider vectors. ScalarOps steps what is left of a range.
+using V = NativeOps;
+
+// Parameters stepped by one thread at a time, large enough to amortize the scheduling and
+// small enough to balance a model of a few hundred thousand parameters
+constexpr size_t CHUNK = 16384;
+
+bool worthParallel(size_t parameters) {
+  return parameters >= 4 * CHUNK && omp_get_max_threads() > 1;
+}
+
+// w -= g * step, rounded the same way the layers' original update was
+template <typename Ops>
+void sgdKernel(float* w, const float* g, float step, size_t& i, size_t n) {
+  typename Ops::Vec s = Ops::set(step);
+  for (; i + Ops::width <= n; i += Ops::width) {
+    Ops::store(w + i, Ops::sub(Ops::load(w + i), Ops::mul(Ops::load(g + i), s)));
+  }
+}
+
+template <typename Ops>
+void momentumKernel(float* w, const float* g, float* v, float scale, float momentum,
+                    float rate, bool nesterov, size_t& i, size_t n) {
+  using Vec = typename Ops::Vec;
+  Vec s = Ops::set(scale);
+  Vec mu = Ops::set(momentum);
+  Vec lr = Ops::set(-rate);
+  for (; i + Ops::width <= n; i += Ops::width) {
+    Vec grad = Ops::mul(Ops::load(g + i), s);
+    Vec velocity = Ops::fmadd(mu, Ops::load(v + i), grad);
+    Ops::store(v + i, velocity);
+    Vec direction = nesterov ? Ops::fmadd(mu, velocity, grad) : velocity;
+    Ops::store(w + i, Ops::fmadd(lr, direction, Ops::load(w + i)));
+  }
+}
+
+struct AdamConstants {
+  float scale;
+  float beta1;
+  float beta2;
+  float rate;
+  float epsilon;
+  float firstCorrection;
+  float secondCorrection;
+  // L2 penalty added to the gradient, and factor the parameters are shrunk by first
+  float l2;
+  float shrink;
+};
+
+template <typename Ops>
+void adamKernel(float* w, const float* g, float* m, float* v, const AdamConstants& c,
+                size_t& i, size_t n) {
+  using Vec = typename Ops::Vec;
+  Vec scale = Ops::set(c.scale);
+  Vec l2 = Ops::set(c.l2);
+  Vec shrink = Ops::set(c.shrink);
+  Vec beta1 = Ops::set(c.beta1);
+  Vec beta2 = Ops::set(c.beta2);
+  Vec oneMinusBeta1 = Ops::set(1.0f - c.beta1);
+  Vec oneMinusBeta2 = Ops::set(1.0f - c.beta2);
+  Vec firstCorrection = Ops::set(-c.rate * c.firstCorrection);
+  Vec secondCorrection = Ops::set(c.secondCorrection);
+  Vec epsilon = Ops::set(c.epsilon);
+  for (; i + Ops::width <= n; i += Ops::width) {
+    Vec weight = Ops::load(w + i);
+    Vec grad = Ops::fmadd(weight, l2, Ops::mul(Ops::load(g + i), scale));
+    Vec first = Ops::fmadd(beta1, Ops::load(m + i), Ops::mul(oneMinusBeta1, grad));
+    Vec second =
+        Ops::fmadd(beta2, Ops::load(v + i), Ops::mul(oneMinusBeta2, Ops::mul(grad, grad)));
+    Ops::store(m + i, first);
+    Ops::store(v + i, second);
+    Vec denominator = Ops::add(Ops::sqrt(Ops::mul(second, secondCorrection)), epsilon);
+    Vec step = Ops::div(Ops::mul(first, firstCorrection), denominator);
+    Ops::store(w + i, Ops::fmadd(weight, shrink, step));
+  }
+}
+
+} // namespace
+
+Optimizer::Optimizer(float learningRate) {
+  if (!(learningRate > 0.0f)) {
+    throw std::invalid_argument("Learning rate must be positive");
+  }
+  this->learningRate = learningRate;
+}
+
+void Optimizer::createMoments(const std::vector<MatrixView<float>>& parameters) {
+  int buffers = this->momentBuffers();
+  if (this->moments.empty() && buffers > 0) {
+    for (const MatrixView<float>& tensor : parameters) {
+      for (int j = 0; j < buffers; j++) {
+        this->moments.push_back(Matrix<float>(tensor.getNumCols(), tensor.getNumRows()));
+      }
+    }
+  }
+}
+
+void Optimizer::step(const std::vector<MatrixView<float>>& parameters,
+                     const std::vector<MatrixView<float>>& gradients, int samples) {
+  if (parameters.size() != gradients.size() || samples < 1) {
+    throw std::invalid_argument("Every parameter tensor needs a gradient and samples > 0");
+  }
+  int buffers = this->momentBuffers();
+  this->createMoments(parameters);
+  if (this->moments.size() != parameters.size() * buffers) {
+    throw std::invalid_argument("Parameters changed since the optimizer's first step");
+  }
+  this->chunks.clear();
+  size_t total = 0;
+  for (size_t t = 0; t < parameters.size(); t++) {
+    const MatrixView<float>& tensor = parameters[t];
+    const MatrixView<float>& gradient = gradients[t];
+    size_t count = (size_t)tensor.getNumCols() * tensor.getNumRows();
+    if (!tensor.isContiguous() || !gradient.isContiguous() ||
+        (size_t)gradient.getNumCols() * gradient.getNumRows() != count ||
+        (buffers > 0 && (size_t)this->moments[t * buffers].getNumCols() *
+                                this->moments[t * buffers].getNumRows() !=
+                            count)) {
+      throw std::invalid_argument("Gradients and moments must match their parameters");
+    }
+    for (size_t begin = 0; begin < count; begin += CHUNK) {
+      this->chunks.push_back({(int)t, begin, std::min(CHUNK, count - begin)});
+    }
+    total += count;
+  }
+  this->steps++;
+  this->beginStep(samples);
+  int chunkCount = (int)this->chunks.size();
+#pragma omp parallel for schedule(static) if (worthParallel(total))
+  for (int c = 0; c < chunkCount; c++) {
+    const Chunk& chunk = this->chunks[c];
+    float* moments[2] = {nullptr, nullptr};
+    for (int j = 0; j < buffers; j++) {
+      moments[j] = this->moments[chunk.tensor * buffers + j].getValues() + chunk.begin;
+    }
+    this->stepRange(parameters[chunk.tensor].getValues() + chunk.begin,
+                    gradients[chunk.tensor].getValues() + chunk.begin, moments, chunk.count);
+  }
+}
+
+void Optimizer::reset() {
+  this->moments.clear();
+  this->steps = 0;
+}
+
+int Optimizer::getSteps() const {
+  return this->steps;
+}
+
+size_t Optimizer::getStateSize() const {
+  size_t size = 0;
+  for (const Matrix<float>& moment : this->moments) {
+    size += (size_t)moment.getNumCols() * moment.getNumRows();
+  }
+  return size;
+}
+
+void Optimizer::collectState(std::vector<MatrixView<float>>& out) {
+  for (Matrix<float>& moment : this->moments) {
+    out.push_back(moment.view());
+  }
+}
+
+void Optimizer::restoreState(const std::vector<MatrixView<float>>& parameters, int steps,
+                             const float* state, size_t size) {
+  this->reset();
+  if (steps < 0) {
+    throw std::invalid_argument("Step count can't be negative");
+  }
+  if (size > 0) {
+    this->createMoments(parameters);
+  }
+  if (this->getStateSize() != size) {
+    this->reset();
+    throw std::invalid_argument("Optimizer state doesn't match the optimizer and parameters");
+  }
+  for (Matrix<float>& moment : this->moments) {
+    size_t count = (size_t)moment.getNumCols() * moment.getNumRows();
+    std::copy(state, state + count, moment.getValues());
+    state += count;
+  }
+  this->steps = steps;
+}
+
+float Optimizer::getLearningRate() const {
+  return this->learningRate;
+}
+
+void Optimizer::setLearningRate(float learningRate) {
+  if (!(learningRate > 0.0f)) {
+    throw std::invalid_argument("Learning rate must be positive");
+  }
+  this->learningRate = learningRate;
+}
+
+SgdOptimizer::SgdOptimizer(float learningRate, float momentum, bool nesterov)
+    : Optimizer(learningRate) {
+  if (!(momentum >= 0.0f && momentum < 1.0f)) {
+    throw std::invalid_argument("Momentum must be in [0, 1)");
+  }
+  if (nesterov && momentum == 0.0f) {
+    throw std::invalid_argument("Nesterov momentum needs a momentum > 0");
+  }
+  this->momentum = momentum;
+  this->nesterov = nesterov;
+}
+
+const char* SgdOptimizer::getName() const {
+  return this->momentum == 0.0f ? "sgd" : this->nesterov ? "nesterov" : "momentum";
+}
+
+int SgdOptimizer::momentBuffers() const {
+  return this->momentum > 0.0f ? 1 : 0;
+}
+
+void SgdOptimizer::beginStep(int samples) {
+  this->gradientScale = 1.0f / samples;
+  this->stepSize = this->learningRate / samples;
+}
+
+void SgdOptimizer::stepRange(float* parameters, const float* gradients, float* const* moments,
+                             size_t n) const {
+  size_t i = 0;
+  if (this->momentum == 0.0f) {
+    sgdKernel<V>(parameters, gradients, this->stepSize, i, n);
+    sgdKernel<ScalarOps>(parameters, gradients, this->stepSize, i, n);
+    return;
+  }
+  momentumKernel<V>(parameters, gradients, moments[0], this->gradientScale, this->momentum,
+                    this->learningRate, this->nesterov, i, n);
+  momentumKernel<ScalarOps>(parameters, gradients, moments[0], this->gradientScale,
+                            this->momentum, this->learningRate, this->nesterov, i, n);
+}
+
+AdamOptimizer::AdamOptimizer(float learningRate, float beta1, float beta2, float epsilon,
+                             float weightDecay, bool decoupledWeightDecay)
+    : Optimizer(learningRate) {
+  if (!(beta1 >= 0.0f && beta1 < 1.0f && beta2 >= 0.0f && beta2 < 1.0f)) {
+    throw std::invalid_argument("Adam betas must be in [0, 1)");
+  }
+  if (!(epsilon > 0.0f) || !(weightDecay >= 0.0f)) {
+    throw std::invalid_argument("Epsilon must be positive and weight decay non negative");
+  }
+  this->beta1 = beta1;
+  this->beta2 = beta2;
+  this->epsilon = epsilon;
+  this->weightDecay = weightDecay;
+  this->decoupledWeightDecay = decoupledWeightDecay;
+}
+
+const char* AdamOptimizer::getName() const {
+  return this->decoupledWeightDecay ? "adamw" : "adam";
+}
+
+int AdamOptimizer::momentBuffers() const {
+  return 2;
+}
+
+void AdamOptimizer::beginStep(int samples) {
+  this->gradientScale = 1.0f / samples;
+  this->firstCorrection = 1.0f / (1.0f - std::pow(this->beta1, (float)this->steps));
+  this->secondCorrection = 1.0f / (1.0f - std::pow(this->beta2, (float)this->steps));
+}
+
+void AdamOptimizer::stepRange(float* parameters, const float* gradients, float* const* moments,
+                              size_t n) const {
+  AdamConstants c;
+  c.scale = this->gradientScale;
+  c.beta1 = this->beta1;
+  c.beta2 = this->beta2;
+  c.rate = this->learningRate;
+  c.epsilon = this->epsilon;
+  c.firstCorrection = this->firstCorrection;
+  c.secondCorrection = this->secondCorrection;
+  c.l2 = this->decoupledWeightDecay ? 0.0f : this->weightDecay;
+  c.shrink = this->decoupledWeightDecay ? 1.0f - this->learningRate * this->weightDecay : 1.0f;
+  size_t i = 0;
+  adamKernel<V>(parameters, gradients, moments[0], moments[1], c, i, n);
+  adamKernel<ScalarOps>(parameters, gradients, moments[0], moments[1], c, i, n);
+}
\ No newline at end of file
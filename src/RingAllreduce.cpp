@@ -0,0 +1,430 @@
+#include <RingAllreduce.hpp>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Transfers are split into segments of this size so additions start before a chunk is
+// complete and neither direction starves the other
+constexpr size_t SEGMENT_BYTES = 64 * 1024;
+// How long a rank keeps retrying to reach the next one while it starts up, and waits for
+// the previous one to connect. A connection gets HELLO_TIMEOUT to introduce itself.
+constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(60);
+constexpr auto HELLO_TIMEOUT = std::chrono::seconds(5);
+
+// Sent both ways once a connection is up, so a rank only exchanges data with the neighbour
+// of its own run and not with a stray client or a rank given a different host list
+struct Hello {
+  char magic[4];
+  int32_t rank;
+  int32_t workers;
+};
+constexpr char HELLO_MAGIC[4] = {'R', 'I', 'N', 'G'};
+
+[[noreturn]] void fail(const std::string& what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+int ringIndex(int i, int workers) {
+  return ((i % workers) + workers) % workers;
+}
+
+sockaddr_un unixAddress(const std::string& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::invalid_argument("Socket path too long: " + path);
+  }
+  std::strcpy(address.sun_path, path.c_str());
+  return address;
+}
+
+// host:port into a resolved IPv4 address
+sockaddr_in tcpAddress(const std::string& hostPort) {
+  size_t colon = hostPort.rfind(':');
+  if (colon == std::string::npos) {
+    throw std::invalid_argument("Expected host:port, got " + hostPort);
+  }
+  std::string host = hostPort.substr(0, colon);
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = nullptr;
+  if (getaddrinfo(host.c_str(), hostPort.c_str() + colon + 1, &hints, &result) != 0) {
+    throw std::invalid_argument("Can't resolve " + hostPort);
+  }
+  sockaddr_in address = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
+  freeaddrinfo(result);
+  return address;
+}
+
+using Deadline = std::chrono::steady_clock::time_point;
+
+// Waits until socket has events or deadline passes, returning false in the latter case
+bool waitFor(int socket, short events, Deadline deadline) {
+  while (true) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    pollfd fd{socket, events, 0};
+    int ready = poll(&fd, 1, std::max<int>(left.count(), 0));
+    if (ready > 0) {
+      return true;
+    }
+    if (ready == 0) {
+      return false;
+    }
+    if (errno != EINTR) {
+      fail("poll failed");
+    }
+  }
+}
+
+void sendHello(int socket, int rank, int workers) {
+  Hello hello{};
+  std::memcpy(hello.magic, HELLO_MAGIC, sizeof(HELLO_MAGIC));
+  hello.rank = rank;
+  hello.workers = workers;
+  const char* bytes = reinterpret_cast<const char*>(&hello);
+  size_t sent = 0;
+  while (sent < sizeof(hello)) {
+    ssize_t done = send(socket, bytes + sent, sizeof(hello) - sent, MSG_NOSIGNAL);
+    if (done < 0 && errno != EINTR) {
+      fail("Can't introduce this rank");
+    }
+    sent += std::max<ssize_t>(done, 0);
+  }
+}
+
+// The rank that introduced itself on socket, or -1 if it didn't before deadline or isn't a
+// rank of a run with this many workers
+int receiveHello(int socket, int workers, Deadline deadline) {
+  Hello hello;
+  char* bytes = reinterpret_cast<char*>(&hello);
+  size_t received = 0;
+  while (received < sizeof(hello)) {
+    if (!waitFor(socket, POLLIN, deadline)) {
+      return -1;
+    }
+    ssize_t done = recv(socket, bytes + received, sizeof(hello) - received, 0);
+    if (done == 0 || (done < 0 && errno != EINTR)) {
+      return -1;
+    }
+    received += std::max<ssize_t>(done, 0);
+  }
+  if (std::memcmp(hello.magic, HELLO_MAGIC, sizeof(HELLO_MAGIC)) != 0 ||
+      hello.workers != workers) {
+    return -1;
+  }
+  return hello.rank;
+}
+
+} // namespace
+
+RingAllreduce::RingAllreduce(int rank, int workers, const std::string& socketPrefix)
+    : rank(rank), workers(workers) {
+  if (workers < 1 || rank < 0 || rank >= workers) {
+    throw std::invalid_argument("Rank must be between 0 and the number of workers");
+  }
+  if (workers > 1) {
+    int next = (rank + 1) % workers;
+    this->connectRing(socketPrefix + "-" + std::to_string(rank),
+                      socketPrefix + "-" + std::to_string(next), false);
+    this->worker = std::thread(&RingAllreduce::runJobs, this);
+  }
+}
+
+RingAllreduce::RingAllreduce(int rank, int workers, const std::vector<std::string>& hosts)
+    : rank(rank), workers(workers) {
+  if (workers < 1 || rank < 0 || rank >= workers) {
+    throw std::invalid_argument("Rank must be between 0 and the number of workers");
+  }
+  if ((int)hosts.size() != workers) {
+    throw std::invalid_argument("Expected one host:port per worker");
+  }
+  if (workers > 1) {
+    this->connectRing(hosts[rank], hosts[(rank + 1) % workers], true);
+    this->worker = std::thread(&RingAllreduce::runJobs, this);
+  }
+}
+
+// Every rank listens before it connects, so the connection to the next rank completes
+// through the listen backlog whatever order the processes reach this in. Each side then
+// introduces itself, the small hellos fit the socket buffers so nobody waits on a send.
+void RingAllreduce::connectRing(const std::string& listenAddress,
+                                const std::string& nextAddress, bool tcp) {
+  int family = tcp ? AF_INET : AF_UNIX;
+  int listener = socket(family, SOCK_STREAM, 0);
+  if (listener < 0) {
+    fail("Can't create socket");
+  }
+  int bound;
+  if (tcp) {
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = tcpAddress(listenAddress);
+    bound = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  } else {
+    sockaddr_un address = unixAddress(listenAddress);
+    unlink(listenAddress.c_str());
+    bound = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  }
+  if (bound < 0 || listen(listener, 1) < 0) {
+    fail("Can't listen on " + listenAddress);
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+  while (true) {
+    this->nextSocket = socket(family, SOCK_STREAM, 0);
+    if (this->nextSocket < 0) {
+      fail("Can't create socket");
+    }
+    int connected;
+    if (tcp) {
+      sockaddr_in address = tcpAddress(nextAddress);
+      connected = connect(this->nextSocket, reinterpret_cast<sockaddr*>(&address),
+                          sizeof(address));
+    } else {
+      sockaddr_un address = unixAddress(nextAddress);
+      connected = connect(this->nextSocket, reinterpret_cast<sockaddr*>(&address),
+                          sizeof(address));
+    }
+    if (connected == 0) {
+      break;
+    }
+    bool starting = errno == ECONNREFUSED || errno == ENOENT;
+    int error = errno;
+    close(this->nextSocket);
+    errno = error;
+    if (!starting || std::chrono::steady_clock::now() > deadline) {
+      fail("Can't connect to " + nextAddress);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+
+  sendHello(this->nextSocket, this->rank, this->workers);
+
+  // Anything that connects without introducing itself as the previous rank is dropped
+  int prev = ringIndex(this->rank - 1, this->workers);
+  deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+  while (true) {
+    if (!waitFor(listener, POLLIN, deadline)) {
+      throw std::runtime_error("The previous rank didn't connect to " + listenAddress);
+    }
+    this->prevSocket = accept(listener, nullptr, nullptr);
+    if (this->prevSocket < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      fail("Can't accept the previous rank");
+    }
+    auto helloDeadline = std::min(deadline, std::chrono::steady_clock::now() + HELLO_TIMEOUT);
+    if (receiveHello(this->prevSocket, this->workers, helloDeadline) == prev) {
+      break;
+    }
+    close(this->prevSocket);
+  }
+  close(listener);
+  sendHello(this->prevSocket, this->rank, this->workers);
+  // The next rank answers once it is past its own connect, which can take as long as ours
+  int next = receiveHello(this->nextSocket, this->workers,
+                          std::chrono::steady_clock::now() + CONNECT_TIMEOUT);
+  if (next != ringIndex(this->rank + 1, this->workers)) {
+    throw std::runtime_error(nextAddress + " isn't rank " +
+                             std::to_string(ringIndex(this->rank + 1, this->workers)) +
+                             " of this run");
+  }
+  if (tcp) {
+    // Small buffers such as biases would otherwise wait for Nagle's algorithm
+    int noDelay = 1;
+    setsockopt(this->nextSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    setsockopt(this->prevSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  } else {
+    unlink(listenAddress.c_str());
+  }
+}
+
+void RingAllreduce::exchange(const void* send, size_t sendBytes, void* recv, size_t recvBytes,
+                             bool accumulate) {
+  const char* out = static_cast<const char*>(send);
+  char* in = static_cast<char*>(recv);
+  float* sums = static_cast<float*>(recv);
+  if (accumulate) {
+    if (this->scratch.size() < recvBytes / sizeof(float)) {
+      this->scratch.resize(recvBytes / sizeof(float));
+    }
+    in = reinterpret_cast<char*>(this->scratch.data());
+  }
+  size_t sent = 0;
+  size_t received = 0;
+  size_t added = 0;
+  while (sent < sendBytes || received < recvBytes) {
+    pollfd fds[2];
+    int count = 0;
+    if (sent < sendBytes) {
+      fds[count++] = {this->nextSocket, POLLOUT, 0};
+    }
+    if (received < recvBytes) {
+      fds[count++] = {this->prevSocket, POLLIN, 0};
+    }
+    if (poll(fds, count, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("poll failed");
+    }
+    for (int i = 0; i < count; i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      if (fds[i].fd == this->nextSocket) {
+        size_t size = std::min(SEGMENT_BYTES, sendBytes - sent);
+        ssize_t done = ::send(this->nextSocket, out + sent, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (done < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          fail("Sending to the next rank failed");
+        }
+        sent += std::max<ssize_t>(done, 0);
+      } else {
+        size_t size = std::min(SEGMENT_BYTES, recvBytes - received);
+        ssize_t done = ::recv(this->prevSocket, in + received, size, MSG_DONTWAIT);
+        if (done == 0) {
+          throw std::runtime_error("The previous rank closed the connection");
+        }
+        if (done < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          fail("Receiving from the previous rank failed");
+        }
+        received += std::max<ssize_t>(done, 0);
+        if (accumulate) {
+          size_t complete = received / sizeof(float);
+          for (; added < complete; added++) {
+            sums[added] += this->scratch[added];
+          }
+        }
+      }
+    }
+  }
+}
+
+void RingAllreduce::reduce(float* values, size_t count) {
+  if (this->workers == 1 || count == 0) {
+    return;
+  }
+  int n = this->workers;
+  auto begin = [&](int chunk) { return count * chunk / n; };
+  auto bytes = [&](int chunk) { return (begin(chunk + 1) - begin(chunk)) * sizeof(float); };
+  // Reduce-scatter: afterwards chunk rank + 1 holds the sum of every rank
+  for (int step = 0; step < n - 1; step++) {
+    int sendChunk = ringIndex(this->rank - step, n);
+    int recvChunk = ringIndex(this->rank - step - 1, n);
+    this->exchange(values + begin(sendChunk), bytes(sendChunk), values + begin(recvChunk),
+                   bytes(recvChunk), true);
+  }
+  // Allgather: the complete chunks travel once around the ring
+  for (int step = 0; step < n - 1; step++) {
+    int sendChunk = ringIndex(this->rank - step + 1, n);
+    int recvChunk = ringIndex(this->rank - step, n);
+    this->exchange(values + begin(sendChunk), bytes(sendChunk), values + begin(recvChunk),
+                   bytes(recvChunk), false);
+  }
+}
+
+void RingAllreduce::runJobs() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    this->changed.wait(lock,
+                       [this] { return this->stopping || this->nextJob < this->jobs.size(); });
+    if (this->nextJob == this->jobs.size()) {
+      return;
+    }
+    Job job = this->jobs[this->nextJob];
+    lock.unlock();
+    try {
+      this->reduce(job.values, job.count);
+      lock.lock();
+      this->nextJob++;
+    } catch (...) {
+      lock.lock();
+      // The ring is out of step after a failure, the remaining jobs are dropped
+      this->failure = std::current_exception();
+      this->nextJob = this->jobs.size();
+    }
+    this->changed.notify_all();
+  }
+}
+
+int RingAllreduce::getRank() const {
+  return this->rank;
+}
+
+int RingAllreduce::getWorkers() const {
+  return this->workers;
+}
+
+void RingAllreduce::allreduce(float* values, size_t count) {
+  this->wait();
+  this->reduce(values, count);
+}
+
+void RingAllreduce::allreduceAsync(float* values, size_t count) {
+  if (this->workers == 1) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->failure == nullptr) {
+    this->jobs.push_back({values, count});
+  }
+  this->changed.notify_all();
+}
+
+void RingAllreduce::wait() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->changed.wait(lock, [this] { return this->nextJob == this->jobs.size(); });
+  this->jobs.clear();
+  this->nextJob = 0;
+  if (this->failure != nullptr) {
+    std::exception_ptr failure = this->failure;
+    this->failure = nullptr;
+    std::rethrow_exception(failure);
+  }
+}
+
+void RingAllreduce::broadcast(void* data, size_t bytes) {
+  this->wait();
+  if (this->workers == 1) {
+    return;
+  }
+  // Passed along the ring from rank 0, the last rank only receives
+  if (this->rank != 0) {
+    this->exchange(nullptr, 0, data, bytes, false);
+  }
+  if (this->rank != this->workers - 1) {
+    this->exchange(data, bytes, nullptr, 0, false);
+  }
+}
+
+RingAllreduce::~RingAllreduce() {
+  if (this->worker.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->stopping = true;
+    }
+    this->changed.notify_all();
+    this->worker.join();
+  }
+  if (this->nextSocket >= 0) {
+    close(this->nextSocket);
+  }
+  if (this->prevSocket >= 0) {
+    close(this->prevSocket);
+  }
+}
\ No newline at end of file
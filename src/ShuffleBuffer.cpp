@@ -0,0 +1,84 @@
+#include <ShuffleBuffer.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+ShuffleBuffer::ShuffleBuffer(MatReader& reader, int classes, int windowSize, int chunkSize,
+                             int holdoutEvery)
+    : reader(reader) {
+  if (windowSize < 1 || chunkSize < 1 || holdoutEvery < 2) {
+    throw std::invalid_argument("Window and chunk need a sample and holdoutEvery must be > 1");
+  }
+  this->holdoutEvery = holdoutEvery;
+  this->window = Dataset(windowSize, reader.getImageSize(), 1, 1, classes);
+  this->chunk = Dataset(chunkSize, reader.getImageSize(), 1, 1, classes);
+  for (int first = 0; first < reader.getSize(); first += chunkSize) {
+    this->chunks.push_back(first);
+  }
+  this->nextChunk = this->chunks.size();
+}
+
+bool ShuffleBuffer::belongs(int sample) const {
+  return (sample % this->holdoutEvery == this->holdoutEvery - 1) == this->heldOut;
+}
+
+int ShuffleBuffer::getSize(bool heldOut) const {
+  int held = this->reader.getSize() / this->holdoutEvery;
+  return heldOut ? held : this->reader.getSize() - held;
+}
+
+void ShuffleBuffer::start(bool heldOut, unsigned seed) {
+  this->heldOut = heldOut;
+  this->rng.seed(seed);
+  std::sort(this->chunks.begin(), this->chunks.end());
+  std::shuffle(this->chunks.begin(), this->chunks.end(), this->rng);
+  this->nextChunk = 0;
+  this->chunkPosition = 0;
+  this->chunkCount = 0;
+  this->filled = 0;
+  while (this->filled < this->window.getSize() && this->pull(this->filled)) {
+    this->filled++;
+  }
+}
+
+bool ShuffleBuffer::pull(int slot) {
+  while (true) {
+    while (this->chunkPosition < this->chunkCount) {
+      int position = this->chunkPosition++;
+      if (this->belongs(this->chunkFirst + position)) {
+        const Dataset& source = this->chunk;
+        std::copy(source.getImage(position), source.getImage(position + 1),
+                  this->window.getImage(slot));
+        this->window.setLabel(slot, source.getLabel(position));
+        return true;
+      }
+    }
+    if (this->nextChunk >= this->chunks.size()) {
+      return false;
+    }
+    this->chunkFirst = this->chunks[this->nextChunk++];
+    this->chunkCount = std::min(this->chunk.getSize(), this->reader.getSize() - this->chunkFirst);
+    this->chunkPosition = 0;
+    this->reader.read(this->chunkFirst, this->chunkCount, this->chunk, 0);
+  }
+}
+
+int ShuffleBuffer::read(Dataset& out) {
+  if (out.getImageSize() != this->window.getImageSize()) {
+    throw std::invalid_argument("Samples don't fit the dataset");
+  }
+  const Dataset& window = this->window;
+  int count = 0;
+  for (; count < out.getSize() && this->filled > 0; count++) {
+    int slot = std::uniform_int_distribution<int>(0, this->filled - 1)(this->rng);
+    std::copy(window.getImage(slot), window.getImage(slot + 1), out.getImage(count));
+    out.setLabel(count, window.getLabel(slot));
+    // Once the part is streamed the window drains, its last sample filling the gap
+    if (!this->pull(slot)) {
+      this->filled--;
+      std::copy(window.getImage(this->filled), window.getImage(this->filled + 1),
+                this->window.getImage(slot));
+      this->window.setLabel(slot, window.getLabel(this->filled));
+    }
+  }
+  return count;
+}
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include <Storage.hpp>
+#include <new>
+#include <vector>
+
+namespace {
+
+// Blocks above the largest class are too big to be worth caching
+constexpr int MIN_CLASS_SHIFT = 6;
+constexpr int CLASS_COUNT = 21;
+constexpr size_t MAX_CACHED_PER_CLASS = 32;
+
+int sizeClass(size_t bytes) {
+  int shift = MIN_CLASS_SHIFT;
+  while (((size_t)1 << shift) < bytes) {
+    shift++;
+  }
+  return shift - MIN_CLASS_SHIFT;
+}
+
+size_t classBytes(int sc) {
+  return (size_t)1 << (sc + MIN_CLASS_SHIFT);
+}
+
+struct Pool {
+  std::vector<void*> freeBlocks[CLASS_COUNT];
+  ~Pool();
+};
+
+// Set once the thread's pool has been destroyed, containers released after that point
+// (e.g. globals torn down at exit) go straight back to the heap
+thread_local bool poolDestroyed = false;
+thread_local Pool pool;
+
+Pool::~Pool() {
+  for (std::vector<void*>& blocks : this->freeBlocks) {
+    for (void* block : blocks) {
+      alignedDeallocate(block);
+    }
+  }
+  poolDestroyed = true;
+}
+
+} // namespace
+
+void* alignedAllocate(size_t bytes) {
+  return ::operator new(bytes == 0 ? STORAGE_ALIGNMENT : bytes,
+                        std::align_val_t(STORAGE_ALIGNMENT));
+}
+
+void alignedDeallocate(void* block) {
+  ::operator delete(block, std::align_val_t(STORAGE_ALIGNMENT));
+}
+
+void* pooledAllocate(size_t bytes) {
+  int sc = sizeClass(bytes);
+  if (sc >= CLASS_COUNT) {
+    return alignedAllocate(bytes);
+  }
+  // Blocks are always the full class size, even when this thread's pool is gone, since they
+  // may be freed into the pool of another thread and serve any request of their class there
+  if (poolDestroyed) {
+    return alignedAllocate(classBytes(sc));
+  }
+  std::vector<void*>& blocks = pool.freeBlocks[sc];
+  if (!blocks.empty()) {
+    void* block = blocks.back();
+    blocks.pop_back();
+    return block;
+  }
+  return alignedAllocate(classBytes(sc));
+}
+
+void pooledDeallocate(void* block, size_t bytes) {
+  if (block == nullptr) {
+    return;
+  }
+  int sc = sizeClass(bytes);
+  if (sc >= CLASS_COUNT || poolDestroyed) {
+    alignedDeallocate(block);
+    return;
+  }
+  std::vector<void*>& blocks = pool.freeBlocks[sc];
+  if (blocks.size() >= MAX_CACHED_PER_CLASS) {
+    alignedDeallocate(block);
+    return;
+  }
+  if (blocks.capacity() == 0) {
+    blocks.reserve(MAX_CACHED_PER_CLASS);
+  }
+  blocks.push_back(block);
+}
\ No newline at end of file
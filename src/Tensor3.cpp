@@ -1,107 +1,186 @@
 #include <Tensor3.hpp>
+#include <algorithm>
 #include <stdexcept>
 
-template <typename T>
-Tensor3<T>::Tensor3() {
+template <typename T, typename Storage>
+Tensor3<T, Storage>::Tensor3() {
   this->w = 0;
   this->h = 0;
   this->c = 0;
   this->values = nullptr;
 }
 
-template <typename T>
-Tensor3<T>::Tensor3(int width, int height, int channels) {
+template <typename T, typename Storage>
+Tensor3<T, Storage>::Tensor3(int width, int height, int channels) {
   this->w = width;
   this->h = height;
   this->c = channels;
-  this->values = new T[width * height * channels](0);
+  this->values = Storage::template allocate<T>(width * height * channels);
+  std::fill(this->values, this->values + width * height * channels, T(0));
 }
 
-template <typename T>
-Tensor3<T>::Tensor3(const Tensor3<T>& other) {
+template <typename T, typename Storage>
+Tensor3<T, Storage>::Tensor3(const Tensor3<T, Storage>& other) {
   this->w = other.w;
   this->h = other.h;
   this->c = other.c;
   int size = other.w * other.h * other.c;
-  this->values = new T[size];
+  this->values = Storage::template allocate<T>(size);
   for (int i = 0; i < size; i++)
     this->values[i] = other.values[i];
 }
 
-template <typename T>
-Tensor3<T>& Tensor3<T>::operator=(const Tensor3<T>& other) {
-  if (this == &other)
-    return *this;
-  delete[] this->values;
+template <typename T, typename Storage>
+Tensor3<T, Storage>::Tensor3(Tensor3<T, Storage>&& other) noexcept {
   this->w = other.w;
   this->h = other.h;
   this->c = other.c;
+  this->values = other.values;
+  other.values = nullptr;
+  other.w = 0;
+  other.h = 0;
+  other.c = 0;
+}
+
+template <typename T, typename Storage>
+Tensor3<T, Storage>& Tensor3<T, Storage>::operator=(const Tensor3<T, Storage>& other) {
+  if (this == &other)
+    return *this;
+  this->resize(other.w, other.h, other.c);
   int size = other.w * other.h * other.c;
-  this->values = new T[size];
   for (int i = 0; i < size; i++)
     this->values[i] = other.values[i];
   return *this;
 }
 
-template <typename T>
-int Tensor3<T>::getWidth() {
+template <typename T, typename Storage>
+Tensor3<T, Storage>& Tensor3<T, Storage>::operator=(Tensor3<T, Storage>&& other) noexcept {
+  if (this == &other)
+    return *this;
+  Storage::deallocate(this->values, this->w * this->h * this->c);
+  this->w = other.w;
+  this->h = other.h;
+  this->c = other.c;
+  this->values = other.values;
+  other.values = nullptr;
+  other.w = 0;
+  other.h = 0;
+  other.c = 0;
+  return *this;
+}
+
+template <typename T, typename Storage>
+int Tensor3<T, Storage>::getWidth() const {
   return this->w;
 }
-template <typename T>
-int Tensor3<T>::getHeight() {
+template <typename T, typename Storage>
+int Tensor3<T, Storage>::getHeight() const {
   return this->h;
 }
-template <typename T>
-int Tensor3<T>::getChannels() {
+template <typename T, typename Storage>
+int Tensor3<T, Storage>::getChannels() const {
   return this->c;
 }
 
-template <typename T>
-T Tensor3<T>::getValue(int x, int y, int z) {
+template <typename T, typename Storage>
+T* Tensor3<T, Storage>::getValues() {
+  return this->values;
+}
+
+template <typename T, typename Storage>
+const T* Tensor3<T, Storage>::getValues() const {
+  return this->values;
+}
+
+template <typename T, typename Storage>
+TensorView<T> Tensor3<T, Storage>::view() {
+  return TensorView<T>(this->values, this->w, this->h, this->c);
+}
+
+template <typename T, typename Storage>
+TensorView<const T> Tensor3<T, Storage>::view() const {
+  return TensorView<const T>(this->values, this->w, this->h, this->c);
+}
+
+template <typename T, typename Storage>
+MatrixView<T> Tensor3<T, Storage>::asMatrix(int cols, int rows) {
+  return this->view().asMatrix(cols, rows);
+}
+
+template <typename T, typename Storage>
+MatrixView<const T> Tensor3<T, Storage>::asMatrix(int cols, int rows) const {
+  return this->view().asMatrix(cols, rows);
+}
+
+template <typename T, typename Storage>
+T Tensor3<T, Storage>::getValue(int x, int y, int z) const {
   if (x >= this->w || y >= this->h || z >= this->c) {
     throw std::invalid_argument("Coordinates out of bounds");
   }
   return this->values[(this->w * this->h * z) + (this->w * y) + x];
 }
-template <typename T>
-void Tensor3<T>::setValue(int x, int y, int z, T value) {
+template <typename T, typename Storage>
+void Tensor3<T, Storage>::setValue(int x, int y, int z, T value) {
   if (x >= this->w || y >= this->h || z >= this->c) {
     throw std::invalid_argument("Coordinates out of bounds");
   }
   this->values[(this->w * this->h * z) + (this->w * y) + x] = value;
 }
 
-template <typename T>
-Tensor3<T> Tensor3<T>::operator+(const Tensor3<T>& t) {
+template <typename T, typename Storage>
+void Tensor3<T, Storage>::resize(int width, int height, int channels) {
+  if (width * height * channels != this->w * this->h * this->c) {
+    Storage::deallocate(this->values, this->w * this->h * this->c);
+    this->values = Storage::template allocate<T>(width * height * channels);
+    std::fill(this->values, this->values + width * height * channels, T(0));
+  }
+  this->w = width;
+  this->h = height;
+  this->c = channels;
+}
+
+template <typename T, typename Storage>
+void Tensor3<T, Storage>::reshape(int width, int height, int channels) {
+  if (width * height * channels != this->w * this->h * this->c) {
+    throw std::invalid_argument("Tensor can't be reshaped to the requested dimensions");
+  }
+  this->w = width;
+  this->h = height;
+  this->c = channels;
+}
+
+template <typename T, typename Storage>
+Tensor3<T, Storage> Tensor3<T, Storage>::operator+(const Tensor3<T, Storage>& t) {
   if (this->w != t.w || this->h != t.h || this->c != t.c) {
     throw std::invalid_argument("Tensors dimensions don't match");
   }
   int n = this->w * this->h * this->c;
-  Tensor3<T> result = Tensor3<T>(this->w, this->h, this->c);
+  Tensor3<T, Storage> result = Tensor3<T, Storage>(this->w, this->h, this->c);
   for (int i = 0; i < n; i++) {
     result.values[i] = this->values[i] + t.values[i];
   }
   return result;
 }
 
-template <typename T>
-Tensor3<T> Tensor3<T>::operator-(const Tensor3<T>& t) {
+template <typename T, typename Storage>
+Tensor3<T, Storage> Tensor3<T, Storage>::operator-(const Tensor3<T, Storage>& t) {
   if (this->w != t.w || this->h != t.h || this->c != t.c) {
     throw std::invalid_argument("Tensors dimensions don't match");
   }
   int n = this->w * this->h * this->c;
-  Tensor3<T> result = Tensor3<T>(this->w, this->h, this->c);
+  Tensor3<T, Storage> result = Tensor3<T, Storage>(this->w, this->h, this->c);
   for (int i = 0; i < n; i++) {
     result.values[i] = this->values[i] - t.values[i];
   }
   return result;
 }
 
-template <typename T>
-Tensor3<T>::~Tensor3() {
+template <typename T, typename Storage>
+Tensor3<T, Storage>::~Tensor3() {
   if (this->values != nullptr) {
-    delete[] this->values;
+    Storage::deallocate(this->values, this->w * this->h * this->c);
   }
 }
 
-template class Tensor3<float>;
\ No newline at end of file
+template class Tensor3<float, PooledStorage>;
+template class Tensor3<float, AlignedStorage>;
\ No newline at end of file
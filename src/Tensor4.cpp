@@ -0,0 +1,151 @@
+#include <Tensor4.hpp>
+#include <algorithm>
+
+template <typename T, typename Storage>
+Tensor4<T, Storage>::Tensor4() {
+  this->n = 0;
+  this->w = 0;
+  this->h = 0;
+  this->c = 0;
+  this->values = nullptr;
+}
+
+template <typename T, typename Storage>
+Tensor4<T, Storage>::Tensor4(int batchSize, int width, int height, int channels) {
+  this->n = batchSize;
+  this->w = width;
+  this->h = height;
+  this->c = channels;
+  size_t size = (size_t)batchSize * width * height * channels;
+  this->values = Storage::template allocate<T>(size);
+  std::fill(this->values, this->values + size, T(0));
+}
+
+template <typename T, typename Storage>
+Tensor4<T, Storage>::Tensor4(const Tensor4<T, Storage>& other) {
+  this->n = other.n;
+  this->w = other.w;
+  this->h = other.h;
+  this->c = other.c;
+  size_t size = (size_t)other.n * other.getSampleSize();
+  this->values = Storage::template allocate<T>(size);
+  std::copy(other.values, other.values + size, this->values);
+}
+
+template <typename T, typename Storage>
+Tensor4<T, Storage>::Tensor4(Tensor4<T, Storage>&& other) noexcept {
+  this->n = other.n;
+  this->w = other.w;
+  this->h = other.h;
+  this->c = other.c;
+  this->values = other.values;
+  other.values = nullptr;
+  other.n = 0;
+  other.w = 0;
+  other.h = 0;
+  other.c = 0;
+}
+
+template <typename T, typename Storage>
+Tensor4<T, Storage>& Tensor4<T, Storage>::operator=(const Tensor4<T, Storage>& other) {
+  if (this == &other)
+    return *this;
+  this->resize(other.n, other.w, other.h, other.c);
+  std::copy(other.values, other.values + (size_t)other.n * other.getSampleSize(),
+            this->values);
+  return *this;
+}
+
+template <typename T, typename Storage>
+Tensor4<T, Storage>& Tensor4<T, Storage>::operator=(Tensor4<T, Storage>&& other) noexcept {
+  if (this == &other)
+    return *this;
+  Storage::deallocate(this->values, (size_t)this->n * this->getSampleSize());
+  this->n = other.n;
+  this->w = other.w;
+  this->h = other.h;
+  this->c = other.c;
+  this->values = other.values;
+  other.values = nullptr;
+  other.n = 0;
+  other.w = 0;
+  other.h = 0;
+  other.c = 0;
+  return *this;
+}
+
+template <typename T, typename Storage>
+int Tensor4<T, Storage>::getBatchSize() const {
+  return this->n;
+}
+template <typename T, typename Storage>
+int Tensor4<T, Storage>::getWidth() const {
+  return this->w;
+}
+template <typename T, typename Storage>
+int Tensor4<T, Storage>::getHeight() const {
+  return this->h;
+}
+template <typename T, typename Storage>
+int Tensor4<T, Storage>::getChannels() const {
+  return this->c;
+}
+template <typename T, typename Storage>
+int Tensor4<T, Storage>::getSampleSize() const {
+  return this->w * this->h * this->c;
+}
+
+template <typename T, typename Storage>
+T* Tensor4<T, Storage>::getValues() {
+  return this->values;
+}
+
+template <typename T, typename Storage>
+const T* Tensor4<T, Storage>::getValues() const {
+  return this->values;
+}
+
+template <typename T, typename Storage>
+Tensor4View<T> Tensor4<T, Storage>::view() {
+  return Tensor4View<T>(this->values, this->n, this->w, this->h, this->c);
+}
+
+template <typename T, typename Storage>
+Tensor4View<const T> Tensor4<T, Storage>::view() const {
+  return Tensor4View<const T>(this->values, this->n, this->w, this->h, this->c);
+}
+
+template <typename T, typename Storage>
+TensorView<T> Tensor4<T, Storage>::sample(int i) {
+  return this->view().sample(i);
+}
+
+template <typename T, typename Storage>
+TensorView<const T> Tensor4<T, Storage>::sample(int i) const {
+  return this->view().sample(i);
+}
+
+template <typename T, typename Storage>
+void Tensor4<T, Storage>::resize(int batchSize, int width, int height, int channels) {
+  size_t size = (size_t)batchSize * width * height * channels;
+  size_t current = (size_t)this->n * this->getSampleSize();
+  if (size != current) {
+    Storage::deallocate(this->values, current);
+    this->values = Storage::template allocate<T>(size);
+    std::fill(this->values, this->values + size, T(0));
+  }
+  this->n = batchSize;
+  this->w = width;
+  this->h = height;
+  this->c = channels;
+}
+
+template <typename T, typename Storage>
+Tensor4<T, Storage>::~Tensor4() {
+  if (this->values != nullptr) {
+    Storage::deallocate(this->values, (size_t)this->n * this->getSampleSize());
+  }
+}
+
+template class Tensor4<float, PooledStorage>;
+template class Tensor4<float, AlignedStorage>;
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include <SimdOps.hpp>
+#include <VectorMath.hpp>
+#include <algorithm>
+#include <cfloat>
+
+namespace {
+
+// Cephes style expf: range reduction by ln 2 split in two parts so r is exact, then a
+// polynomial for exp(r) on [-ln 2 / 2, ln 2 / 2]
+template <typename Ops>
+typename Ops::Vec expApprox(typename Ops::Vec x) {
+  using Vec = typename Ops::Vec;
+  x = Ops::min(Ops::max(x, Ops::set(-87.0f)), Ops::set(88.0f));
+  Vec n = Ops::round(Ops::mul(x, Ops::set(1.44269504088896341f)));
+  Vec r = Ops::fmadd(n, Ops::set(-0.693359375f), x);
+  r = Ops::fmadd(n, Ops::set(2.12194440e-4f), r);
+  Vec p = Ops::set(1.9875691500e-4f);
+  p = Ops::fmadd(p, r, Ops::set(1.3981999507e-3f));
+  p = Ops::fmadd(p, r, Ops::set(8.3334519073e-3f));
+  p = Ops::fmadd(p, r, Ops::set(4.1665795894e-2f));
+  p = Ops::fmadd(p, r, Ops::set(1.6666665459e-1f));
+  p = Ops::fmadd(p, r, Ops::set(5.0000001201e-1f));
+  p = Ops::fmadd(p, Ops::mul(r, r), Ops::add(r, Ops::set(1.0f)));
+  return Ops::mul(p, Ops::pow2(n));
+}
+
+template <typename Ops>
+typename Ops::Vec sigmoidApprox(typename Ops::Vec x) {
+  using Vec = typename Ops::Vec;
+  Vec one = Ops::set(1.0f);
+  return Ops::div(one, Ops::add(one, expApprox<Ops>(Ops::sub(Ops::set(0.0f), x))));
+}
+
+// Every activation provides forward(z) and derivative(z), both in terms of the
+// pre-activation z
+struct Identity {
+  template <typename Ops>
+  static typename Ops::Vec forward(typename Ops::Vec x) {
+    return x;
+  }
+  template <typename Ops>
+  static typename Ops::Vec derivative(typename Ops::Vec) {
+    return Ops::set(1.0f);
+  }
+};
+
+struct Relu {
+  template <typename Ops>
+  static typename Ops::Vec forward(typename Ops::Vec x) {
+    return Ops::max(x, Ops::set(0.0f));
+  }
+  template <typename Ops>
+  static typename Ops::Vec derivative(typename Ops::Vec x) {
+    return Ops::select(Ops::greater(x, Ops::set(0.0f)), Ops::set(1.0f), Ops::set(0.0f));
+  }
+};
+
+struct LeakyRelu {
+  template <typename Ops>
+  static typename Ops::Vec forward(typename Ops::Vec x) {
+    return Ops::select(Ops::greater(x, Ops::set(0.0f)), x,
+                       Ops::mul(x, Ops::set(LEAKY_RELU_SLOPE)));
+  }
+  template <typename Ops>
+  static typename Ops::Vec derivative(typename Ops::Vec x) {
+    return Ops::select(Ops::greater(x, Ops::set(0.0f)), Ops::set(1.0f),
+                       Ops::set(LEAKY_RELU_SLOPE));
+  }
+};
+
+struct Sigmoid {
+  template <typename Ops>
+  static typename Ops::Vec forward(typename Ops::Vec x) {
+    return sigmoidApprox<Ops>(x);
+  }
+  template <typename Ops>
+  static typename Ops::Vec derivative(typename Ops::Vec x) {
+    typename Ops::Vec s = sigmoidApprox<Ops>(x);
+    return Ops::mul(s, Ops::sub(Ops::set(1.0f), s));
+  }
+};
+
+// tanh(x) = 2 * sigmoid(2x) - 1
+struct Tanh {
+  template <typename Ops>
+  static typename Ops::Vec forward(typename Ops::Vec x) {
+    typename Ops::Vec s = sigmoidApprox<Ops>(Ops::add(x, x));
+    return Ops::fmadd(s, Ops::set(2.0f), Ops::set(-1.0f));
+  }
+  template <typename Ops>
+  static typename Ops::Vec derivative(typename Ops::Vec x) {
+    typename Ops::Vec t = forward<Ops>(x);
+    return Ops::sub(Ops::set(1.0f), Ops::mul(t, t));
+  }
+};
+
+// 0.5 * x * (1 + tanh(u)) is x * sigmoid(2u), with u = sqrt(2 / pi) * (x + 0.044715 * x^3)
+struct Gelu {
+  static constexpr float TWO_K0 = 2.0f * 0.7978845608f;
+  static constexpr float K1 = 0.044715f;
+  template <typename Ops>
+  static typename Ops::Vec twoU(typename Ops::Vec x) {
+    typename Ops::Vec x2 = Ops::mul(x, x);
+    typename Ops::Vec inner = Ops::fmadd(Ops::mul(x2, Ops::set(K1)), x, x);
+    return Ops::mul(inner, Ops::set(TWO_K0));
+  }
+  template <typename Ops>
+  static typename Ops::Vec forward(typename Ops::Vec x) {
+    return Ops::mul(x, sigmoidApprox<Ops>(twoU<Ops>(x)));
+  }
+  // s + x * s * (1 - s) * 2u'
+  template <typename Ops>
+  static typename Ops::Vec derivative(typename Ops::Vec x) {
+    typename Ops::Vec s = sigmoidApprox<Ops>(twoU<Ops>(x));
+    typename Ops::Vec x2 = Ops::mul(x, x);
+    typename Ops::Vec twoDu =
+        Ops::mul(Ops::fmadd(x2, Ops::set(3.0f * K1), Ops::set(1.0f)), Ops::set(TWO_K0));
+    typename Ops::Vec ds = Ops::mul(s, Ops::sub(Ops::set(1.0f), s));
+    return Ops::fmadd(Ops::mul(x, ds), twoDu, s);
+  }
+};
+
+template <typename F>
+void mapForward(const float* in, float* out, int n) {
+  using V = NativeOps;
+  int i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    V::store(out + i, F::template forward<V>(V::load(in + i)));
+  }
+  for (; i < n; i++) {
+    out[i] = F::template forward<ScalarOps>(in[i]);
+  }
+}
+
+template <typename F>
+void mapDerivative(const float* preActivations, const float* upstream, float* out, int n) {
+  using V = NativeOps;
+  int i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    typename V::Vec d = F::template derivative<V>(V::load(preActivations + i));
+    V::store(out + i, V::mul(V::load(upstream + i), d));
+  }
+  for (; i < n; i++) {
+    out[i] = upstream[i] * F::template derivative<ScalarOps>(preActivations[i]);
+  }
+}
+
+} // namespace
+
+void applyActivation(ActivationFunction function, const float* in, float* out, int n) {
+  switch (function) {
+  case RELU:
+    mapForward<Relu>(in, out, n);
+    break;
+  case SIGMOID:
+    mapForward<Sigmoid>(in, out, n);
+    break;
+  case TANH:
+    mapForward<Tanh>(in, out, n);
+    break;
+  case LEAKY_RELU:
+    mapForward<LeakyRelu>(in, out, n);
+    break;
+  case GELU:
+    mapForward<Gelu>(in, out, n);
+    break;
+  default:
+    if (in != out) {
+      std::copy(in, in + n, out);
+    }
+    break;
+  }
+}
+
+void applyActivationDerivative(ActivationFunction function, const float* preActivations,
+                               const float* upstream, float* out, int n) {
+  switch (function) {
+  case RELU:
+    mapDerivative<Relu>(preActivations, upstream, out, n);
+    break;
+  case SIGMOID:
+    mapDerivative<Sigmoid>(preActivations, upstream, out, n);
+    break;
+  case TANH:
+    mapDerivative<Tanh>(preActivations, upstream, out, n);
+    break;
+  case LEAKY_RELU:
+    mapDerivative<LeakyRelu>(preActivations, upstream, out, n);
+    break;
+  case GELU:
+    mapDerivative<Gelu>(preActivations, upstream, out, n);
+    break;
+  default:
+    if (upstream != out) {
+      std::copy(upstream, upstream + n, out);
+    }
+    break;
+  }
+}
+
+void softmax(const float* in, float* out, int n) {
+  using V = NativeOps;
+  using Vec = typename V::Vec;
+  // Each lane keeps its own running max and sum, merged at the end
+  Vec laneMax = V::set(-FLT_MAX);
+  Vec laneSum = V::set(0.0f);
+  int i = 0;
+  for (; i + V::width <= n; i += V::width) {
+    Vec x = V::load(in + i);
+    Vec newMax = V::max(laneMax, x);
+    laneSum = V::fmadd(laneSum, expApprox<V>(V::sub(laneMax, newMax)),
+                       expApprox<V>(V::sub(x, newMax)));
+    laneMax = newMax;
+  }
+  alignas(64) float maxes[V::width];
+  alignas(64) float sums[V::width];
+  V::store(maxes, laneMax);
+  V::store(sums, laneSum);
+  float maxVal = -FLT_MAX;
+  for (int l = 0; l < V::width; l++) {
+    maxVal = std::max(maxVal, maxes[l]);
+  }
+  for (int j = i; j < n; j++) {
+    maxVal = std::max(maxVal, in[j]);
+  }
+  float sum = 0.0f;
+  for (int l = 0; l < V::width; l++) {
+    sum += sums[l] * expApprox<ScalarOps>(maxes[l] - maxVal);
+  }
+  for (int j = i; j < n; j++) {
+    sum += expApprox<ScalarOps>(in[j] - maxVal);
+  }
+  Vec shift = V::set(maxVal);
+  Vec scale = V::set(1.0f / sum);
+  int j = 0;
+  for (; j + V::width <= n; j += V::width) {
+    V::store(out + j, V::mul(expApprox<V>(V::sub(V::load(in + j), shift)), scale));
+  }
+  for (; j < n; j++) {
+    out[j] = expApprox<ScalarOps>(in[j] - maxVal) / sum;
+  }
+}
+
+const char* vectorMathIsa() {
+  return NATIVE_ISA;
+}
@@ -0,0 +1,306 @@
+#include <Gemm.hpp>
+#include <Winograd.hpp>
+#include <algorithm>
+#include <omp.h>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Transform matrices from Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks"
+template <int M>
+struct WinogradTransform;
+
+template <>
+struct WinogradTransform<2> {
+  static constexpr int ALPHA = 4;
+  static constexpr float BT[4][4] = {
+      {1, 0, -1, 0}, {0, 1, 1, 0}, {0, -1, 1, 0}, {0, 1, 0, -1}};
+  static constexpr float G[4][3] = {{1, 0, 0}, {0.5f, 0.5f, 0.5f}, {0.5f, -0.5f, 0.5f}, {0, 0, 1}};
+  static constexpr float AT[2][4] = {{1, 1, 1, 0}, {0, 1, -1, -1}};
+};
+
+template <>
+struct WinogradTransform<4> {
+  static constexpr int ALPHA = 6;
+  static constexpr float BT[6][6] = {
+      {4, 0, -5, 0, 1, 0},  {0, -4, -4, 1, 1, 0}, {0, 4, -4, -1, 1, 0},
+      {0, -2, -1, 2, 1, 0}, {0, 2, -1, -2, 1, 0}, {0, 4, 0, -5, 0, 1}};
+  static constexpr float G[6][3] = {{1.0f / 4, 0, 0},
+                                    {-1.0f / 6, -1.0f / 6, -1.0f / 6},
+                                    {-1.0f / 6, 1.0f / 6, -1.0f / 6},
+                                    {1.0f / 24, 1.0f / 12, 1.0f / 6},
+                                    {1.0f / 24, -1.0f / 12, 1.0f / 6},
+                                    {0, 0, 1}};
+  static constexpr float AT[4][6] = {
+      {1, 1, 1, 1, 1, 0}, {0, 1, -1, 2, -2, 0}, {0, 1, 1, 4, 4, 0}, {0, 1, -1, 8, -8, 1}};
+};
+
+int tilesAlong(int outSize, int m) {
+  return (outSize + m - 1) / m;
+}
+
+bool worthParallel(size_t work) {
+  return work >= 64 * 64 * 64 && omp_get_max_threads() > 1;
+}
+
+// U = G g G^T, written with a stride of count * depth between its elements so the result
+// lands in one (alpha x alpha) slice per element
+template <int M>
+void transformFilter(const float g[3][3], float* dst, size_t stride) {
+  using T = WinogradTransform<M>;
+  constexpr int A = T::ALPHA;
+  float tmp[A][3];
+  for (int i = 0; i < A; i++) {
+    for (int j = 0; j < 3; j++) {
+      tmp[i][j] = T::G[i][0] * g[0][j] + T::G[i][1] * g[1][j] + T::G[i][2] * g[2][j];
+    }
+  }
+  for (int i = 0; i < A; i++) {
+    for (int j = 0; j < A; j++) {
+      dst[(i * A + j) * stride] = tmp[i][0] * T::G[j][0] + tmp[i][1] * T::G[j][1] +
+                                  tmp[i][2] * T::G[j][2];
+    }
+  }
+}
+
+template <int M>
+void transformFilters(const float* flat, int depth, int count, bool flip, float* transformed) {
+  size_t stride = (size_t)depth * count;
+  for (int f = 0; f < count; f++) {
+    for (int c = 0; c < depth; c++) {
+      float g[3][3];
+      for (int ky = 0; ky < 3; ky++) {
+        for (int kx = 0; kx < 3; kx++) {
+          int y = flip ? 2 - ky : ky;
+          int x = flip ? 2 - kx : kx;
+          g[ky][kx] = flat[(size_t)(c * 9 + y * 3 + x) * count + f];
+        }
+      }
+      // Each slice is an outChannels x inChannels matrix
+      size_t offset = flip ? (size_t)c * count + f : (size_t)f * depth + c;
+      transformFilter<M>(g, transformed + offset, stride);
+    }
+  }
+}
+
+// Scratch rows of the separable transforms, kept per thread so steady state calls don't
+// allocate
+thread_local std::vector<float> scratch;
+
+float* scratchFor(size_t size) {
+  if (scratch.size() < size) {
+    scratch.resize(size);
+  }
+  return scratch.data();
+}
+
+// dst[t] = sum_k coefs[k] * src[k * srcStride + t] for t < n, skipping zero coefficients.
+// Vectorized across t.
+template <int K>
+void combine(const float* coefs, const float* src, size_t srcStride, int n, float init,
+             float* dst) {
+  std::fill(dst, dst + n, init);
+  for (int k = 0; k < K; k++) {
+    float coef = coefs[k];
+    if (coef == 0.0f) {
+      continue;
+    }
+    const float* row = src + k * srcStride;
+#pragma omp simd
+    for (int t = 0; t < n; t++) {
+      dst[t] += coef * row[t];
+    }
+  }
+}
+
+// Rows of tiles transformed together, about 64 tiles so the scratch stays in L1
+int chunkRows(int tilesW) {
+  return std::max(1, 64 / tilesW);
+}
+
+// V = B^T d B for every tile of every channel, stored as alpha^2 slices of
+// inChannels x tiles matrices. Tiles hanging over the input edge read zeros. A chunk of tiles
+// is first gathered as d[i][j][tile] so both products run across all of them at once.
+template <int M>
+void transformInput(const float* in, int channels, int inW, int inH, int tilesW, int tilesH,
+                    float* v) {
+  using T = WinogradTransform<M>;
+  constexpr int A = T::ALPHA;
+  int tiles = tilesW * tilesH;
+  int rows = chunkRows(tilesW);
+  int chunks = (tilesH + rows - 1) / rows;
+  bool parallel = worthParallel((size_t)channels * tiles * A * A);
+#pragma omp parallel for collapse(2) schedule(static) if (parallel)
+  for (int c = 0; c < channels; c++) {
+    for (int chunk = 0; chunk < chunks; chunk++) {
+      int ty0 = chunk * rows;
+      int ty1 = std::min(tilesH, ty0 + rows);
+      int n = (ty1 - ty0) * tilesW;
+      float* d = scratchFor((size_t)2 * A * A * n);
+      float* r = d + (size_t)A * A * n;
+      for (int ty = ty0; ty < ty1; ty++) {
+        for (int i = 0; i < A; i++) {
+          int y = ty * M + i;
+          float* dst = d + (size_t)i * A * n + (ty - ty0) * tilesW;
+          for (int j = 0; j < A; j++) {
+            float* dj = dst + (size_t)j * n;
+            // Tiles whose pixel (i, j) is still inside the input
+            int inside = y < inH ? std::min(tilesW, (inW - j + M - 1) / M) : 0;
+            const float* src = in + ((size_t)c * inH + y) * inW + j;
+            for (int tx = 0; tx < inside; tx++) {
+              dj[tx] = src[tx * M];
+            }
+            std::fill(dj + inside, dj + tilesW, 0.0f);
+          }
+        }
+      }
+      // r[i][jp] = (d B)[i][jp], then v[ip][jp] = (B^T r)[ip][jp]
+      for (int i = 0; i < A; i++) {
+        for (int jp = 0; jp < A; jp++) {
+          combine<A>(T::BT[jp], d + (size_t)i * A * n, n, n, 0.0f,
+                     r + (size_t)(i * A + jp) * n);
+        }
+      }
+      for (int ip = 0; ip < A; ip++) {
+        for (int jp = 0; jp < A; jp++) {
+          combine<A>(T::BT[ip], r + (size_t)jp * n, (size_t)A * n, n, 0.0f,
+                     v + ((size_t)(ip * A + jp) * channels + c) * tiles + ty0 * tilesW);
+        }
+      }
+    }
+  }
+}
+
+// Y = A^T m A for every tile of every output channel, dropping pixels past the output edge.
+// The tiles of a channel are contiguous in m, so both products run across a chunk of them.
+template <int M>
+void transformOutput(const float* m, int channels, int outW, int outH, int tilesW, int tilesH,
+                     const float* bias, float* out) {
+  using T = WinogradTransform<M>;
+  constexpr int A = T::ALPHA;
+  int tiles = tilesW * tilesH;
+  size_t slice = (size_t)channels * tiles;
+  int rows = chunkRows(tilesW);
+  int chunks = (tilesH + rows - 1) / rows;
+  bool parallel = worthParallel(slice * A * A);
+#pragma omp parallel for collapse(2) schedule(static) if (parallel)
+  for (int f = 0; f < channels; f++) {
+    for (int chunk = 0; chunk < chunks; chunk++) {
+      int ty0 = chunk * rows;
+      int ty1 = std::min(tilesH, ty0 + rows);
+      int n = (ty1 - ty0) * tilesW;
+      float* s = scratchFor((size_t)(M * A + M * M) * n);
+      float* y = s + (size_t)M * A * n;
+      const float* src = m + (size_t)f * tiles + ty0 * tilesW;
+      // s[ip][j] = (A^T m)[ip][j], then y[ip][jp] = (s A)[ip][jp] + bias
+      for (int ip = 0; ip < M; ip++) {
+        for (int j = 0; j < A; j++) {
+          combine<A>(T::AT[ip], src + (size_t)j * slice, A * slice, n, 0.0f,
+                     s + (size_t)(ip * A + j) * n);
+        }
+      }
+      float b = bias != nullptr ? bias[f] : 0.0f;
+      for (int ip = 0; ip < M; ip++) {
+        for (int jp = 0; jp < M; jp++) {
+          combine<A>(T::AT[jp], s + (size_t)ip * A * n, n, n, b, y + (size_t)(ip * M + jp) * n);
+        }
+      }
+      for (int ty = ty0; ty < ty1; ty++) {
+        for (int ip = 0; ip < M && ty * M + ip < outH; ip++) {
+          float* row = out + ((size_t)f * outH + ty * M + ip) * outW;
+          const float* yRow = y + (size_t)ip * M * n + (ty - ty0) * tilesW;
+          for (int tx = 0; tx < tilesW; tx++) {
+            // Pixels of the last tile column may fall past the output edge
+            int width = std::min(M, outW - tx * M);
+            for (int jp = 0; jp < width; jp++) {
+              row[tx * M + jp] = yRow[(size_t)jp * n + tx];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <int M>
+void convolve(const float* in, int inChannels, int inW, int inH, const float* transformed,
+              int outChannels, const float* bias, float* out, float* workspace) {
+  constexpr int A = WinogradTransform<M>::ALPHA;
+  int outW = inW - 2;
+  int outH = inH - 2;
+  int tilesW = tilesAlong(outW, M);
+  int tilesH = tilesAlong(outH, M);
+  int tiles = tilesW * tilesH;
+  float* v = workspace;
+  float* m = workspace + (size_t)A * A * inChannels * tiles;
+  transformInput<M>(in, inChannels, inW, inH, tilesW, tilesH, v);
+  // One GEMM per transformed element: (outChannels x inChannels) * (inChannels x tiles).
+  // Small ones are cheaper as plain loops than through sgemm's packing.
+  if ((size_t)inChannels * outChannels >= 32 * 32) {
+    for (int e = 0; e < A * A; e++) {
+      sgemm(false, false, outChannels, tiles, inChannels,
+            transformed + (size_t)e * outChannels * inChannels, inChannels,
+            v + (size_t)e * inChannels * tiles, tiles, m + (size_t)e * outChannels * tiles,
+            tiles);
+    }
+  } else {
+    bool parallel = worthParallel((size_t)A * A * outChannels * inChannels * tiles);
+#pragma omp parallel for collapse(2) schedule(static) if (parallel)
+    for (int e = 0; e < A * A; e++) {
+      for (int f = 0; f < outChannels; f++) {
+        const float* u = transformed + ((size_t)e * outChannels + f) * inChannels;
+        float* dst = m + ((size_t)e * outChannels + f) * tiles;
+        std::fill(dst, dst + tiles, 0.0f);
+        for (int c = 0; c < inChannels; c++) {
+          const float* src = v + ((size_t)e * inChannels + c) * tiles;
+          for (int t = 0; t < tiles; t++) {
+            dst[t] += u[c] * src[t];
+          }
+        }
+      }
+    }
+  }
+  transformOutput<M>(m, outChannels, outW, outH, tilesW, tilesH, bias, out);
+}
+
+int alphaFor(int m) {
+  if (m == 2) {
+    return WinogradTransform<2>::ALPHA;
+  }
+  if (m == 4) {
+    return WinogradTransform<4>::ALPHA;
+  }
+  throw std::invalid_argument("Winograd tile size must be 2 or 4");
+}
+
+} // namespace
+
+size_t winogradFilterSize(int depth, int count, int m) {
+  int alpha = alphaFor(m);
+  return (size_t)alpha * alpha * depth * count;
+}
+
+void winogradTransformFilters(const float* flat, int depth, int count, int m, bool flip,
+                              float* transformed) {
+  if (alphaFor(m) == WinogradTransform<2>::ALPHA) {
+    transformFilters<2>(flat, depth, count, flip, transformed);
+  } else {
+    transformFilters<4>(flat, depth, count, flip, transformed);
+  }
+}
+
+size_t winogradWorkspaceSize(int inChannels, int outChannels, int inW, int inH, int m) {
+  int alpha = alphaFor(m);
+  size_t tiles = (size_t)tilesAlong(inW - 2, m) * tilesAlong(inH - 2, m);
+  return (size_t)alpha * alpha * (inChannels + outChannels) * tiles;
+}
+
+void winogradConv(const float* in, int inChannels, int inW, int inH, const float* transformed,
+                  int outChannels, const float* bias, int m, float* out, float* workspace) {
+  if (alphaFor(m) == WinogradTransform<2>::ALPHA) {
+    convolve<2>(in, inChannels, inW, inH, transformed, outChannels, bias, out, workspace);
+  } else {
+    convolve<4>(in, inChannels, inW, inH, transformed, outChannels, bias, out, workspace);
+  }
+}
\ No newline at end of file
@@ -1,130 +1,111 @@
+#include <AllocationCounter.hpp>
+#include <BatchPipeline.hpp>
 #include <Canvas.hpp>
+#include <Checkpointer.hpp>
 #include <ConvolutionalLayer.hpp>
+#include <Dataset.hpp>
 #include <DenseLayer.hpp>
 #include <FlattenLayer.hpp>
 #include <GAP.hpp>
+#include <MatReader.hpp>
 #include <MaxPoolLayer.hpp>
 #include <Network.hpp>
+#include <Optimizer.hpp>
+#include <RingAllreduce.hpp>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_rect.h>
 #include <SDL3/SDL_render.h>
 #include <SDL3/SDL_video.h>
+#include <ShuffleBuffer.hpp>
 #include <Tensor3.hpp>
+#include <Tensor4.hpp>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <cstdint>
+#include <future>
 #include <iomanip>
 #include <iostream>
-#include <matio.h>
+#include <memory>
+#include <numeric>
+#include <omp.h>
 #include <random>
+#include <sstream>
+#include <stdexcept>
 #include <vector>
 
-void load_data(std::string path, std::vector<Tensor3<float>>& images,
-               std::vector<Tensor3<float>>& labels) {
-  mat_t* dataset = Mat_Open(path.c_str(), MAT_ACC_RDONLY);
-  if (!dataset) {
-    std::cerr << "Couldn't open the file" << std::endl;
-    return;
+// Reads a whole .mat file a few thousand samples at a time, so the only full copy of the
+// data is the dataset's bytes
+void load_data(std::string path, Dataset& samples) {
+  MatReader reader(path);
+  std::cout << "Data dimensions: " << reader.getImageSize() << " x " << reader.getSize()
+            << std::endl;
+  if (reader.getImageSize() != 28 * 28) {
+    throw std::runtime_error("Expected 28 x 28 images");
   }
-  matvar_t* dataVar = Mat_VarRead(dataset, "data");
-  if (!dataVar) {
-    std::cerr << "Cannot find variable 'data'\n";
-    Mat_Close(dataset);
-    return;
-  }
-
-  if (!dataVar->data) {
-    std::cerr << "Data variable has no data\n";
-    Mat_VarFree(dataVar);
-    Mat_Close(dataset);
-    return;
-  }
-
-  size_t rows = dataVar->dims[0]; // 784
-  size_t cols = dataVar->dims[1]; // 70000
-
-  std::cout << "Data dimensions: " << rows << " x " << cols << std::endl;
-  std::cout << "Data class type: " << dataVar->class_type << std::endl;
-
-  images = std::vector<Tensor3<float>>(cols, Tensor3<float>(28, 28, 1));
-
-  // Handle different data types
-  if (dataVar->class_type == MAT_C_DOUBLE) {
-    double* data = static_cast<double*>(dataVar->data);
-
-    // Some MNIST .mat files store pixels as double in [0,255].
-    // Detect that case and normalize to [0,1] to avoid sigmoid saturation.
-    double maxPixel = 0.0;
-    for (size_t idx = 0; idx < rows * cols; ++idx) {
-      if (data[idx] > maxPixel) {
-        maxPixel = data[idx];
-      }
-    }
-    const double scale = (maxPixel > 1.0) ? 255.0 : 1.0;
-
-    for (size_t c = 0; c < cols; ++c)
-      for (size_t r = 0; r < rows; ++r)
-        images[c].setValue(r % 28, r / 28, 0, static_cast<float>(data[r + c * rows] / scale));
-  } else if (dataVar->class_type == MAT_C_UINT8) {
-    uint8_t* data = static_cast<uint8_t*>(dataVar->data);
-    for (size_t c = 0; c < cols; ++c)
-      for (size_t r = 0; r < rows; ++r)
-        images[c].setValue(r % 28, r / 28, 0,
-                           static_cast<float>(data[r + c * rows]) / 255.0f); // Normalize to [0, 1]
-  } else {
-    std::cerr << "Unsupported data type: " << dataVar->class_type << std::endl;
-    Mat_VarFree(dataVar);
-    Mat_Close(dataset);
-    return;
+  samples = Dataset(reader.getSize(), 28, 28, 1, 10);
+  for (int first = 0; first < reader.getSize(); first += 4096) {
+    reader.read(first, std::min(4096, reader.getSize() - first), samples, first);
   }
+}
 
-  Mat_VarFree(dataVar);
+struct TrainOptions {
+  std::string savePath = "mnist_cnn_weights.bin";
+  // Samples per weight update, the gradient is averaged over each mini-batch
+  int batchSize = 1;
+  // Hogwild training: threads step the shared weights without waiting for each other
+  bool async = false;
+  // Multi-process training: workers processes split every batch, this one is rank. They
+  // talk over Unix sockets at ringPath-<rank>, or TCP when ringHosts lists host:port per rank.
+  int workers = 1;
+  int rank = 0;
+  std::string ringPath = "/tmp/cnn-ring";
+  std::vector<std::string> ringHosts;
+  // sgd, momentum, nesterov, adam or adamw. A learning rate or weight decay below 0 picks
+  // the usual one for the optimizer.
+  std::string optimizer = "sgd";
+  float learningRate = -1.0f;
+  float momentum = 0.9f;
+  float weightDecay = -1.0f;
+  // Threads assembling and augmenting batches ahead of the training loop
+  int loaderThreads = 2;
+  // IDX label file, for training on IDX images
+  std::string labelPath;
+  // Samples a .mat file is shuffled through when it is streamed instead of loaded whole
+  int streamWindow = 0;
+  // Checkpoint written every checkpointEvery batches and at the end of every epoch, and one
+  // to continue from. Every rank of a multi-process run resumes from the same checkpoint.
+  std::string checkpointPath;
+  int checkpointEvery = 500;
+  std::string resumePath;
+};
 
-  /* -------- Read labels -------- */
-  matvar_t* labelVar = Mat_VarRead(dataset, "label");
-  if (!labelVar) {
-    std::cerr << "Cannot find variable 'label'\n";
-    Mat_Close(dataset);
-    return;
+// Null for an unknown optimizer name
+Optimizer* makeOptimizer(const TrainOptions& options) {
+  bool adam = options.optimizer == "adam" || options.optimizer == "adamw";
+  float rate = options.learningRate >= 0.0f ? options.learningRate : adam ? 0.001f : 0.01f;
+  if (options.optimizer == "sgd") {
+    return new SgdOptimizer(rate);
   }
-
-  if (!labelVar->data) {
-    std::cerr << "Label variable has no data\n";
-    Mat_VarFree(labelVar);
-    Mat_Close(dataset);
-    return;
+  if (options.optimizer == "momentum" || options.optimizer == "nesterov") {
+    return new SgdOptimizer(rate, options.momentum, options.optimizer == "nesterov");
   }
-
-  labels = std::vector<Tensor3<float>>(cols, Tensor3<float>(10, 1, 1));
-
-  if (labelVar->class_type == MAT_C_DOUBLE) {
-    double* labels_raw = static_cast<double*>(labelVar->data);
-    for (size_t i = 0; i < cols; ++i)
-      labels[i].setValue(static_cast<int>(labels_raw[i]), 0, 0, 1);
-  } else if (labelVar->class_type == MAT_C_UINT8) {
-    uint8_t* labels_raw = static_cast<uint8_t*>(labelVar->data);
-    for (size_t i = 0; i < cols; ++i)
-      labels[i].setValue(static_cast<int>(labels_raw[i]), 0, 0, 1);
-  } else if (labelVar->class_type == MAT_C_SINGLE) {
-    float* labels_raw = static_cast<float*>(labelVar->data);
-    for (size_t i = 0; i < cols; ++i)
-      labels[i].setValue(static_cast<int>(labels_raw[i]), 0, 0, 1);
-  } else {
-    std::cerr << "Unsupported label type: " << labelVar->class_type << std::endl;
+  if (adam) {
+    bool decoupled = options.optimizer == "adamw";
+    float decay = options.weightDecay >= 0.0f ? options.weightDecay : decoupled ? 0.01f : 0.0f;
+    return new AdamOptimizer(rate, 0.9f, 0.999f, 1e-8f, decay, decoupled);
   }
-  Mat_VarFree(labelVar);
-  Mat_Close(dataset);
+  return nullptr;
 }
 
-struct TrainItem {
-  Tensor3<float> image;
-  Tensor3<float> label;
-};
-
-void train_mode(Network& net, const std::vector<Tensor3<float>>& images,
-                const std::vector<Tensor3<float>>& labels, std::string savePath);
+// Trains on samples in memory, or on samples streamed through stream when samples is null
+void train_mode(Network& net, const Dataset* samples, ShuffleBuffer* stream,
+                const TrainOptions& options);
 void test_mode(Network& net);
 
-Tensor3<float> augment(const Tensor3<float>& src, std::mt19937& rng) {
+// Writes a randomly shifted and zoomed copy of src to out, a 28 x 28 image scaled to [0, 1]
+void augment(const uint8_t* src, std::mt19937& rng, float* out) {
   std::uniform_int_distribution<int> shift_dist(-2, 2);
   std::uniform_real_distribution<float> zoom_dist(0.9f, 1.1f);
 
@@ -132,7 +113,6 @@ Tensor3<float> augment(const Tensor3<float>& src, std::mt19937& rng) {
   int dy = shift_dist(rng);
   float scale = zoom_dist(rng);
 
-  Tensor3<float> out(28, 28, 1);
   float cx = 13.5f, cy = 13.5f;
 
   for (int y = 0; y < 28; y++) {
@@ -144,61 +124,228 @@ Tensor3<float> augment(const Tensor3<float>& src, std::mt19937& rng) {
       int iy = static_cast<int>(std::round(sy));
 
       if (ix >= 0 && ix < 28 && iy >= 0 && iy < 28)
-        out.setValue(x, y, 0, const_cast<Tensor3<float>&>(src).getValue(ix, iy, 0));
+        out[y * 28 + x] = src[iy * 28 + ix] * (1.0f / 255.0f);
+      else
+        out[y * 28 + x] = 0.0f;
     }
   }
-  return out;
-}
-
-std::vector<TrainItem> augment_dataset(const std::vector<TrainItem>& trainItem, std::mt19937& rng) {
-  std::vector<TrainItem> augmented;
-  for (const auto& item : trainItem) {
-    augmented.push_back({augment(item.image, rng), item.label});
-  }
-  return augmented;
 }
 
 int main(int argc, char* argv[]) {
 
   Network net = Network();
 
-  // --test (path to .bin file) or --train(path to .mat file)
+  // --test (path to .bin file), --train (path to .mat or dataset file) or --convert
   if (argc < 2) {
-    std::cerr << "Usage: " << argv[0] << " --train <path_to_mat_file> -O <path_to_save_weights> OR "
-              << argv[0] << " --test <path_to_bin_file>" << std::endl;
+    std::cerr << "Usage: " << argv[0]
+              << " --train <path_to_mat_or_dataset_file> [-O <path_to_save_weights>]"
+              << " [--batch-size N] [--threads N] [--async] [--workers N --rank R [--ring-path P]"
+              << " [--ring-hosts host:port,...]] [--optimizer sgd|momentum|nesterov|adam|adamw]"
+              << " [--lr X] [--momentum X] [--weight-decay X] [--loader-threads N]"
+              << " [--labels <idx_label_file>] [--stream-window N] [--checkpoint <path>"
+              << " [--checkpoint-every N]] [--resume <checkpoint>] OR " << argv[0]
+              << " --test <path_to_bin_file>"
+              << " OR " << argv[0] << " --convert <path_to_mat_file> <path_to_dataset>"
+              << std::endl;
     return 1;
   }
   std::string mode = argv[1];
   if (mode == "--train") {
     if (argc < 3) {
-      std::cerr << "No .mat specified" << std::endl;
+      std::cerr << "No dataset specified" << std::endl;
       return 1;
     }
-    std::vector<Tensor3<float>> images, labels;
-    load_data(argv[2], images, labels);
-    std::string savePath = "mnist_cnn_weights.bin";
-    if (argc > 4 && std::string(argv[3]) == "-O") {
-      savePath = argv[4];
+    TrainOptions options;
+    // Threads a mini-batch is split over, every sample of a batch of one runs on one thread
+    int threads = omp_get_max_threads();
+    for (int i = 3; i < argc; i++) {
+      std::string option = argv[i];
+      if (option == "--async") {
+        options.async = true;
+        continue;
+      }
+      if (i + 1 >= argc) {
+        std::cerr << "Missing value for " << option << std::endl;
+        return 1;
+      }
+      std::string value = argv[++i];
+      if (option == "-O") {
+        options.savePath = value;
+      } else if (option == "--batch-size") {
+        options.batchSize = std::atoi(value.c_str());
+        if (options.batchSize < 1) {
+          std::cerr << "Batch size must be a positive integer" << std::endl;
+          return 1;
+        }
+      } else if (option == "--workers") {
+        options.workers = std::atoi(value.c_str());
+      } else if (option == "--rank") {
+        options.rank = std::atoi(value.c_str());
+      } else if (option == "--ring-path") {
+        options.ringPath = value;
+      } else if (option == "--ring-hosts") {
+        std::stringstream hosts(value);
+        std::string host;
+        while (std::getline(hosts, host, ',')) {
+          options.ringHosts.push_back(host);
+        }
+      } else if (option == "--optimizer") {
+        options.optimizer = value;
+      } else if (option == "--lr") {
+        options.learningRate = std::atof(value.c_str());
+      } else if (option == "--momentum") {
+        options.momentum = std::atof(value.c_str());
+      } else if (option == "--weight-decay") {
+        options.weightDecay = std::atof(value.c_str());
+      } else if (option == "--loader-threads") {
+        options.loaderThreads = std::atoi(value.c_str());
+        if (options.loaderThreads < 1) {
+          std::cerr << "Loader thread count must be a positive integer" << std::endl;
+          return 1;
+        }
+      } else if (option == "--labels") {
+        options.labelPath = value;
+      } else if (option == "--stream-window") {
+        options.streamWindow = std::atoi(value.c_str());
+        if (options.streamWindow < 1) {
+          std::cerr << "Stream window must be a positive integer" << std::endl;
+          return 1;
+        }
+      } else if (option == "--checkpoint") {
+        options.checkpointPath = value;
+      } else if (option == "--checkpoint-every") {
+        options.checkpointEvery = std::atoi(value.c_str());
+        if (options.checkpointEvery < 1) {
+          std::cerr << "Checkpoint interval must be a positive integer" << std::endl;
+          return 1;
+        }
+      } else if (option == "--resume") {
+        options.resumePath = value;
+      } else if (option == "--threads") {
+        threads = std::atoi(value.c_str());
+        if (threads < 1) {
+          std::cerr << "Thread count must be a positive integer" << std::endl;
+          return 1;
+        }
+      } else {
+        std::cerr << "Unknown option: " << option << std::endl;
+        return 1;
+      }
+    }
+    if (options.workers < 1 || options.rank < 0 || options.rank >= options.workers) {
+      std::cerr << "Rank must be between 0 and the number of workers" << std::endl;
+      return 1;
+    }
+    if (options.workers > 1 && options.async) {
+      std::cerr << "--async can't be combined with --workers" << std::endl;
+      return 1;
+    }
+    if (options.async && options.optimizer != "sgd") {
+      std::cerr << "--async only trains with plain SGD" << std::endl;
+      return 1;
+    }
+    try {
+      Optimizer* optimizer = makeOptimizer(options);
+      if (optimizer == nullptr) {
+        std::cerr << "Unknown optimizer: " << options.optimizer << std::endl;
+        return 1;
+      }
+      net.setOptimizer(optimizer);
+    } catch (const std::invalid_argument& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    // .mat files are decoded, or streamed with --stream-window, anything else is mapped as a
+    // dataset file or IDX images
+    std::string path = argv[2];
+    Dataset samples;
+    std::unique_ptr<MatReader> reader;
+    std::unique_ptr<ShuffleBuffer> stream;
+    auto loadStart = std::chrono::high_resolution_clock::now();
+    try {
+      if (options.streamWindow > 0) {
+        if (!path.ends_with(".mat")) {
+          std::cerr << "--stream-window needs a .mat file" << std::endl;
+          return 1;
+        }
+        reader = std::make_unique<MatReader>(path);
+        if (reader->getImageSize() != 28 * 28) {
+          std::cerr << "The network trains on 28 x 28 grayscale images" << std::endl;
+          return 1;
+        }
+        // Every fifth sample is held out for testing
+        stream = std::make_unique<ShuffleBuffer>(*reader, 10, options.streamWindow, 1024, 5);
+      } else if (path.ends_with(".mat")) {
+        load_data(path, samples);
+      } else {
+        samples = Dataset::open(path, options.labelPath);
+      }
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
     }
-    train_mode(net, images, labels, savePath);
+    std::chrono::duration<double> loadTime = std::chrono::high_resolution_clock::now() - loadStart;
+    if (stream) {
+      std::cout << "Streaming " << reader->getSize() << " samples through a window of "
+                << options.streamWindow << std::endl;
+    } else {
+      if (samples.getSize() == 0) {
+        std::cerr << "No samples loaded" << std::endl;
+        return 1;
+      }
+      if (samples.getWidth() != 28 || samples.getHeight() != 28 || samples.getChannels() != 1 ||
+          samples.getClasses() > 10) {
+        std::cerr << "The network trains on 28 x 28 grayscale images of up to 10 classes"
+                  << std::endl;
+        return 1;
+      }
+      std::cout << "Loaded " << samples.getSize() << " samples in " << loadTime.count() * 1000
+                << " ms" << std::endl;
+    }
+    net.setThreads(threads);
+    try {
+      train_mode(net, stream ? nullptr : &samples, stream.get(), options);
+    } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+
+  } else if (mode == "--convert") {
+    if (argc < 4) {
+      std::cerr << "Usage: " << argv[0] << " --convert <path_to_mat_file> <path_to_dataset>"
+                << std::endl;
+      return 1;
+    }
+    Dataset samples;
+    try {
+      load_data(argv[2], samples);
+      samples.save(argv[3]);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote " << samples.getSize() << " samples to " << argv[3] << std::endl;
 
   } else if (mode == "--test") {
     if (argc < 3) {
       std::cerr << "No .bin file specified" << std::endl;
       return 1;
     }
-    net.loadWeights(argv[2]);
+    if (!net.loadWeights(argv[2])) {
+      std::cerr << "Can't test without weights from " << argv[2] << std::endl;
+      return 1;
+    }
     test_mode(net);
   } else {
-    std::cerr << "Unknown mode: " << mode << ". Use --train or --test" << std::endl;
+    std::cerr << "Unknown mode: " << mode << ". Use --train, --test or --convert" << std::endl;
     return 1;
   }
 
   return 0;
 }
 
-void train_mode(Network& net, const std::vector<Tensor3<float>>& images,
-                const std::vector<Tensor3<float>>& labels, std::string savePath) {
+void train_mode(Network& net, const Dataset* samples, ShuffleBuffer* stream,
+                const TrainOptions& options) {
 
   net.addLayer(new ConvolutionalLayer(3, 1, 8));
   net.addLayer(new MaxPoolLayer(2, 8));
@@ -209,52 +356,236 @@ void train_mode(Network& net, const std::vector<Tensor3<float>>& images,
   net.addLayer(new DenseLayer(120, 84));
   net.addLayer(new DenseLayer(84, 10));
 
-  std::vector<TrainItem> samples;
-  for (size_t i = 0; i < images.size(); i++) {
-    samples.push_back({images[i], labels[i]});
+  // A resumed run takes the layers, optimizer state and seed of the checkpoint
+  Checkpointer::Position resume;
+  bool resuming = !options.resumePath.empty();
+  if (resuming) {
+    resume = Checkpointer::load(net, options.resumePath);
+    std::cout << "Resuming epoch " << resume.epoch + 1 << " at round " << resume.round
+              << ", sample " << resume.sample << std::endl;
   }
-  std::mt19937 rng(std::random_device{}());
-  std::shuffle(samples.begin(), samples.end(), rng);
-  std::vector<TrainItem> testData(samples.begin() + samples.size() * 0.8, samples.end());
-  std::vector<TrainItem> trainData(samples.begin(), samples.begin() + samples.size() * 0.8);
 
-  std::shuffle(trainData.begin(), trainData.end(), rng);
-  trainData = augment_dataset(trainData, rng);
+  // Every rank starts from rank 0's weights and shuffles with its seed, so all of them walk
+  // the same batches and take their own share of each
+  std::unique_ptr<RingAllreduce> ring;
+  unsigned seed = resuming ? resume.seed : std::random_device{}();
+  if (options.workers > 1) {
+    if (options.ringHosts.empty()) {
+      ring = std::make_unique<RingAllreduce>(options.rank, options.workers, options.ringPath);
+    } else {
+      ring = std::make_unique<RingAllreduce>(options.rank, options.workers, options.ringHosts);
+    }
+    net.setCommunicator(ring.get());
+    net.broadcastParameters();
+    ring->broadcast(&seed, sizeof(seed));
+  }
 
-  for (size_t epoch = 0; epoch < 10; epoch++) {
+  // The split and every epoch's shuffle are permutations of sample indices, the images stay
+  // where load_data put them
+  std::mt19937 rng(seed);
+  std::vector<int> trainIndices;
+  std::vector<int> permutation;
+  std::vector<int> testIndices;
+  int trainSize;
+  if (samples) {
+    std::vector<int> indices(samples->getSize());
+    std::iota(indices.begin(), indices.end(), 0);
+    std::shuffle(indices.begin(), indices.end(), rng);
+    trainSize = samples->getSize() * 0.8;
+    testIndices.assign(indices.begin() + trainSize, indices.end());
+    trainIndices.assign(indices.begin(), indices.begin() + trainSize);
+  } else {
+    trainSize = stream->getSize(false);
+  }
+  // The split is drawn again from the seed, the epochs continue from the generator state the
+  // resumed epoch started with
+  int firstEpoch = 0;
+  if (resuming) {
+    rng = resume.rng;
+    firstEpoch = resume.epoch;
+  }
+  // The weights are the same on every rank, rank 0 writes the checkpoints
+  std::unique_ptr<Checkpointer> checkpointer;
+  if (!options.checkpointPath.empty() && options.rank == 0) {
+    checkpointer = std::make_unique<Checkpointer>(options.checkpointPath);
+  }
+  int sinceCheckpoint = 0;
+
+  // Asynchronous training hands the threads 1000 samples at a time, which they split into
+  // mini-batches themselves. With several workers a batch is spread over all of them.
+  int chunk = options.async ? 1000 : options.batchSize * options.workers;
+  // An epoch is trained a round at a time, all of the samples in memory in one round.
+  // Streamed samples come in rounds of whole chunks, the next one read from the shuffle
+  // buffer in the background while the network trains on the current one.
+  int roundSize = std::max(1, 8192 / chunk) * chunk;
+  Dataset rounds[2];
+  if (stream) {
+    for (Dataset& round : rounds) {
+      round = Dataset(roundSize, 28, 28, 1, 10);
+    }
+  }
+  const Dataset* source = samples;
+
+  int classes = 10;
+  // Samples are augmented afresh from the originals while the batches are assembled, on
+  // threads of their own so the training loop never waits for a pass over the dataset
+  BatchPipeline pipeline(
+      [&source, classes](int index, std::mt19937& random, float* image, float* label) {
+        augment(source->getImage(index), random, image);
+        std::fill(label, label + classes, 0.0f);
+        label[source->getLabel(index)] = 1.0f;
+      },
+      28, 28, 1, classes, options.loaderThreads, std::max(4, 2 * options.loaderThreads));
+  std::vector<int> order;
+  const int epochs = 10;
+  for (int epoch = firstEpoch; epoch < epochs; epoch++) {
+    std::mt19937 epochRng = rng;
+    bool resumedEpoch = resuming && epoch == resume.epoch;
+    std::future<int> pending;
+    if (stream) {
+      stream->start(false, rng());
+      pending = std::async(std::launch::async, [stream, &rounds] {
+        return stream->read(rounds[0]);
+      });
+    }
+    pipeline.resetStallSeconds();
     float totalLoss = 0.0f;
+    int trained = 0;
+    auto epochStart = std::chrono::high_resolution_clock::now();
     // Measure time each 1000 samples
     auto startTime = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < (int)trainData.size(); i++) {
-      const TrainItem& item = trainData[i];
-      Tensor3<float> output = net.forward(item.image);
-      net.backwards(output, item.label);
-      net.update(0.01f);
-
-      // Calculate loss (MSE)
-      float sampleLoss = 0.0f;
-      for (size_t j = 0; j < output.getWidth(); j++) {
-        float predicted = output.getValue(j, 0, 0);
-        float actual = const_cast<Tensor3<float>&>(item.label).getValue(j, 0, 0);
-        sampleLoss += (predicted - actual) * (predicted - actual);
+    // After the first samples every buffer has its final size, so this should stay at 0
+    size_t allocationsBefore = heapAllocationCount();
+    // Samples of the epoch in the rounds before this one
+    int done = 0;
+    for (int round = 0;; round++) {
+      int roundCount;
+      if (stream) {
+        roundCount = pending.get();
+        if (roundCount == 0) {
+          break;
+        }
+        // The shuffle buffer already drew them in random order
+        source = &rounds[round % 2];
+        permutation.resize(roundCount);
+        std::iota(permutation.begin(), permutation.end(), 0);
+        pending = std::async(std::launch::async, [stream, &rounds, round] {
+          return stream->read(rounds[(round + 1) % 2]);
+        });
+      } else {
+        if (round > 0) {
+          break;
+        }
+        // Shuffled from the split every time, so the order only depends on rng
+        permutation.assign(trainIndices.begin(), trainIndices.end());
+        std::shuffle(permutation.begin(), permutation.end(), rng);
+        roundCount = (int)permutation.size();
+      }
+      // Rounds the checkpoint had finished still take their draw, and the round it stopped
+      // in goes on from the chunk it stopped at
+      if (resumedEpoch && round < resume.round) {
+        rng();
+        done += roundCount;
+        continue;
+      }
+      int skip = resumedEpoch && round == resume.round ? resume.sample : 0;
+      // This rank's share of every chunk, in the order the pipeline hands out the batches
+      order.clear();
+      for (int start = skip; start < roundCount; start += chunk) {
+        // The last batch of the epoch takes whatever samples are left
+        int n = std::min(chunk, roundCount - start);
+        int first = start;
+        int count = n;
+        if (options.workers > 1) {
+          // Every rank needs a sample, a shorter tail is left out
+          if (n < options.workers) {
+            break;
+          }
+          first = start + (int)((long long)n * options.rank / options.workers);
+          count = start + (int)((long long)n * (options.rank + 1) / options.workers) - first;
+        }
+        order.insert(order.end(), permutation.begin() + first,
+                     permutation.begin() + first + count);
+      }
+      // Every chunk is one batch of this rank's
+      pipeline.startEpoch(order, options.async ? chunk : options.batchSize, rng(), skip / chunk);
+      int start = skip;
+      while (const BatchPipeline::Batch* batch = pipeline.next()) {
+        int n = std::min(chunk, roundCount - start);
+        int count = batch->images.getBatchSize();
+        const Tensor4<float>& batchImages = batch->images;
+        const Tensor4<float>& batchLabels = batch->labels;
+        const Tensor4<float>& output =
+            options.workers > 1 ? net.trainDistributed(batchImages, batchLabels, n)
+            : options.async     ? net.trainAsync(batchImages, batchLabels, options.batchSize)
+                                : net.trainBatch(batchImages, batchLabels);
+        trained += count;
+
+        // Calculate loss (MSE)
+        float sampleLoss = 0.0f;
+        for (int b = 0; b < count; b++) {
+          sampleLoss = 0.0f;
+          for (int j = 0; j < classes; j++) {
+            float predicted = output.getValues()[b * classes + j];
+            float actual = batchLabels.getValues()[b * classes + j];
+            sampleLoss += (predicted - actual) * (predicted - actual);
+          }
+          totalLoss += sampleLoss / output.getChannels();
+        }
+        int i = done + start + n - 1;
+        if (i / 1000 != (done + start - 1) / 1000 && i >= 1000) {
+          auto endTime = std::chrono::high_resolution_clock::now();
+          std::chrono::duration<double> elapsed = endTime - startTime;
+          size_t allocations = heapAllocationCount() - allocationsBefore;
+          std::cout << "Processed " << i << " samples in " << elapsed.count() << " seconds. "
+                    << " Sample loss: " << sampleLoss / output.getChannels()
+                    << " Heap allocations: " << allocations << std::endl;
+          allocationsBefore = heapAllocationCount();
+          startTime = std::chrono::high_resolution_clock::now();
+        }
+        start += chunk;
+        // Skipped while the last checkpoint is still being written, tried again next batch
+        if (checkpointer && ++sinceCheckpoint >= options.checkpointEvery) {
+          Checkpointer::Position position;
+          position.epoch = epoch;
+          position.round = start < roundCount ? round : round + 1;
+          position.sample = start < roundCount ? start : 0;
+          position.seed = seed;
+          position.rng = epochRng;
+          if (checkpointer->save(net, position)) {
+            sinceCheckpoint = 0;
+          }
+        }
       }
-      totalLoss += sampleLoss / output.getChannels();
-      if (i % 1000 == 0 && i > 0) {
-        auto endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> elapsed = endTime - startTime;
-        std::cout << "Processed " << i << " samples in " << elapsed.count() << " seconds. "
-                  << " Sample loss: " << sampleLoss / output.getChannels() << std::endl;
-        startTime = std::chrono::high_resolution_clock::now();
+      done += roundCount;
+    }
+    std::chrono::duration<double> epochTime =
+        std::chrono::high_resolution_clock::now() - epochStart;
+    // Stall is the time the training loop spent waiting for the pipeline
+    std::cout << "Epoch " << epoch + 1 << ", Loss: " << totalLoss / trained
+              << ", Samples/s: " << trainSize / epochTime.count()
+              << ", Pipeline stall: " << pipeline.getStallSeconds() << "s" << std::endl;
+    // Like the periodic checkpoints this doesn't wait for a write still in progress, the next
+    // batch tries again. Only the one after the last epoch waits, training being over.
+    if (checkpointer) {
+      Checkpointer::Position position;
+      position.epoch = epoch + 1;
+      position.seed = seed;
+      position.rng = rng;
+      if (epoch + 1 == epochs) {
+        checkpointer->wait();
       }
+      sinceCheckpoint = checkpointer->save(net, position) ? 0 : options.checkpointEvery;
     }
-    std::cout << "Epoch " << epoch + 1 << ", Loss: " << totalLoss / (trainData.size()) << std::endl;
-    std::shuffle(trainData.begin(), trainData.end(), rng);
-    trainData = augment_dataset(trainData, rng);
   }
   // Evaluate on test data
   int correct = 0;
-  for (const TrainItem& item : testData) {
-    Tensor3<float> output = net.forward(item.image);
+  int tested = 0;
+  Tensor3<float> input(28, 28, 1);
+  std::vector<float> expected(classes);
+  auto evaluate = [&](const Dataset& data, int index) {
+    data.loadSample(index, input.getValues(), expected.data());
+    const Tensor3<float>& output = net.forward(input);
     int predictedLabel = 0;
     float maxVal = output.getValue(0, 0, 0);
     for (size_t j = 1; j < (size_t)output.getWidth(); j++) {
@@ -264,19 +595,28 @@ void train_mode(Network& net, const std::vector<Tensor3<float>>& images,
         predictedLabel = j;
       }
     }
-    int actualLabel = 0;
-    for (size_t j = 0; j < (size_t)const_cast<Tensor3<float>&>(item.label).getWidth(); j++) {
-      if (const_cast<Tensor3<float>&>(item.label).getValue(j, 0, 0) == 1) {
-        actualLabel = j;
-        break;
-      }
-    }
-    if (predictedLabel == actualLabel) {
+    if (predictedLabel == data.getLabel(index)) {
       correct++;
     }
+    tested++;
+  };
+  if (samples) {
+    for (int index : testIndices) {
+      evaluate(*samples, index);
+    }
+  } else {
+    stream->start(true, rng());
+    while (int count = stream->read(rounds[0])) {
+      for (int index = 0; index < count; index++) {
+        evaluate(rounds[0], index);
+      }
+    }
+  }
+  std::cout << "Test Accuracy: " << (float)correct / tested * 100 << "%" << std::endl;
+  // The weights are the same on every rank
+  if (options.rank == 0) {
+    net.saveWeights(options.savePath);
   }
-  std::cout << "Test Accuracy: " << (float)correct / testData.size() * 100 << "%" << std::endl;
-  net.saveWeights(savePath);
 }
 
 void test_mode(Network& net) {
@@ -334,7 +674,7 @@ void test_mode(Network& net) {
             input.setValue(i % 28, i / 28, 0, (pixels[i] == 0xFFFFFFFF) ? 1.0f : 0.0f);
           }
 
-          Tensor3<float> output = net.forward(input);
+          const Tensor3<float>& output = net.forward(input);
           for (size_t i = 0; i < output.getWidth(); i++) {
             std::cout << i << ": " << std::fixed << std::setprecision(2)
                       << output.getValue(i, 0, 0) * 100 << "%" << std::endl;
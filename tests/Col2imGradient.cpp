@@ -0,0 +1,112 @@
+#include <ConvolutionalLayer.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks the im2col backward pass, whose input gradient col2im scatters back over the
+// strided and padded input, against central differences of the loss sum(output * weights)
+// for every stride from 1 to 4 and padding from 0 to 4. SIGMOID keeps the loss smooth.
+
+namespace {
+
+constexpr int FILTER_SIZE = 3;
+constexpr int DEPTH = 2;
+constexpr int FILTERS = 3;
+constexpr int WIDTH = 10;
+constexpr int HEIGHT = 9;
+constexpr float STEP = 1e-2f;
+// Central differences of a float loss are good to about 1e-4 of the gradient at this step
+constexpr double TOLERANCE = 2e-3;
+
+void fill(float* values, size_t count, std::mt19937& rng, float scale) {
+  std::normal_distribution<float> dist(0.0f, scale);
+  for (size_t i = 0; i < count; i++) {
+    values[i] = dist(rng);
+  }
+}
+
+double loss(ConvolutionalLayer& layer, const Tensor3<float>& input,
+            const Tensor3<float>& weights, size_t outputCount) {
+  layer.invalidateCaches();
+  TensorView<const float> output = layer.forward(input.view());
+  double sum = 0;
+  for (size_t i = 0; i < outputCount; i++) {
+    sum += (double)output.getValues()[i] * weights.getValues()[i];
+  }
+  return sum;
+}
+
+// Largest difference between analytic and the numeric derivative of the loss in each of
+// values, relative to the derivative where it is above 1
+double worstError(ConvolutionalLayer& layer, const Tensor3<float>& input,
+                  const Tensor3<float>& weights, size_t outputCount, float* values,
+                  const float* analytic, size_t count) {
+  double worst = 0;
+  for (size_t i = 0; i < count; i++) {
+    float original = values[i];
+    values[i] = original + STEP;
+    double above = loss(layer, input, weights, outputCount);
+    values[i] = original - STEP;
+    double below = loss(layer, input, weights, outputCount);
+    values[i] = original;
+    double numeric = (above - below) / (2 * STEP);
+    double error = std::fabs(analytic[i] - numeric) / std::max(1.0, std::fabs(numeric));
+    worst = std::max(worst, error);
+  }
+  return worst;
+}
+
+} // namespace
+
+int main() {
+  std::mt19937 rng(7);
+  bool ok = true;
+  for (int stride = 1; stride <= 4; stride++) {
+    for (int padding = 0; padding <= 4; padding++) {
+      ConvolutionalLayer layer(FILTER_SIZE, DEPTH, FILTERS, SIGMOID, stride, padding);
+      layer.setAlgorithm(IM2COL);
+      std::vector<MatrixView<float>> parameters;
+      layer.collectParameters(parameters);
+      for (MatrixView<float>& p : parameters) {
+        fill(p.getValues(), (size_t)p.getNumRows() * p.getNumCols(), rng, 0.5f);
+      }
+
+      int outW = (WIDTH + 2 * padding - FILTER_SIZE) / stride + 1;
+      int outH = (HEIGHT + 2 * padding - FILTER_SIZE) / stride + 1;
+      size_t inputCount = (size_t)WIDTH * HEIGHT * DEPTH;
+      size_t outputCount = (size_t)outW * outH * FILTERS;
+      Tensor3<float> input(WIDTH, HEIGHT, DEPTH);
+      Tensor3<float> weights(outW, outH, FILTERS);
+      fill(input.getValues(), inputCount, rng, 1.0f);
+      fill(weights.getValues(), outputCount, rng, 1.0f);
+
+      // The gradient of the loss with respect to the output is weights itself
+      layer.forward(input.view());
+      TensorView<const float> inputDeltas = layer.backwards(weights.view());
+      std::vector<float> inputGradient(inputDeltas.getValues(),
+                                       inputDeltas.getValues() + inputCount);
+      layer.clearGradients();
+      layer.accumulateGradients();
+      std::vector<MatrixView<float>> gradients;
+      layer.collectGradients(gradients);
+
+      double inputError = worstError(layer, input, weights, outputCount, input.getValues(),
+                                     inputGradient.data(), inputCount);
+      double filterError = 0;
+      for (size_t i = 0; i < parameters.size(); i++) {
+        size_t count = (size_t)parameters[i].getNumRows() * parameters[i].getNumCols();
+        filterError = std::max(filterError, worstError(layer, input, weights, outputCount,
+                                                       parameters[i].getValues(),
+                                                       gradients[i].getValues(), count));
+      }
+      bool passed = inputError <= TOLERANCE && filterError <= TOLERANCE;
+      std::cout << "stride " << stride << ", padding " << padding << ": input gradient "
+                << inputError << ", filter gradient " << filterError
+                << (passed ? "" : "  FAILED") << std::endl;
+      ok &= passed;
+    }
+  }
+  return ok ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include <ConvolutionalLayer.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Runs the same 3x3 layers through WINOGRAD and IM2COL and compares the output, the input
+// gradient and the parameter gradients. The MNIST model's layers take F(4x4, 3x3) on the
+// first layer and F(2x2, 3x3) on the second, the deeper shape shows how the error grows
+// with the number of channels summed.
+
+namespace {
+
+struct Shape {
+  int size;
+  int depth;
+  int filters;
+  int padding;
+};
+
+struct Error {
+  double absolute = 0;
+  double relative = 0;
+};
+
+// relative is the largest difference over the largest reference magnitude, so values that
+// happen to land near zero don't dominate it
+Error compare(const float* got, const float* expected, size_t count) {
+  Error error;
+  double largest = 0;
+  for (size_t i = 0; i < count; i++) {
+    error.absolute = std::max(error.absolute, (double)std::fabs(got[i] - expected[i]));
+    largest = std::max(largest, (double)std::fabs(expected[i]));
+  }
+  error.relative = largest > 0 ? error.absolute / largest : error.absolute;
+  return error;
+}
+
+void fill(float* values, size_t count, std::mt19937& rng, float scale) {
+  std::normal_distribution<float> dist(0.0f, scale);
+  for (size_t i = 0; i < count; i++) {
+    values[i] = dist(rng);
+  }
+}
+
+void fillParameters(ConvolutionalLayer& layer, std::mt19937& rng) {
+  std::vector<MatrixView<float>> parameters;
+  layer.collectParameters(parameters);
+  float scale = std::sqrt(1.0f / (9 * layer.getFilterDepth()));
+  for (MatrixView<float>& p : parameters) {
+    fill(p.getValues(), (size_t)p.getNumRows() * p.getNumCols(), rng, scale);
+  }
+  layer.invalidateCaches();
+}
+
+bool report(const char* what, Error error, double tolerance) {
+  bool ok = error.relative <= tolerance;
+  std::cout << "  " << what << ": max abs " << error.absolute << ", max rel " << error.relative
+            << (ok ? "" : "  FAILED") << std::endl;
+  return ok;
+}
+
+} // namespace
+
+int main() {
+  // F(4x4, 3x3) is about 10x less accurate than F(2x2, 3x3)
+  constexpr double F2_TOLERANCE = 1e-5;
+  constexpr double F4_TOLERANCE = 1e-4;
+  const Shape shapes[] = {{28, 1, 8, 0}, {13, 8, 16, 0}, {13, 8, 16, 1}, {34, 16, 32, 0}};
+  std::mt19937 rng(42);
+  bool ok = true;
+  for (Shape s : shapes) {
+    ConvolutionalLayer reference(3, s.depth, s.filters, NONE, 1, s.padding);
+    ConvolutionalLayer winograd(3, s.depth, s.filters, NONE, 1, s.padding);
+    reference.setAlgorithm(IM2COL);
+    winograd.setAlgorithm(WINOGRAD);
+    fillParameters(reference, rng);
+    winograd.copyParameters(reference);
+
+    int outSize = s.size + 2 * s.padding - 2;
+    Tensor3<float> input(s.size, s.size, s.depth);
+    Tensor3<float> deltas(outSize, outSize, s.filters);
+    size_t inputCount = (size_t)s.size * s.size * s.depth;
+    size_t outputCount = (size_t)outSize * outSize * s.filters;
+    fill(input.getValues(), inputCount, rng, 1.0f);
+    fill(deltas.getValues(), outputCount, rng, 1.0f);
+
+    // Square outputs of 16 or more take the 4x4 tiles
+    int tile = outSize >= 16 ? 4 : 2;
+    double tolerance = tile == 4 ? F4_TOLERANCE : F2_TOLERANCE;
+    std::cout << s.size << "x" << s.size << "x" << s.depth << " -> " << s.filters
+              << " filters, padding " << s.padding << ", F(" << tile << "x" << tile
+              << ", 3x3)" << std::endl;
+
+    TensorView<const float> expected = reference.forward(input.view());
+    TensorView<const float> got = winograd.forward(input.view());
+    ok &= report("output", compare(got.getValues(), expected.getValues(), outputCount),
+                 tolerance);
+    TensorView<const float> expectedDeltas = reference.backwards(deltas.view());
+    TensorView<const float> gotDeltas = winograd.backwards(deltas.view());
+    ok &= report("input gradient",
+                 compare(gotDeltas.getValues(), expectedDeltas.getValues(), inputCount),
+                 tolerance);
+
+    reference.clearGradients();
+    winograd.clearGradients();
+    reference.accumulateGradients();
+    winograd.accumulateGradients();
+    std::vector<MatrixView<float>> expectedGradients;
+    std::vector<MatrixView<float>> gotGradients;
+    reference.collectGradients(expectedGradients);
+    winograd.collectGradients(gotGradients);
+    const char* names[] = {"filter gradient", "bias gradient"};
+    for (size_t i = 0; i < gotGradients.size(); i++) {
+      size_t count = (size_t)gotGradients[i].getNumRows() * gotGradients[i].getNumCols();
+      ok &= report(names[i],
+                   compare(gotGradients[i].getValues(), expectedGradients[i].getValues(), count),
+                   tolerance);
+    }
+    if (reference.getAlgorithm() != IM2COL || winograd.getAlgorithm() != WINOGRAD) {
+      std::cout << "  ran with the wrong algorithm  FAILED" << std::endl;
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}
\ No newline at end of file